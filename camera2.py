@@ -8,13 +8,147 @@ import numpy as np
 from ultralytics import YOLO
 from tkinter import *
 from PIL import Image, ImageTk
-from collections import defaultdict
+from collections import defaultdict, deque, namedtuple
 from matplotlib.backends.backend_tkagg import FigureCanvasTkAgg
 import matplotlib.pyplot as plt
+import argparse
+import glob
+import json
+import queue
+import shutil
+import struct
+import threading
 import time
+import uuid
 
-# === 模型初始化 ===
-model = YOLO("best.pt")  # 請換成你的模型路徑
+# === 模型初始化：可選推論後端，匯出一次後快取在 exports/，下次啟動直接載入 ===
+MODEL_PATH = "best.pt"  # 請換成你的模型路徑
+EXPORT_DIR = "exports"
+BACKENDS = ("pytorch", "onnx", "openvino")
+CALIBRATION_DATA = "data.yaml"  # OpenVINO INT8 量化用的校正資料集，填訓練時的 data.yaml
+BENCHMARK_FOLDER = "photo/detect_snapshots"
+
+parser = argparse.ArgumentParser(description="智慧垃圾分類系統")
+parser.add_argument("--backend", choices=BACKENDS, default="pytorch", help="推論後端")
+parser.add_argument("--imgsz", type=int, default=640, help="模型輸入解析度")
+parser.add_argument("--int8", action="store_true", help="匯出時做 INT8 量化（onnx、openvino）")
+parser.add_argument("--threads", type=int, default=0, help="推論執行緒數，0 為後端預設")
+parser.add_argument("--benchmark", nargs="*", choices=BACKENDS, metavar="BACKEND",
+                    help=f"在 {BENCHMARK_FOLDER} 的影像上量測各後端的延遲與 FPS 後結束，未指定時量測全部後端")
+parser.add_argument("--bench-images", type=int, default=50, help="benchmark 最多使用幾張影像")
+args = parser.parse_args()
+
+def export_path(backend, imgsz, int8):
+    """匯出模型的快取路徑，解析度與量化不同的版本分開存放"""
+    stem = os.path.splitext(os.path.basename(MODEL_PATH))[0] + f"_{imgsz}" + ("_int8" if int8 else "")
+    if backend == "onnx":
+        return os.path.join(EXPORT_DIR, stem + ".onnx")
+    return os.path.join(EXPORT_DIR, stem + "_openvino_model")  # ultralytics 以這個結尾辨認 OpenVINO 模型
+
+def export_model(backend, imgsz, int8, path):
+    """把 PyTorch 模型匯出成 CPU 推論格式並搬到快取路徑"""
+    print(f"⏳ 匯出 {backend} 模型（只需一次）: {path}")
+    os.makedirs(EXPORT_DIR, exist_ok=True)
+    source = YOLO(MODEL_PATH)
+    if backend == "onnx":
+        exported = source.export(format="onnx", imgsz=imgsz)
+        if not int8:
+            shutil.move(exported, path)
+            return
+        # ONNX 做動態 INT8 量化（權重量化，不需校正資料），再補回 ultralytics 的類別名稱等資訊
+        import onnx
+        from onnxruntime.quantization import QuantType, quantize_dynamic
+        quantize_dynamic(exported, path, weight_type=QuantType.QUInt8)
+        quantized = onnx.load(path)
+        del quantized.metadata_props[:]
+        quantized.metadata_props.extend(onnx.load(exported).metadata_props)
+        onnx.save(quantized, path)
+        os.remove(exported)
+    else:
+        options = {"int8": True, "data": CALIBRATION_DATA} if int8 else {}
+        exported = source.export(format="openvino", imgsz=imgsz, **options)
+        shutil.move(exported, path)
+
+def limit_threads(detector, backend, path, threads):
+    """設定推論執行緒數；ONNX Runtime 與 OpenVINO 的執行緒池由 ultralytics 建立，需重建一次"""
+    import torch
+    torch.set_num_threads(threads)
+    if backend == "pytorch":
+        return
+    runtime = detector.predictor.model
+    try:
+        if backend == "onnx":
+            import onnxruntime as ort
+            options = ort.SessionOptions()
+            options.intra_op_num_threads = threads
+            runtime.session = ort.InferenceSession(path, options, providers=runtime.session.get_providers())
+        else:
+            import openvino as ov
+            core = ov.Core()
+            xml = glob.glob(os.path.join(path, "*.xml"))[0]
+            runtime.ov_compiled_model = core.compile_model(
+                core.read_model(xml), "CPU", {"INFERENCE_NUM_THREADS": threads, "PERFORMANCE_HINT": "LATENCY"})
+    except (AttributeError, ImportError) as e:
+        print(f"⚠️ 無法設定 {backend} 執行緒數: {e}")
+
+def load_detector(backend, imgsz, int8, threads):
+    """載入選定後端的模型，沒有快取時先匯出；回傳暖機過的模型"""
+    if backend == "pytorch":
+        path = MODEL_PATH
+        detector = YOLO(path)
+    else:
+        path = export_path(backend, imgsz, int8)
+        if not os.path.exists(path):
+            export_model(backend, imgsz, int8, path)
+        detector = YOLO(path, task="detect")
+    # 暖機一次建立 predictor，第一張影格不會多花載入時間
+    detector(np.zeros((imgsz, imgsz, 3), np.uint8), imgsz=imgsz, verbose=False)
+    if threads:
+        limit_threads(detector, backend, path, threads)
+    return detector
+
+def top_label(results):
+    """信心值最高的方框類別，沒有方框時回傳 None"""
+    if len(results.boxes) == 0:
+        return None
+    return results.names[int(results.boxes.cls[int(results.boxes.conf.argmax())])]
+
+def run_benchmark(backends):
+    """逐一量測各後端每張影像的延遲與 FPS，並與第一個後端比對最高分類別是否一致"""
+    paths = sorted(glob.glob(os.path.join(BENCHMARK_FOLDER, "*.jpg")))[:args.bench_images]
+    images = [image for image in (cv2.imread(p) for p in paths) if image is not None]
+    if not images:
+        print(f"⚠️ {BENCHMARK_FOLDER} 沒有影像可量測")
+        return
+    print(f"📊 {len(images)} 張影像，imgsz={args.imgsz}，int8={args.int8}，threads={args.threads or '預設'}")
+    print(f"{'backend':<10}{'mean ms':>9}{'p50 ms':>9}{'p95 ms':>9}{'FPS':>8}{'一致':>8}")
+    reference = None
+    for backend in backends:
+        try:
+            detector = load_detector(backend, args.imgsz, args.int8, args.threads)
+        except Exception as e:
+            print(f"{backend:<10}無法載入: {e}")
+            continue
+        latencies, labels = [], []
+        for image in images:
+            start = time.perf_counter()
+            results = detector(image, imgsz=args.imgsz, verbose=False)[0]
+            latencies.append((time.perf_counter() - start) * 1000)
+            labels.append(top_label(results))
+        if reference is None:
+            reference = labels
+        agreement = sum(a == b for a, b in zip(labels, reference)) / len(labels)
+        ordered = sorted(latencies)
+        mean = sum(latencies) / len(latencies)
+        print(f"{backend:<10}{mean:>9.1f}{ordered[len(ordered) // 2]:>9.1f}"
+              f"{ordered[int(len(ordered) * 0.95)]:>9.1f}{1000 / mean:>8.1f}{agreement:>8.0%}")
+
+if args.benchmark is not None:
+    run_benchmark(args.benchmark or BACKENDS)
+    raise SystemExit(0)
+
+model = load_detector(args.backend, args.imgsz, args.int8, args.threads)
+print(f"✅ 推論後端: {args.backend}（imgsz={args.imgsz}{'，INT8' if args.int8 and args.backend != 'pytorch' else ''}）")
 
 # === 自動搜尋可用串口（for macOS） ===
 def find_serial_port():
@@ -35,14 +169,459 @@ except serial.SerialException:
     print(f"⚠️ 無法連接到序列埠: {port_name}")
     ser = None
 
+# === 二進位序列協定（與韌體 src/include/arm_protocol.h 對應） ===
+# 封包格式：SOF | length | seq | address | type | payload | crc16（little endian）
+# address 為手臂位址，一塊板子驅動多支手臂時用來選擇分類站
+PROTO_SOF = 0xA5
+PROTO_MAX_PAYLOAD = 32
+PROTO_JOB = 0x01
+PROTO_PING = 0x02
+PROTO_SPEC = 0x03
+PROTO_CONFIRM = 0x04
+PROTO_CANCEL = 0x05
+PROTO_ACK = 0x81
+PROTO_BUSY = 0x82
+PROTO_DONE = 0x83
+PROTO_ERROR = 0x84
+PROTO_ERROR_CRC = 0x01
+PROTO_ADDRESS_NONE = 0xFF  # 不屬於任何分類站的回覆（CRC 錯誤的封包無法判斷是誰送的）
+ARM_ADDRESS = 0  # 這台相機負責的分類站
+
+def crc16_ccitt(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+def encode_frame(seq, frame_type, payload=b"", address=0):
+    if len(payload) > PROTO_MAX_PAYLOAD:
+        raise ValueError("payload too long")
+    body = bytes([len(payload), seq & 0xFF, address & 0xFF, frame_type]) + bytes(payload)
+    return bytes([PROTO_SOF]) + body + struct.pack("<H", crc16_ccitt(body))
+
+class ArmLink:
+    """透過序列埠送出分類工作，並在背景執行緒解析手臂回傳的 ACK/BUSY/DONE 狀態封包"""
+
+    def __init__(self, serial_port, address=0):
+        self.ser = serial_port
+        self.address = address
+        self.lock = threading.Lock()
+        self.seq = 0
+        self.free_slots = None      # 手臂還能接受的工作數，None 表示尚未收到回覆
+        self.in_flight = {}         # (seq, index) -> 送出時間
+        self.last_done = None       # (seq, index, 手臂時間 ms, 主機耗時 s)
+        self.speculative = None     # 等待確認的推測工作 (seq, 暫定指令)
+        self.running = True
+        self.reader = threading.Thread(target=self._read_loop, daemon=True)
+        self.reader.start()
+        self.ping()
+
+    def _send(self, frame_type, payload=b""):
+        with self.lock:
+            seq = self.seq
+            self.seq = (self.seq + 1) & 0xFF
+        self.ser.write(encode_frame(seq, frame_type, payload, self.address))
+        return seq
+
+    def ping(self):
+        return self._send(PROTO_PING)
+
+    def send_jobs(self, actions):
+        """一個封包送出多個分類工作，actions 為 object_to_action 中的指令字元"""
+        payload = "".join(actions).encode()
+        now = time.time()
+        seq = self._send(PROTO_JOB, payload)
+        with self.lock:
+            for index in range(len(actions)):
+                self.in_flight[(seq, index)] = now
+        return seq
+
+    def send_speculative(self, action):
+        """依暫定辨識結果先送出推測工作，手臂先夾取並移到分類箱上方，確認前不會放開"""
+        now = time.time()
+        seq = self._send(PROTO_SPEC, action.encode())
+        with self.lock:
+            self.in_flight[(seq, 0)] = now
+            self.speculative = (seq, action)
+        return seq
+
+    def confirm(self, action):
+        """以最終辨識結果確認推測工作，分類箱不同時手臂在移動途中改變目標"""
+        with self.lock:
+            self.speculative = None
+        return self._send(PROTO_CONFIRM, action.encode())
+
+    def cancel(self):
+        """取消推測工作，已夾起的物品會放回夾取點"""
+        with self.lock:
+            if self.speculative:
+                self.in_flight.pop((self.speculative[0], 0), None)
+            self.speculative = None
+        return self._send(PROTO_CANCEL)
+
+    def has_speculative(self):
+        with self.lock:
+            return self.speculative is not None
+
+    def is_available(self):
+        with self.lock:
+            return self.free_slots is None or self.free_slots > 0
+
+    def pending(self):
+        with self.lock:
+            return len(self.in_flight)
+
+    def _read_loop(self):
+        buffer = bytearray()
+        while self.running:
+            try:
+                data = self.ser.read(self.ser.in_waiting or 1)
+            except (serial.SerialException, OSError, TypeError):
+                break
+            if not data:
+                continue
+            buffer.extend(data)
+            # 韌體的文字輸出會夾在封包之間，找不到 SOF 的部分直接丟棄
+            while True:
+                start = buffer.find(PROTO_SOF)
+                if start < 0:
+                    buffer.clear()
+                    break
+                del buffer[:start]
+                if len(buffer) < 5:
+                    break
+                length = buffer[1]
+                if length > PROTO_MAX_PAYLOAD:
+                    del buffer[0]
+                    continue
+                total = 5 + length + 2
+                if len(buffer) < total:
+                    break
+                body = bytes(buffer[1:5 + length])
+                crc = struct.unpack("<H", buffer[5 + length:total])[0]
+                if crc != crc16_ccitt(body):
+                    del buffer[0]
+                    continue
+                del buffer[:total]
+                # 其他分類站的回覆不屬於這條連線
+                if body[2] != self.address and body[2] != PROTO_ADDRESS_NONE:
+                    continue
+                self._handle_frame(body[1], body[3], body[4:])
+
+    def _handle_frame(self, seq, frame_type, payload):
+        with self.lock:
+            if frame_type in (PROTO_ACK, PROTO_BUSY) and len(payload) >= 6:
+                accepted, free_slots, _ = struct.unpack("<BBI", payload[:6])
+                self.free_slots = free_slots
+                if frame_type == PROTO_BUSY:
+                    # 未被接受的工作不會執行，從追蹤表移除
+                    for key in [k for k in self.in_flight if k[0] == seq and k[1] >= accepted]:
+                        del self.in_flight[key]
+                    if self.speculative and self.speculative[0] == seq:
+                        self.speculative = None
+            elif frame_type == PROTO_DONE and len(payload) >= 5:
+                index, arm_ms = struct.unpack("<BI", payload[:5])
+                sent = self.in_flight.pop((seq, index), None)
+                self.last_done = (seq, index, arm_ms, time.time() - sent if sent else None)
+                if self.free_slots is not None:
+                    self.free_slots += 1
+            elif frame_type == PROTO_ERROR and payload[:1] == bytes([PROTO_ERROR_CRC]):
+                # 無法判斷是哪個封包出錯，不清除任何追蹤；遺失的工作不會收到 ACK 或 DONE
+                print("⚠️ 手臂收到 CRC 錯誤的封包")
+            elif frame_type == PROTO_ERROR:
+                for key in [k for k in self.in_flight if k[0] == seq]:
+                    del self.in_flight[key]
+                if self.speculative and self.speculative[0] == seq:
+                    self.speculative = None
+                print(f"⚠️ 手臂拒絕封包 seq={seq}: {payload.hex()}")
+
+    def close(self):
+        self.running = False
+
+arm = ArmLink(ser, ARM_ADDRESS) if ser else None
+
 # === 相機初始化 ===
 cap = cv2.VideoCapture(0)
 
+# === 擷取與推論管線：擷取執行緒只留最新影格，推論執行緒發布最新偵測結果，UI 執行緒只負責繪製 ===
+# 一筆偵測結果；boxes 為 (類別, 信心值, (x1, y1, x2, y2)) 的清單，與 ultralytics 的結果物件脫鉤
+# gate 為動態閘門的狀態，閘門未開時不跑模型，boxes 為空清單
+Detection = namedtuple("Detection", "frame_id frame captured_at inferred_at inference_s boxes gate")
+
+# 拍照時最新偵測結果的影格若比這更舊，就等下一筆結果，避免用到物品放上之前的畫面
+SNAPSHOT_MAX_AGE_S = 0.3
+# 等待下一筆偵測結果的上限
+SNAPSHOT_WAIT_S = 2.0
+# 等待期間檢查偵測結果的間隔，UI 執行緒不阻塞
+SNAPSHOT_POLL_MS = 20
+
+class FrameGrabber:
+    """背景持續讀取相機，只保留最新一張影格；來不及處理的舊影格直接丟棄，畫面不會越來越延遲"""
+
+    def __init__(self, capture):
+        self.capture = capture
+        self.cond = threading.Condition()
+        self.frame = None
+        self.frame_id = 0
+        self.captured_at = 0
+        self.running = True
+        self.thread = threading.Thread(target=self._loop, daemon=True)
+        self.thread.start()
+
+    def _loop(self):
+        while self.running:
+            ret, frame = self.capture.read()
+            if not ret:
+                time.sleep(0.01)
+                continue
+            with self.cond:
+                self.frame = frame
+                self.frame_id += 1
+                self.captured_at = time.time()
+                self.cond.notify_all()
+
+    def latest(self):
+        """回傳 (影格編號, 影格, 擷取時間)，尚未取得影格時影格為 None"""
+        with self.cond:
+            return self.frame_id, self.frame, self.captured_at
+
+    def wait_newer(self, frame_id, timeout):
+        """等到有比 frame_id 更新的影格，逾時回傳目前最新的影格"""
+        with self.cond:
+            self.cond.wait_for(lambda: self.frame_id != frame_id or not self.running, timeout)
+            return self.frame_id, self.frame, self.captured_at
+
+    def stop(self):
+        self.running = False
+        with self.cond:
+            self.cond.notify_all()
+        self.thread.join(timeout=1)
+
+def boxes_from_results(results, names, offset=(0, 0)):
+    """把 ultralytics 的偵測結果轉成 (類別, 信心值, 方框) 清單，offset 為裁切區在原影格中的左上角"""
+    boxes = []
+    dx, dy = offset
+    for box in results.boxes:
+        x1, y1, x2, y2 = map(int, box.xyxy[0])
+        boxes.append((names[int(box.cls[0])], float(box.conf[0]), (x1 + dx, y1 + dy, x2 + dx, y2 + dy)))
+    return boxes
+
+class InferenceWorker:
+    """推論執行緒：每次取最新影格跑一次模型，只保留最新一筆帶時間戳記的偵測結果"""
+
+    def __init__(self, grabber, detector, gate=None, imgsz=640):
+        self.grabber = grabber
+        self.detector = detector
+        self.imgsz = imgsz
+        self.gate = gate
+        self.cond = threading.Condition()
+        self.detection = None
+        self.running = True
+        self.thread = threading.Thread(target=self._loop, daemon=True)
+        self.thread.start()
+
+    def _loop(self):
+        last_id = 0
+        while self.running:
+            frame_id, frame, captured_at = self.grabber.wait_newer(last_id, 0.5)
+            if frame is None or frame_id == last_id:
+                continue
+            last_id = frame_id
+            start = time.time()
+            if self.gate is None:
+                results = self.detector(frame, imgsz=self.imgsz, verbose=False)[0]
+                boxes = boxes_from_results(results, self.detector.names)
+                state = "off"
+            elif self.gate.update(frame):
+                # 只對投放區裁切後的影像跑模型，方框再換回原影格座標
+                x1, y1, x2, y2 = self.gate.roi_box(frame)
+                results = self.detector(frame[y1:y2, x1:x2], imgsz=self.imgsz, verbose=False)[0]
+                boxes = boxes_from_results(results, self.detector.names, (x1, y1))
+                state = self.gate.state
+                self.gate.report(boxes)
+            else:
+                boxes = []
+                state = self.gate.state
+            now = time.time()
+            detection = Detection(frame_id, frame, captured_at, now, now - start, boxes, state)
+            with self.cond:
+                self.detection = detection
+                self.cond.notify_all()
+
+    def latest(self):
+        with self.cond:
+            return self.detection
+
+    def stop(self):
+        self.running = False
+        with self.cond:
+            self.cond.notify_all()
+        self.thread.join(timeout=5)
+
+# === 動態閘門：在降採樣的灰階投放區上做影格差分，物品放入且靜止後才跑模型 ===
+GATE_ENABLED = True
+GATE_ROI = (0.2, 0.2, 0.8, 0.95)   # 投放區 (x1, y1, x2, y2)，以畫面寬高的比例表示
+GATE_SCALE = 0.25                  # 閘門影像的降採樣比例
+GATE_DIFF_THRESHOLD = 25           # 灰階差超過此值的像素視為有變化
+GATE_MOTION_RATIO = 0.02           # 與上一張相比變化的像素比例超過此值，視為還在移動
+GATE_PRESENT_RATIO = 0.05          # 與背景相比不同的像素比例超過此值，視為投放區有物品
+GATE_SETTLE_FRAMES = 3             # 連續幾張沒有移動才視為物品已放穩
+GATE_BACKGROUND_ALPHA = 0.05       # 投放區空著時背景的更新速度，跟上光線的緩慢變化
+GATE_RESEED_FRAMES = 15            # 放穩後連續幾張模型都沒偵測到物品，就把目前畫面當成新背景
+
+class MotionGate:
+    """便宜的前置判斷：投放區空著或物品還在移動時不跑模型，物品放穩後才開閘"""
+
+    def __init__(self):
+        self.background = None
+        self.previous = None
+        self.still = 0
+        self.state = "empty"
+        self.unseen = 0
+
+    @staticmethod
+    def roi_box(frame):
+        """投放區在影格中的像素座標 (x1, y1, x2, y2)"""
+        h, w = frame.shape[:2]
+        x1, y1, x2, y2 = GATE_ROI
+        return int(x1 * w), int(y1 * h), int(x2 * w), int(y2 * h)
+
+    def update(self, frame):
+        """餵入一張影格，回傳是否該對這張影格跑模型"""
+        x1, y1, x2, y2 = self.roi_box(frame)
+        gray = cv2.cvtColor(frame[y1:y2, x1:x2], cv2.COLOR_BGR2GRAY)
+        small = cv2.resize(gray, None, fx=GATE_SCALE, fy=GATE_SCALE, interpolation=cv2.INTER_AREA)
+        small = cv2.GaussianBlur(small, (5, 5), 0)
+        if self.background is None or self.background.shape != small.shape:
+            self.background = small.astype(np.float32)
+            self.previous = small
+            self.still = 0
+            return False
+        motion = np.count_nonzero(cv2.absdiff(small, self.previous) > GATE_DIFF_THRESHOLD) / small.size
+        present = np.count_nonzero(cv2.absdiff(small, cv2.convertScaleAbs(self.background)) > GATE_DIFF_THRESHOLD) / small.size
+        self.previous = small
+        if motion > GATE_MOTION_RATIO:
+            self.still = 0
+            self.unseen = 0
+            self.state = "moving"
+            return False
+        self.still += 1
+        if present < GATE_PRESENT_RATIO:
+            cv2.accumulateWeighted(small, self.background, GATE_BACKGROUND_ALPHA)
+            self.state = "empty"
+            return False
+        if self.still < GATE_SETTLE_FRAMES:
+            self.state = "settling"
+            return False
+        self.state = "settled"
+        return True
+
+    def report(self, boxes):
+        """回報放穩影格的偵測結果；啟動時已有物品或光線突然改變時背景會一直不同，
+        靜止且模型一直沒看到物品就以目前畫面重設背景，閘門才不會卡在放穩狀態"""
+        if boxes:
+            self.unseen = 0
+            return
+        self.unseen += 1
+        if self.unseen >= GATE_RESEED_FRAMES:
+            self.background = self.previous.astype(np.float32)
+            self.unseen = 0
+            self.still = 0
+            self.state = "empty"
+
+grabber = FrameGrabber(cap)
+worker = InferenceWorker(grabber, model, MotionGate() if GATE_ENABLED else None, args.imgsz)
+
 # === 儲存資料夾設定 ===
 save_folder = "photo/detect_snapshots"
 misclassified_folder =  "photo/misclassified"
 os.makedirs(save_folder, exist_ok=True)
 os.makedirs(misclassified_folder, exist_ok=True)
+# 每張存下的影像在索引檔追加一行 JSON，重新訓練時直接讀索引建資料集，不必掃描資料夾
+manifest_path = "photo/manifest.jsonl"
+WRITER_QUEUE_SIZE = 32     # 等待寫入的影像上限，佇列滿時丟棄新影像而不卡住畫面
+WRITER_BATCH = 8           # 寫入執行緒一次最多處理幾張，索引一次追加
+
+class DatasetWriter:
+    """背景寫入執行緒：JPEG 編碼、存檔並追加索引紀錄，UI 執行緒只負責排入佇列"""
+
+    def __init__(self, manifest):
+        self.manifest = manifest
+        self.queue = queue.Queue(maxsize=WRITER_QUEUE_SIZE)
+        # 啟動時間加隨機碼作為本次執行的前綴，再加流水號，重新啟動也不會覆蓋舊檔
+        self.session = time.strftime("%Y%m%d_%H%M%S") + "_" + uuid.uuid4().hex[:4]
+        self.count = 0
+        self.thread = threading.Thread(target=self._loop, daemon=True)
+        self.thread.start()
+
+    def submit(self, frame, folder, prefix, record):
+        """排入一張影像，回傳 (影像編號, 路徑)；佇列已滿時丟棄並回傳 (None, None)"""
+        self.count += 1
+        image_id = f"{self.session}_{self.count:04d}"
+        path = os.path.join(folder, f"{prefix}_{image_id}.jpg")
+        record = dict(record, id=image_id, path=path.replace(os.sep, "/"))
+        try:
+            self.queue.put_nowait((frame, path, record))
+        except queue.Full:
+            print(f"⚠️ 寫入佇列已滿，丟棄影像 {image_id}")
+            return None, None
+        return image_id, path
+
+    def _loop(self):
+        while True:
+            batch = [self.queue.get()]
+            while len(batch) < WRITER_BATCH:
+                try:
+                    batch.append(self.queue.get_nowait())
+                except queue.Empty:
+                    break
+            lines = []
+            stop = False
+            for item in batch:
+                if item is None:
+                    stop = True
+                    continue
+                frame, path, record = item
+                ok, data = cv2.imencode(".jpg", frame)
+                if not ok:
+                    print(f"⚠️ 影像編碼失敗: {path}")
+                    continue
+                # 磁碟已滿或沒有權限時只丟棄這一張，寫入執行緒繼續處理後面的影像
+                try:
+                    os.makedirs(os.path.dirname(path), exist_ok=True)
+                    with open(path, "wb") as f:
+                        f.write(data.tobytes())
+                except OSError as e:
+                    print(f"⚠️ 影像寫入失敗: {path}: {e}")
+                    continue
+                lines.append(json.dumps(record, ensure_ascii=False) + "\n")
+            if lines:
+                # 影像寫完才追加索引，索引裡的每一筆都找得到檔案
+                try:
+                    with open(self.manifest, "a", encoding="utf-8") as f:
+                        f.writelines(lines)
+                except OSError as e:
+                    print(f"⚠️ 索引寫入失敗，{len(lines)} 筆紀錄遺失: {e}")
+            if stop:
+                return
+
+    def stop(self):
+        """寫完佇列中剩下的影像後結束；佇列卡住時不無限等待，避免關閉視窗時當住"""
+        if not self.thread.is_alive():
+            return
+        try:
+            self.queue.put(None, timeout=5)
+        except queue.Full:
+            print("⚠️ 寫入佇列未清空，放棄剩下的影像")
+            return
+        self.thread.join(timeout=10)
+
+def boxes_record(boxes):
+    return [{"label": label, "conf": round(conf, 4), "box": list(box)} for label, conf, box in boxes]
+
+writer = DatasetWriter(manifest_path)
 
 # === 分類對應指令 ===
 object_to_action = {
@@ -52,14 +631,73 @@ object_to_action = {
     "paper": "P"
 }
 
-snapshot_count = 0
+# 即時畫面的信心值達到門檻就先送出推測工作，拍照確認時手臂已在途中
+SPECULATIVE_CONF = 0.6
+# 確認或取消後隔一段時間才再送推測工作，避免同一個物品被重複推測
+SPECULATIVE_COOLDOWN_S = 2.0
+last_decision_time = 0
+
+# === 自動觸發：以滑動視窗內多張影格的信心值加權投票，達門檻就自動送出指令 ===
+AUTO_TRIGGER = True
+VOTE_WINDOW = 8            # 投票視窗的影格數
+VOTE_MIN_FRAMES = 4        # 視窗內至少幾張影格才投票
+VOTE_MIN_BOX_CONF = 0.3    # 低於此信心值的方框不參與投票
+VOTE_CONF = 0.6            # 勝出類別在視窗內的平均信心值門檻（沒偵測到的影格以 0 計）
+VOTE_AGREEMENT = 0.7       # 勝出類別占全部票數（信心值總和）的比例門檻
+
+class VoteWindow:
+    """保留最近幾張影格各類別的最高信心值，以信心值加權投票決定分類"""
+
+    def __init__(self):
+        self.frames = deque(maxlen=VOTE_WINDOW)
+        self.arrived_at = None
+
+    def reset(self):
+        self.frames.clear()
+        self.arrived_at = None
+
+    def add(self, detection, arrived_at):
+        """加入一張影格的偵測結果，arrived_at 為物品進入畫面的時間，只記第一次"""
+        votes = {}
+        for label, conf, _ in detection.boxes:
+            if label in object_to_action and conf >= VOTE_MIN_BOX_CONF:
+                votes[label] = max(votes.get(label, 0), conf)
+        if self.arrived_at is None:
+            self.arrived_at = arrived_at
+        self.frames.append(votes)
+
+    def decide(self):
+        """回傳 (類別, 平均信心值, 一致比例)，未達門檻回傳 None"""
+        if len(self.frames) < VOTE_MIN_FRAMES:
+            return None
+        scores = defaultdict(float)
+        for votes in self.frames:
+            for label, conf in votes.items():
+                scores[label] += conf
+        total = sum(scores.values())
+        if total <= 0:
+            return None
+        label = max(scores, key=scores.get)
+        conf = scores[label] / len(self.frames)
+        agreement = scores[label] / total
+        if conf >= VOTE_CONF and agreement >= VOTE_AGREEMENT:
+            return label, conf, agreement
+        return None
+
+vote_window = VoteWindow()
+arrival_time = None        # 目前物品進入投放區的時間
+vote_done = False          # 目前物品已決定過，等投放區清空再投下一個
+decision_latencies = []
+
 total_counts = defaultdict(int)
 latest_snapshot = None
 latest_label = ""
 latest_conf = 0
-latest_results = None
+latest_boxes = []
+latest_record = None       # 最新快照的索引紀錄，標記誤判時引用
 prev_frame_time = 0
 new_frame_time = 0
+last_detection_id = 0
 
 # === 建立主視窗 ===
 window = Tk()
@@ -131,6 +769,10 @@ wrong_btn = Button(right_frame, text="❌ 標記為誤判", font=("Arial", 12),
                    command=lambda: save_wrong_prediction())
 wrong_btn.pack(pady=5)
 
+auto_var = BooleanVar(value=AUTO_TRIGGER)
+auto_check = Checkbutton(right_frame, text="🤖 自動觸發", font=("Arial", 12), bg="#ecf0f1", variable=auto_var)
+auto_check.pack(pady=5)
+
 # === 更新統計圖 ===
 def update_bar_chart():
     ax.clear()
@@ -146,51 +788,94 @@ def update_bar_chart():
 
 # === 拍照傳送 ===
 def capture_snapshot():
-    global snapshot_count, latest_snapshot, latest_label, latest_conf, latest_results
-    ret, frame = cap.read()
-    if not ret:
+    # 直接使用推論執行緒對目前畫面的結果，不再多跑一次模型；結果不夠新時以 window.after 輪詢，不阻塞 UI
+    btn.config(state=DISABLED)
+    poll_snapshot(time.time() + SNAPSHOT_WAIT_S)
+
+def poll_snapshot(deadline):
+    detection = worker.latest()
+    fresh = detection is not None and time.time() - detection.captured_at <= SNAPSHOT_MAX_AGE_S
+    # 閘門未開時模型沒有跑，空的 boxes 不代表沒有物品，要等物品放穩的結果
+    settled = detection is not None and detection.gate in ("off", "settled")
+    if not (fresh and settled) and time.time() < deadline:
+        window.after(SNAPSHOT_POLL_MS, poll_snapshot, deadline)
+        return
+    # 逾時就用最新的一筆
+    btn.config(state=NORMAL)
+    if detection is None:
         status_label.config(text="❌ 拍照失敗", fg="red")
         return
-
-    results = model(frame, verbose=False)[0]
+    if not settled:
+        # 不當成無效物件：不存檔、不取消已送出的推測工作
+        status_label.config(text="⏳ 投放區沒有放穩的物品，請稍後再拍", fg="orange")
+        return
     best_label, best_conf = None, 0
 
-    for box in results.boxes:
-        cls = int(box.cls[0])
-        label = model.names[cls]
-        conf = float(box.conf[0])
+    for label, conf, _ in detection.boxes:
         if label in object_to_action and conf > best_conf:
             best_label, best_conf = label, conf
 
-    snapshot_count += 1
-    fname = f"{best_label or 'unknown'}_{snapshot_count:03d}.jpg"
-    cv2.imwrite(os.path.join(save_folder, fname), frame)
+    send_decision(detection, best_label, best_conf)
+
+# === 送出分類結果：存檔、傳送指令並更新快照與統計（手動拍照與自動觸發共用） ===
+# 回傳物品是否已決定；手臂忙碌沒送出工作時不計數也不存檔，回傳 False 讓呼叫端稍後重試
+def send_decision(detection, best_label, best_conf):
+    global latest_snapshot, latest_label, latest_conf, latest_boxes, latest_record, last_decision_time
+    frame = detection.frame
+    command = None
 
+    speculative = arm and ser.is_open and arm.has_speculative()
+    if speculative:
+        last_decision_time = time.time()
     if best_label:
         action = object_to_action[best_label]
-        if ser and ser.is_open:
-            ser.write((action + '\n').encode())
+        if speculative:
+            # 手臂已依暫定結果移動，確認最終分類箱
+            arm.confirm(action)
+            command = action
+            status_label.config(text=f"✅ 確認指令: {best_label}（排隊中 {arm.pending()}）", fg="green")
+        elif arm and ser.is_open:
+            if arm.is_available():
+                arm.send_jobs([action])
+                command = action
+                status_label.config(text=f"✅ 傳送指令: {best_label}（排隊中 {arm.pending()}）", fg="green")
+            else:
+                status_label.config(text=f"⏳ 手臂忙碌，未傳送: {best_label}", fg="orange")
+                return False
+        else:
+            status_label.config(text=f"✅ 辨識結果: {best_label}（未連接手臂）", fg="green")
         total_counts[best_label] += 1
         latest_label, latest_conf = best_label, best_conf * 100
-        status_label.config(text=f"✅ 傳送指令: {best_label}", fg="green")
     else:
-        if ser and ser.is_open:
-            ser.write(b'R\n')
+        # 無效物件不送出工作，手臂不會做多餘的夾取；已送出的推測工作取消
+        if speculative:
+            arm.cancel()
         latest_label, latest_conf = "None", 0
-        status_label.config(text="❎ 無效物件，發送重置", fg="orange")
+        status_label.config(text="❎ 無效物件，未傳送指令", fg="orange")
+
+    # 指令送出後才排入寫入佇列，存檔不會延誤手臂
+    latest_record = {
+        "kind": "snapshot",
+        "label": best_label,
+        "conf": round(best_conf, 4),
+        "boxes": boxes_record(detection.boxes),
+        "captured_at": round(detection.captured_at, 3),
+        "command": command,
+    }
+    image_id, _ = writer.submit(frame, save_folder, best_label or "unknown", latest_record)
+    latest_record["id"] = image_id
 
-    latest_snapshot = frame.copy()
-    latest_results = results
+    latest_snapshot = frame
+    latest_boxes = detection.boxes
     update_bar_chart()
     show_snapshot()
+    return True
 
 # === 顯示快照圖像 ===
 def show_snapshot():
-    if latest_snapshot is not None and latest_results is not None:
+    if latest_snapshot is not None:
         snap = latest_snapshot.copy()
-        for box in latest_results.boxes:
-            x1, y1, x2, y2 = map(int, box.xyxy[0])
-            label = model.names[int(box.cls[0])]
+        for label, _, (x1, y1, x2, y2) in latest_boxes:
             cv2.rectangle(snap, (x1, y1), (x2, y2), (255, 0, 0), 2)
             cv2.putText(snap, label, (x1, y1 - 5), cv2.FONT_HERSHEY_SIMPLEX, 0.6, (255, 0, 0), 2)
         img = Image.fromarray(cv2.cvtColor(snap, cv2.COLOR_BGR2RGB))
@@ -201,34 +886,120 @@ def show_snapshot():
 
 # === 儲存錯誤樣本 ===
 def save_wrong_prediction():
-    ret, frame = cap.read()
-    if not ret:
+    # 存下被誤判的那張快照；還沒拍過照時存目前畫面（相機由擷取執行緒獨佔，不直接讀取）
+    if latest_snapshot is not None:
+        frame, captured_at = latest_snapshot, latest_record["captured_at"]
+    else:
+        _, frame, captured_at = grabber.latest()
+    if frame is None:
         status_label.config(text="❌ 拍照失敗", fg="red")
         return
     label_folder = os.path.join(misclassified_folder, latest_label or "unknown")
-    os.makedirs(label_folder, exist_ok=True)
-    path = os.path.join(label_folder, f"wrong_{latest_label}_{snapshot_count}.jpg")
-    cv2.imwrite(path, frame)
+    record = {
+        "kind": "misclassified",
+        "label": latest_label if latest_label not in ("", "None") else None,
+        "conf": round(latest_conf / 100, 4),
+        "boxes": boxes_record(latest_boxes) if latest_snapshot is not None else [],
+        "captured_at": round(captured_at, 3),
+        "command": latest_record["command"] if latest_record else None,
+        "snapshot_id": latest_record["id"] if latest_record else None,
+    }
+    _, path = writer.submit(frame, label_folder, f"wrong_{latest_label}", record)
+    if path is None:
+        status_label.config(text="❌ 寫入佇列已滿，未儲存", fg="red")
+        return
     status_label.config(text=f"⚠️ 儲存錯誤樣本：{path}", fg="red")
 
-# === 更新即時畫面 + 等比例縮放 ===
+# === 自動觸發：每筆偵測結果加入投票視窗，達門檻就送出指令並記錄決策延遲 ===
+def auto_vote(detection):
+    global arrival_time, vote_done, last_decision_time
+    has_item = any(label in object_to_action for label, _, _ in detection.boxes)
+    if GATE_ENABLED:
+        # 投放區空著表示物品已取走；物品移動中不投票，放穩後重新累積
+        if detection.gate == "empty":
+            if arrival_time is not None and not vote_done and arm and ser.is_open and arm.has_speculative():
+                # 物品未決定就被取走，取消已送出的推測工作
+                arm.cancel()
+            arrival_time, vote_done = None, False
+            vote_window.reset()
+            return
+        if arrival_time is None:
+            arrival_time = detection.captured_at
+        if detection.gate != "settled":
+            vote_window.reset()
+            return
+    else:
+        # 沒有閘門時，以第一張偵測到物品的影格為到達時間，冷卻後才接受下一個物品
+        if arrival_time is None:
+            if not has_item or time.time() - last_decision_time < SPECULATIVE_COOLDOWN_S:
+                return
+            arrival_time, vote_done = detection.captured_at, False
+    if vote_done:
+        return
+
+    vote_window.add(detection, arrival_time)
+    decision = vote_window.decide()
+    if decision is None:
+        return
+    label, conf, agreement = decision
+    if not send_decision(detection, label, conf):
+        # 手臂沒有空位，繼續投票，下一張影格再送
+        return
+    vote_done = True
+    last_decision_time = time.time()
+    latency_ms = (time.time() - vote_window.arrived_at) * 1000
+    decision_latencies.append(latency_ms)
+    mean_ms = sum(decision_latencies) / len(decision_latencies)
+    print(f"🤖 自動觸發: {label} 信心值 {conf:.2f} 一致 {agreement:.0%} "
+          f"({len(vote_window.frames)} 張)，決策延遲 {latency_ms:.0f} ms（平均 {mean_ms:.0f} ms，共 {len(decision_latencies)} 次）")
+    vote_window.reset()
+    if not GATE_ENABLED:
+        arrival_time = None
+
+# === 新的偵測結果：自動觸發投票；暫定結果達門檻時先送出推測工作 ===
+def on_detection(detection):
+    if auto_var.get():
+        auto_vote(detection)
+        if vote_done:
+            return
+
+    spec_label, spec_conf = None, SPECULATIVE_CONF
+    for label, conf, _ in detection.boxes:
+        if label in object_to_action and conf >= spec_conf:
+            spec_label, spec_conf = label, conf
+
+    # 暫定結果先送出推測工作，手臂在拍照確認前就開始夾取
+    if (spec_label and arm and ser.is_open and not arm.has_speculative() and arm.is_available()
+            and time.time() - last_decision_time > SPECULATIVE_COOLDOWN_S):
+        arm.send_speculative(object_to_action[spec_label])
+        status_label.config(text=f"➡️ 預先移動: {spec_label}（等待確認）", fg="blue")
+
+# === 更新即時畫面 + 等比例縮放（只繪製，相機與模型都在背景執行緒） ===
 def update_video():
-    global prev_frame_time
-    ret, frame = cap.read()
-    if ret:
-        results = model(frame, verbose=False)[0]
-        for box in results.boxes:
-            x1, y1, x2, y2 = map(int, box.xyxy[0])
-            label = model.names[int(box.cls[0])]
-            conf = float(box.conf[0])
+    global prev_frame_time, last_detection_id
+    _, frame, _ = grabber.latest()
+    detection = worker.latest()
+    if detection is not None and detection.frame_id != last_detection_id:
+        last_detection_id = detection.frame_id
+        on_detection(detection)
+    if frame is not None:
+        # 最新影格疊上最新一筆偵測結果的方框與投放區
+        frame = frame.copy()
+        if GATE_ENABLED:
+            x1, y1, x2, y2 = MotionGate.roi_box(frame)
+            gate_state = detection.gate if detection else "empty"
+            cv2.rectangle(frame, (x1, y1), (x2, y2), (0, 255, 255), 1)
+            cv2.putText(frame, gate_state, (x1 + 5, y2 - 8), cv2.FONT_HERSHEY_SIMPLEX, 0.5, (0, 255, 255), 1)
+        for label, conf, (x1, y1, x2, y2) in (detection.boxes if detection else []):
             cv2.rectangle(frame, (x1, y1), (x2, y2), (0, 255, 0), 2)
             cv2.putText(frame, f"{label} {conf:.2f}", (x1, y1 - 10), cv2.FONT_HERSHEY_SIMPLEX, 0.6, (0, 255, 0), 2)
 
-        # FPS 顯示
+        # FPS 顯示：畫面更新率與推論耗時
         now = time.time()
         fps = 1 / (now - prev_frame_time + 1e-10)
         prev_frame_time = now
-        fps_label.config(text=f"FPS: {fps:.1f}")
+        infer_ms = detection.inference_s * 1000 if detection else 0
+        fps_label.config(text=f"FPS: {fps:.1f}  推論: {infer_ms:.0f} ms")
 
         # 等比例縮放
         rgb = cv2.cvtColor(frame, cv2.COLOR_BGR2RGB)
@@ -253,7 +1024,12 @@ def update_video():
 
 # === 關閉前釋放資源 ===
 def on_close():
+    worker.stop()
+    grabber.stop()
+    writer.stop()
     cap.release()
+    if arm:
+        arm.close()
     if ser and ser.is_open:
         ser.close()
     window.destroy()
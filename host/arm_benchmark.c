@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "robotic_arm.h"
+#include "sort_sequences.h"
+#include "sort_planner.h"
+#include "arm_stats.h"
+#include "arm_trace.h"
+#include "mock_hardware.h"
+
+
+// Longest time a sort cycle may take before the arm is considered stuck (ms)
+#define BENCHMARK_TIMEOUT_MS 60000
+
+// Bin commands replayed in order, as sent by camera2.py
+static const char benchmark_bins[] = "amgp";
+
+/**
+ * @name: Sequence and index of the segment, e.g. "pick[2]"
+ * @duration_us: Virtual time from the previous segment end to this one (us)
+ */
+typedef struct benchmark_segment {
+    char name[16];
+    uint64_t duration_us;
+} benchmark_segment;
+
+#define BENCHMARK_SERVOS 4
+
+ROBOTIC_ARM_DEFINE(benchmark_arm, BENCHMARK_SERVOS);
+
+#define BENCHMARK_SERVO_MG996R(servo_pin, lower, upper, velocity, acceleration)                          \
+    { .pin = (servo_pin), .angle_range = 180.0f, .period = 20000, .min_duty = 500, .max_duty = 2500, \
+      .angle = 90.0f, .park_angle = 90.0f, .angle_lower_bound = (lower), .angle_upper_bound = (upper),                   \
+      .max_velocity = (velocity), .max_acceleration = (acceleration) }
+
+// Same servos as main.c
+static const robotic_arm_servo_config benchmark_servo_configs[BENCHMARK_SERVOS] = {
+    BENCHMARK_SERVO_MG996R(16, 0.0f, 180.0f, 180.0f, 720.0f),
+    BENCHMARK_SERVO_MG996R(17, 3.0f, 177.0f, 120.0f, 480.0f),
+    BENCHMARK_SERVO_MG996R(18, 0.0f, 180.0f, 180.0f, 720.0f),
+    BENCHMARK_SERVO_MG996R(19, 0.0f, 180.0f, 180.0f, 720.0f)
+};
+
+// Set up the arm the same way main.c does, on the motion timer since core 1 is not emulated
+static robotic_arm* benchmark_arm_create(void) {
+    robotic_arm* robot = &benchmark_arm;
+    if(!robotic_arm_init(robot, benchmark_servo_configs))
+        return NULL;
+    if(!robotic_arm_start(robot))
+        return NULL;
+    return robot;
+}
+
+// Queue a sequence segment by segment, flagged for DMA playback if asked, and name the segments
+static uint benchmark_queue(robotic_arm* robot, const robotic_arm_sequence* sequence, bool dma, benchmark_segment* segments) {
+    for(uint8_t i = 0; i < sequence->length; i++) {
+        robotic_arm_segment segment = sequence->segments[i];
+        if(dma)
+            segment.flags |= ROBOTIC_ARM_SEGMENT_DMA;
+        if(!robotic_arm_queue_segment(robot, &segment)) {
+            fprintf(stderr, "Robotic arm queue is full.\n");
+            exit(1);
+        }
+        snprintf(segments[i].name, sizeof(segments[i].name), "%s[%d]", sequence->name, i);
+    }
+    return sequence->length;
+}
+
+// Queue one item planned from the end of the previous one, and name the segments
+static uint benchmark_queue_planned(robotic_arm* robot, sort_planner* planner, int command, benchmark_segment* segments) {
+    if(!sort_planner_queue_item(planner, robot, command)) {
+        fprintf(stderr, "Sort planner cannot queue bin %c.\n", command);
+        exit(1);
+    }
+    for(uint8_t i = 0; i < SORT_PLANNER_ITEM_SEGMENTS; i++)
+        snprintf(segments[i].name, sizeof(segments[i].name), "plan[%d]", i);
+    return SORT_PLANNER_ITEM_SEGMENTS;
+}
+
+// Play one sort cycle and record when each segment finished, return the cycle time (us)
+// With a planner the item is planned from the previous drop, otherwise the fixed sequences are played
+static uint64_t benchmark_cycle(robotic_arm* robot, int command, sort_planner* planner, bool dma,
+                                benchmark_segment* segments, uint* count) {
+    *count = 0;
+    if(planner) {
+        *count += benchmark_queue_planned(robot, planner, command, segments);
+    }
+    else {
+        *count += benchmark_queue(robot, &sort_sequence_pick, dma, &segments[*count]);
+        *count += benchmark_queue(robot, sort_sequence_find(command), dma, &segments[*count]);
+        *count += benchmark_queue(robot, &sort_sequence_throw, dma, &segments[*count]);
+    }
+    uint64_t start = mock_time_us();
+    uint64_t last = start;
+    uint32_t done = robot->segments_done;
+    uint finished = 0;
+    while(finished < *count) {
+        // Segments finish on motion ticks, so one tick period is the timing resolution
+        mock_advance_us(robot->period);
+        while(finished < *count && (int32_t)(robot->segments_done - done) > 0) {
+            segments[finished++].duration_us = mock_time_us() - last;
+            last = mock_time_us();
+            done++;
+        }
+        if(mock_time_us() - start > (uint64_t)BENCHMARK_TIMEOUT_MS * 1000) {
+            fprintf(stderr, "Sort cycle did not finish.\n");
+            exit(1);
+        }
+    }
+    return last - start;
+}
+
+// Write every latched PWM level change as CSV
+static void benchmark_write_log(const char* path) {
+    FILE* file = fopen(path, "w");
+    if(!file) {
+        fprintf(stderr, "Cannot open %s.\n", path);
+        return;
+    }
+    uint count;
+    const mock_pwm_write* log = mock_pwm_log(&count);
+    fprintf(file, "time_us,slice,channel,level\n");
+    for(uint i = 0; i < count; i++)
+        fprintf(file, "%llu,%u,%u,%u\n", (unsigned long long)log[i].time_us, log[i].slice, log[i].channel, log[i].level);
+    fclose(file);
+}
+
+static FILE* benchmark_trace_file = NULL;
+
+static void benchmark_write_trace(const uint8_t* data, uint length) {
+    fwrite(data, 1, length, benchmark_trace_file);
+}
+
+static void benchmark_usage(const char* program) {
+    printf("Usage: %s [--dma] [--plan] [--stats] [--max-cycle-ms ms] [--pwm-log file.csv] [--trace file.bin]\n"
+           "  --dma           play every segment by DMA instead of timer steps\n"
+           "  --plan          plan items from the previous drop with sort_planner instead of the fixed sequences\n"
+           "  --stats         print the firmware statistics histograms at the end\n"
+           "  --max-cycle-ms  exit with 1 if any sort cycle takes longer\n"
+           "  --pwm-log       write every latched PWM level change as CSV\n"
+           "  --trace         write the firmware PWM trace dump, decode with tools/trace_decode.py\n", program);
+}
+
+/**
+ * Replay the sort sequences of every bin on the host with virtual time and report
+ * cycle time per bin, duration of every segment and host compute time per motion tick.
+ */
+int main(int argc, char** argv) {
+    bool dma = false;
+    bool plan = false;
+    bool stats = false;
+    double max_cycle_ms = 0;
+    const char* log_path = NULL;
+    const char* trace_path = NULL;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--dma") == 0)
+            dma = true;
+        else if(strcmp(argv[i], "--plan") == 0)
+            plan = true;
+        else if(strcmp(argv[i], "--stats") == 0)
+            stats = true;
+        else if(strcmp(argv[i], "--max-cycle-ms") == 0 && i + 1 < argc)
+            max_cycle_ms = atof(argv[++i]);
+        else if(strcmp(argv[i], "--pwm-log") == 0 && i + 1 < argc)
+            log_path = argv[++i];
+        else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+        else {
+            benchmark_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    robotic_arm* robot = benchmark_arm_create();
+    if(!robot) {
+        fprintf(stderr, "Failed to create robotic arm.\n");
+        return 1;
+    }
+    // Let the arm settle at home before measuring
+    mock_advance_us(robot->period);
+    if(trace_path)
+        arm_trace_start();
+
+    // Same pose cache the firmware solves at boot
+    static const arm_kinematics geometry = ARM_KINEMATICS_DEFAULT;
+    static arm_pose_cache poses;
+    sort_planner planner;
+    if(!arm_pose_cache_build(&poses, &geometry, robot->servos, sort_pose_points, SORT_POSES)) {
+        fprintf(stderr, "Sort poses are out of reach.\n");
+        return 1;
+    }
+    sort_planner_init(&planner, &poses, robot);
+    if(dma)
+        planner.segment_flags |= ROBOTIC_ARM_SEGMENT_DMA;
+
+    bool too_slow = false;
+    double total_ms = 0;
+    benchmark_segment segments[ROBOTIC_ARM_QUEUE_SIZE];
+    printf("Sort cycle benchmark, %s playback, %s\n", dma ? "DMA" : "timer", plan ? "planned routes" : "fixed sequences");
+    printf("Servo soft start %.1f ms\n", robot->start_us / 1e3);
+    for(const char* command = benchmark_bins; *command; command++) {
+        uint count;
+        mock_timer_stats_reset();
+        uint64_t cycle_us = benchmark_cycle(robot, *command, plan ? &planner : NULL, dma, segments, &count);
+        mock_timer_stats stats;
+        mock_timer_stats_get(&stats);
+        double cycle_ms = cycle_us / 1e3;
+        total_ms += cycle_ms;
+        printf("\nBin %c: %.1f ms\n", *command, cycle_ms);
+        for(uint i = 0; i < count; i++)
+            printf("  %-10s %8.1f ms\n", segments[i].name, segments[i].duration_us / 1e3);
+        printf("  ticks %llu, compute mean %.0f ns, max %llu ns per tick\n", (unsigned long long)stats.calls,
+               stats.calls ? (double)stats.total_ns / stats.calls : 0.0, (unsigned long long)stats.max_ns);
+        if(max_cycle_ms > 0 && cycle_ms > max_cycle_ms)
+            too_slow = true;
+    }
+    printf("\nMean cycle %.1f ms\n", total_ms / (sizeof(benchmark_bins) - 1));
+    if(plan) {
+        // Return home once the last item is dropped, as the firmware does when no item follows
+        sort_planner_park(&planner, robot);
+        while(!robotic_arm_is_idle(robot))
+            mock_advance_us(robot->period);
+        sort_planner_print(&planner);
+    }
+
+    if(stats) {
+        printf("\n");
+        arm_stats_print();
+    }
+    if(log_path)
+        benchmark_write_log(log_path);
+    if(trace_path) {
+        benchmark_trace_file = fopen(trace_path, "wb");
+        if(!benchmark_trace_file)
+            fprintf(stderr, "Cannot open %s.\n", trace_path);
+        else if(!arm_trace_dump(benchmark_write_trace))
+            fprintf(stderr, "PWM trace is not compiled in, configure with -DARM_TRACE=ON.\n");
+        if(benchmark_trace_file)
+            fclose(benchmark_trace_file);
+    }
+    robotic_arm_deinit(robot);
+    if(too_slow) {
+        fprintf(stderr, "A sort cycle took longer than %.1f ms.\n", max_cycle_ms);
+        return 1;
+    }
+    return 0;
+}
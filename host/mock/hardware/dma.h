@@ -0,0 +1,70 @@
+#ifndef MOCK_HARDWARE_DMA_H
+#define MOCK_HARDWARE_DMA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NUM_DMA_CHANNELS 12
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2
+};
+
+/**
+ * @size: Transfer size
+ * @read_increment: Whether the read address moves after each transfer
+ * @write_increment: Whether the write address moves after each transfer
+ * @dreq: PWM slice pacing the channel, the mock has no other DREQ sources
+ * @chain_to: Channel triggered on completion, itself for none
+ */
+typedef struct {
+    enum dma_channel_transfer_size size;
+    bool read_increment;
+    bool write_increment;
+    unsigned int dreq;
+    unsigned int chain_to;
+} dma_channel_config;
+
+typedef struct {
+    volatile uint32_t abort;
+} dma_hw_t;
+
+// Every access first finishes aborts written before, so abort bits read back clear like on hardware
+dma_hw_t* mock_dma_hw(void);
+#define dma_hw (mock_dma_hw())
+
+dma_channel_config dma_channel_get_default_config(unsigned int channel);
+
+static inline void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size) {
+    c->size = size;
+}
+
+static inline void channel_config_set_read_increment(dma_channel_config* c, bool increment) {
+    c->read_increment = increment;
+}
+
+static inline void channel_config_set_write_increment(dma_channel_config* c, bool increment) {
+    c->write_increment = increment;
+}
+
+static inline void channel_config_set_dreq(dma_channel_config* c, unsigned int dreq) {
+    c->dreq = dreq;
+}
+
+static inline void channel_config_set_chain_to(dma_channel_config* c, unsigned int chain_to) {
+    c->chain_to = chain_to;
+}
+
+void dma_channel_configure(unsigned int channel, const dma_channel_config* config, volatile void* write_addr,
+                           const volatile void* read_addr, unsigned int transfer_count, bool trigger);
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(unsigned int channel);
+void dma_start_channel_mask(uint32_t mask);
+void dma_irqn_set_channel_enabled(unsigned int irq_index, unsigned int channel, bool enabled);
+bool dma_irqn_get_channel_status(unsigned int irq_index, unsigned int channel);
+void dma_irqn_acknowledge_channel(unsigned int irq_index, unsigned int channel);
+
+
+#endif  // MOCK_HARDWARE_DMA_H
@@ -0,0 +1,9 @@
+#ifndef MOCK_HARDWARE_GPIO_H
+#define MOCK_HARDWARE_GPIO_H
+
+#define GPIO_FUNC_PWM 4
+
+void gpio_set_function(unsigned int gpio, int fn);
+
+
+#endif  // MOCK_HARDWARE_GPIO_H
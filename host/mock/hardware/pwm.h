@@ -0,0 +1,47 @@
+#ifndef MOCK_HARDWARE_PWM_H
+#define MOCK_HARDWARE_PWM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NUM_PWM_SLICES 8
+#define PWM_CH0_CC_A_LSB 0
+#define PWM_CH0_CC_B_LSB 16
+
+typedef struct {
+    volatile uint32_t csr;
+    volatile uint32_t div;
+    volatile uint32_t ctr;
+    volatile uint32_t cc;
+    volatile uint32_t top;
+} pwm_slice_hw_t;
+
+typedef struct {
+    pwm_slice_hw_t slice[NUM_PWM_SLICES];
+    volatile uint32_t en;
+} pwm_hw_t;
+
+// Registers read and written by the firmware, latched by the mock at every wrap
+extern pwm_hw_t* pwm_hw;
+
+static inline unsigned int pwm_gpio_to_slice_num(unsigned int gpio) {
+    return (gpio >> 1) & 7;
+}
+
+static inline unsigned int pwm_gpio_to_channel(unsigned int gpio) {
+    return gpio & 1;
+}
+
+static inline unsigned int pwm_get_dreq(unsigned int slice_num) {
+    return slice_num;
+}
+
+void pwm_set_clkdiv(unsigned int slice_num, float divider);
+void pwm_set_wrap(unsigned int slice_num, uint16_t wrap);
+void pwm_set_counter(unsigned int slice_num, uint16_t count);
+void pwm_set_chan_level(unsigned int slice_num, unsigned int channel, uint16_t level);
+void pwm_set_gpio_level(unsigned int gpio, uint16_t level);
+void pwm_set_enabled(unsigned int slice_num, bool enabled);
+
+
+#endif  // MOCK_HARDWARE_PWM_H
@@ -0,0 +1,48 @@
+#ifndef MOCK_HARDWARE_SYNC_H
+#define MOCK_HARDWARE_SYNC_H
+
+#include <stdint.h>
+
+// Timer callbacks only run while the virtual clock advances, so there is nothing to mask
+static inline uint32_t save_and_disable_interrupts(void) {
+    return 0;
+}
+
+static inline void restore_interrupts(uint32_t status) {
+    (void)status;
+}
+
+// Single host thread, a spin lock never contends
+#define PICO_SPINLOCK_ID_STRIPED_FIRST 16
+
+typedef volatile uint32_t spin_lock_t;
+
+static inline spin_lock_t* spin_lock_instance(unsigned lock_num) {
+    static spin_lock_t locks[32];
+    return &locks[lock_num];
+}
+
+static inline uint32_t spin_lock_blocking(spin_lock_t* lock) {
+    (void)lock;
+    return save_and_disable_interrupts();
+}
+
+static inline void spin_unlock(spin_lock_t* lock, uint32_t saved_irq) {
+    (void)lock;
+    restore_interrupts(saved_irq);
+}
+
+static inline void __mem_fence_acquire(void) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static inline void __mem_fence_release(void) {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void hw_set_bits(volatile uint32_t* address, uint32_t mask) {
+    *address |= mask;
+}
+
+
+#endif  // MOCK_HARDWARE_SYNC_H
@@ -0,0 +1,24 @@
+#ifndef MOCK_HARDWARE_WATCHDOG_H
+#define MOCK_HARDWARE_WATCHDOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    volatile uint32_t ctrl;
+    volatile uint32_t load;
+    volatile uint32_t reason;
+    volatile uint32_t scratch[8];
+    volatile uint32_t tick;
+} watchdog_hw_t;
+
+// Scratch registers survive a watchdog reset on the board, the mock never resets
+extern watchdog_hw_t* watchdog_hw;
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+void watchdog_update(void);
+bool watchdog_caused_reboot(void);
+bool watchdog_enable_caused_reboot(void);
+
+
+#endif  // MOCK_HARDWARE_WATCHDOG_H
@@ -0,0 +1,475 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/irq.h"
+#include "hardware/pwm.h"
+#include "hardware/watchdog.h"
+#include "mock_hardware.h"
+
+
+// Maximum number of repeating timers running at once
+#define MOCK_MAX_TIMERS 8
+
+/**
+ * @config: Configuration written by dma_channel_configure()
+ * @write_addr: Register written by every transfer
+ * @read_addr: Next word to transfer
+ * @count: Remaining transfers
+ * @busy: Whether the channel waits for its DREQ
+ * @claimed: Whether the channel was claimed
+ * @irq_enabled: Whether completion raises the DMA interrupt
+ * @irq_status: Whether completion is waiting to be acknowledged
+ */
+typedef struct mock_dma_channel {
+    dma_channel_config config;
+    volatile uint32_t* write_addr;
+    const volatile uint32_t* read_addr;
+    uint count;
+    bool busy;
+    bool claimed;
+    bool irq_enabled;
+    bool irq_status;
+} mock_dma_channel;
+
+static uint64_t now_us = 0;
+
+static pwm_hw_t pwm_registers;
+pwm_hw_t* pwm_hw = &pwm_registers;
+static float pwm_dividers[NUM_PWM_SLICES];
+static uint32_t pwm_latched[NUM_PWM_SLICES];
+static uint64_t pwm_next_wrap[NUM_PWM_SLICES];
+static uint32_t pwm_running = 0;
+
+static mock_pwm_write* pwm_log = NULL;
+static uint pwm_log_count = 0;
+static uint pwm_log_capacity = 0;
+
+static repeating_timer_t* timers[MOCK_MAX_TIMERS];
+static mock_timer_stats timer_stats;
+
+static dma_hw_t dma_registers;
+static mock_dma_channel dma_channels[NUM_DMA_CHANNELS];
+static irq_handler_t dma_handler = NULL;
+static bool dma_irq_enabled = false;
+
+// Host monotonic time (ns), measures callbacks
+static uint64_t host_time_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+// PWM period of a slice (us) from its divider and wrap
+static uint64_t pwm_period_us(uint slice_num) {
+    double counts = (double)(pwm_hw->slice[slice_num].top + 1) * pwm_dividers[slice_num];
+    uint64_t period = (uint64_t)(counts * 1e6 / MOCK_SYSTEM_CLOCK + 0.5);
+    return period > 0 ? period : 1;
+}
+
+static void pwm_log_append(uint slice_num, uint channel, uint16_t level) {
+    if(pwm_log_count == pwm_log_capacity) {
+        uint capacity = pwm_log_capacity ? pwm_log_capacity * 2 : 1024;
+        mock_pwm_write* log = realloc(pwm_log, capacity * sizeof(mock_pwm_write));
+        if(!log) {
+            fprintf(stderr, "PWM log realloc failed.\n");
+            return;
+        }
+        pwm_log = log;
+        pwm_log_capacity = capacity;
+    }
+    pwm_log[pwm_log_count++] = (mock_pwm_write){
+        .time_us = now_us,
+        .slice = slice_num,
+        .channel = channel,
+        .level = level
+    };
+}
+
+// Slices enabled through pwm_hw->en since the last event start wrapping one period later
+static void pwm_update_running(void) {
+    uint32_t started = pwm_hw->en & ~pwm_running;
+    for(uint slice_num = 0; slice_num < NUM_PWM_SLICES; slice_num++) {
+        if(started & (1u << slice_num))
+            pwm_next_wrap[slice_num] = now_us + pwm_period_us(slice_num);
+    }
+    pwm_running = pwm_hw->en;
+}
+
+// Wrap of a slice: latch the compare levels, then serve the DMA channels paced by the slice
+static void pwm_wrap(uint slice_num) {
+    uint32_t compare = pwm_hw->slice[slice_num].cc;
+    for(uint channel = 0; channel < 2; channel++) {
+        uint shift = channel ? PWM_CH0_CC_B_LSB : PWM_CH0_CC_A_LSB;
+        uint16_t level = (compare >> shift) & 0xFFFF;
+        if(level != ((pwm_latched[slice_num] >> shift) & 0xFFFF))
+            pwm_log_append(slice_num, channel, level);
+    }
+    pwm_latched[slice_num] = compare;
+    bool raised = false;
+    uint32_t chained = 0;
+    for(uint channel = 0; channel < NUM_DMA_CHANNELS; channel++) {
+        mock_dma_channel* dma = &dma_channels[channel];
+        if(!dma->busy || dma->config.dreq != slice_num)
+            continue;
+        *dma->write_addr = *dma->read_addr;
+        if(dma->config.read_increment)
+            dma->read_addr++;
+        if(dma->config.write_increment)
+            dma->write_addr++;
+        if(--dma->count > 0)
+            continue;
+        dma->busy = false;
+        if(dma->irq_enabled) {
+            dma->irq_status = true;
+            raised = true;
+        }
+        if(dma->config.chain_to != channel)
+            chained |= 1u << dma->config.chain_to;
+    }
+    dma_start_channel_mask(chained);
+    if(raised && dma_irq_enabled && dma_handler)
+        dma_handler();
+}
+
+// Run every event up to a virtual time, PWM wraps before timers falling due at the same time
+static void mock_run_until(uint64_t end_us) {
+    while(true) {
+        pwm_update_running();
+        int next_slice = -1;
+        int next_timer = -1;
+        for(uint slice_num = 0; slice_num < NUM_PWM_SLICES; slice_num++) {
+            if((pwm_running & (1u << slice_num))
+               && (next_slice < 0 || pwm_next_wrap[slice_num] < pwm_next_wrap[next_slice]))
+                next_slice = slice_num;
+        }
+        for(int i = 0; i < MOCK_MAX_TIMERS; i++) {
+            if(timers[i] && (next_timer < 0 || timers[i]->next_us < timers[next_timer]->next_us))
+                next_timer = i;
+        }
+        if(next_slice >= 0 && pwm_next_wrap[next_slice] <= end_us
+           && (next_timer < 0 || pwm_next_wrap[next_slice] <= timers[next_timer]->next_us)) {
+            now_us = pwm_next_wrap[next_slice];
+            pwm_next_wrap[next_slice] += pwm_period_us(next_slice);
+            pwm_wrap(next_slice);
+            continue;
+        }
+        if(next_timer < 0 || timers[next_timer]->next_us > end_us) {
+            now_us = end_us;
+            return;
+        }
+        now_us = timers[next_timer]->next_us;
+        repeating_timer_t* timer = timers[next_timer];
+        int64_t delay = timer->delay_us < 0 ? -timer->delay_us : timer->delay_us;
+        timer->next_us += delay;
+        uint64_t start = host_time_ns();
+        bool again = timer->callback(timer);
+        uint64_t elapsed = host_time_ns() - start;
+        timer_stats.calls++;
+        timer_stats.total_ns += elapsed;
+        if(elapsed > timer_stats.max_ns)
+            timer_stats.max_ns = elapsed;
+        if(!again)
+            cancel_repeating_timer(timer);
+    }
+}
+
+
+/**
+ * Get the virtual time since boot (us).
+ */
+uint64_t mock_time_us(void) {
+    return now_us;
+}
+
+/**
+ * Advance the virtual clock, running PWM wraps, DMA transfers and timers in time order.
+ * 
+ * @us: Time to advance (us)
+ */
+void mock_advance_us(uint64_t us) {
+    mock_run_until(now_us + us);
+}
+
+/**
+ * Get PWM level changes logged so far, one entry per channel whose level changed at a wrap.
+ * Levels are logged when the slice latches them, which is when the servo sees them.
+ * 
+ * @count: Output number of entries
+ */
+const mock_pwm_write* mock_pwm_log(uint* count) {
+    *count = pwm_log_count;
+    return pwm_log;
+}
+
+/**
+ * Forget all logged PWM level changes.
+ */
+void mock_pwm_log_clear(void) {
+    pwm_log_count = 0;
+}
+
+/**
+ * Get host time spent in timer callbacks since the last reset.
+ * 
+ * @stats: Output statistics
+ */
+void mock_timer_stats_get(mock_timer_stats* stats) {
+    *stats = timer_stats;
+}
+
+/**
+ * Reset timer callback statistics.
+ */
+void mock_timer_stats_reset(void) {
+    timer_stats = (mock_timer_stats){0};
+}
+
+
+// pico/stdlib.h and pico/time.h
+
+void sleep_us(uint64_t us) {
+    mock_advance_us(us);
+}
+
+void sleep_ms(uint32_t ms) {
+    mock_advance_us((uint64_t)ms * 1000);
+}
+
+uint64_t time_us_64(void) {
+    return now_us;
+}
+
+absolute_time_t get_absolute_time(void) {
+    return now_us;
+}
+
+void busy_wait_until(absolute_time_t t) {
+    if(t > now_us)
+        mock_run_until(t);
+}
+
+void sleep_until(absolute_time_t t) {
+    busy_wait_until(t);
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out) {
+    for(int i = 0; i < MOCK_MAX_TIMERS; i++) {
+        if(timers[i])
+            continue;
+        out->delay_us = delay_us;
+        out->callback = callback;
+        out->user_data = user_data;
+        out->next_us = now_us + (uint64_t)(delay_us < 0 ? -delay_us : delay_us);
+        out->alive = true;
+        timers[i] = out;
+        return true;
+    }
+    return false;
+}
+
+bool cancel_repeating_timer(repeating_timer_t* timer) {
+    for(int i = 0; i < MOCK_MAX_TIMERS; i++) {
+        if(timers[i] == timer) {
+            timers[i] = NULL;
+            timer->alive = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// pico/multicore.h
+
+void multicore_launch_core1(void (*entry)(void)) {
+    (void)entry;
+    fprintf(stderr, "Core 1 is not emulated on the host, use robotic_arm_start().\n");
+    exit(1);
+}
+
+void multicore_fifo_push_blocking(uint32_t data) {
+    (void)data;
+}
+
+uint32_t multicore_fifo_pop_blocking(void) {
+    return 0;
+}
+
+
+// hardware/gpio.h
+
+void gpio_set_function(unsigned int gpio, int fn) {
+    (void)gpio;
+    (void)fn;
+}
+
+
+// hardware/pwm.h
+
+void pwm_set_clkdiv(unsigned int slice_num, float divider) {
+    pwm_dividers[slice_num] = divider;
+}
+
+void pwm_set_wrap(unsigned int slice_num, uint16_t wrap) {
+    pwm_hw->slice[slice_num].top = wrap;
+}
+
+void pwm_set_counter(unsigned int slice_num, uint16_t count) {
+    pwm_hw->slice[slice_num].ctr = count;
+}
+
+void pwm_set_chan_level(unsigned int slice_num, unsigned int channel, uint16_t level) {
+    uint shift = channel ? PWM_CH0_CC_B_LSB : PWM_CH0_CC_A_LSB;
+    pwm_hw->slice[slice_num].cc = (pwm_hw->slice[slice_num].cc & ~(0xFFFFu << shift)) | ((uint32_t)level << shift);
+}
+
+void pwm_set_gpio_level(unsigned int gpio, uint16_t level) {
+    pwm_set_chan_level(pwm_gpio_to_slice_num(gpio), pwm_gpio_to_channel(gpio), level);
+}
+
+void pwm_set_enabled(unsigned int slice_num, bool enabled) {
+    if(enabled)
+        pwm_hw->en |= 1u << slice_num;
+    else
+        pwm_hw->en &= ~(1u << slice_num);
+}
+
+
+// hardware/irq.h
+
+void irq_add_shared_handler(unsigned int num, irq_handler_t handler, uint8_t order_priority) {
+    (void)order_priority;
+    if(num == DMA_IRQ_0 || num == DMA_IRQ_1)
+        dma_handler = handler;
+}
+
+void irq_set_enabled(unsigned int num, bool enabled) {
+    if(num == DMA_IRQ_0 || num == DMA_IRQ_1)
+        dma_irq_enabled = enabled;
+}
+
+
+// hardware/dma.h
+
+dma_hw_t* mock_dma_hw(void) {
+    // Aborts finish instantly, without chaining
+    for(uint channel = 0; channel < NUM_DMA_CHANNELS; channel++) {
+        if(dma_registers.abort & (1u << channel))
+            dma_channels[channel].busy = false;
+    }
+    dma_registers.abort = 0;
+    return &dma_registers;
+}
+
+dma_channel_config dma_channel_get_default_config(unsigned int channel) {
+    return (dma_channel_config){
+        .size = DMA_SIZE_32,
+        .read_increment = true,
+        .write_increment = false,
+        .dreq = NUM_PWM_SLICES,
+        .chain_to = channel
+    };
+}
+
+void dma_channel_configure(unsigned int channel, const dma_channel_config* config, volatile void* write_addr,
+                           const volatile void* read_addr, unsigned int transfer_count, bool trigger) {
+    mock_dma_channel* dma = &dma_channels[channel];
+    if(config->size != DMA_SIZE_32)
+        fprintf(stderr, "Mock DMA only transfers 32-bit words.\n");
+    dma->config = *config;
+    dma->write_addr = write_addr;
+    dma->read_addr = read_addr;
+    dma->count = transfer_count;
+    if(trigger)
+        dma_start_channel_mask(1u << channel);
+}
+
+int dma_claim_unused_channel(bool required) {
+    for(uint channel = 0; channel < NUM_DMA_CHANNELS; channel++) {
+        if(!dma_channels[channel].claimed) {
+            dma_channels[channel].claimed = true;
+            return channel;
+        }
+    }
+    if(required) {
+        fprintf(stderr, "No DMA channel left.\n");
+        exit(1);
+    }
+    return -1;
+}
+
+void dma_channel_unclaim(unsigned int channel) {
+    dma_channels[channel].claimed = false;
+}
+
+void dma_start_channel_mask(uint32_t mask) {
+    for(uint channel = 0; channel < NUM_DMA_CHANNELS; channel++) {
+        if((mask & (1u << channel)) && dma_channels[channel].count > 0)
+            dma_channels[channel].busy = true;
+    }
+}
+
+void dma_irqn_set_channel_enabled(unsigned int irq_index, unsigned int channel, bool enabled) {
+    (void)irq_index;
+    dma_channels[channel].irq_enabled = enabled;
+}
+
+bool dma_irqn_get_channel_status(unsigned int irq_index, unsigned int channel) {
+    (void)irq_index;
+    return dma_channels[channel].irq_status;
+}
+
+void dma_irqn_acknowledge_channel(unsigned int irq_index, unsigned int channel) {
+    (void)irq_index;
+    dma_channels[channel].irq_status = false;
+}
+
+// hardware/flash.h
+
+uint8_t mock_flash[PICO_FLASH_SIZE_BYTES];
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    if(flash_offs % FLASH_SECTOR_SIZE || count % FLASH_SECTOR_SIZE || flash_offs + count > PICO_FLASH_SIZE_BYTES) {
+        fprintf(stderr, "Mock flash erase of %zu bytes at 0x%x is not sector aligned.\n", count, flash_offs);
+        abort();
+    }
+    memset(&mock_flash[flash_offs], 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count) {
+    if(flash_offs % FLASH_PAGE_SIZE || count % FLASH_PAGE_SIZE || flash_offs + count > PICO_FLASH_SIZE_BYTES) {
+        fprintf(stderr, "Mock flash program of %zu bytes at 0x%x is not page aligned.\n", count, flash_offs);
+        abort();
+    }
+    // Programming only clears bits, like NOR flash, so writes without an erase show up
+    for(size_t i = 0; i < count; i++)
+        mock_flash[flash_offs + i] &= data[i];
+}
+
+// hardware/watchdog.h
+
+static watchdog_hw_t watchdog_registers;
+watchdog_hw_t* watchdog_hw = &watchdog_registers;
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug) {
+    (void)pause_on_debug;
+    watchdog_registers.load = delay_ms * 1000;
+    watchdog_registers.ctrl = 1;
+}
+
+void watchdog_update(void) {
+}
+
+bool watchdog_caused_reboot(void) {
+    return false;
+}
+
+bool watchdog_enable_caused_reboot(void) {
+    return false;
+}
@@ -0,0 +1,72 @@
+#ifndef MOCK_HARDWARE_H
+#define MOCK_HARDWARE_H
+
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+// System clock the PWM dividers are calculated for (Hz)
+#define MOCK_SYSTEM_CLOCK 125000000
+
+/**
+ * @time_us: Virtual time of the wrap that latched the level (us)
+ * @slice: PWM slice
+ * @channel: PWM channel, 0 for A and 1 for B
+ * @level: New compare level
+ */
+typedef struct mock_pwm_write {
+    uint64_t time_us;
+    uint8_t slice;
+    uint8_t channel;
+    uint16_t level;
+} mock_pwm_write;
+
+/**
+ * @calls: Number of timer callbacks run
+ * @total_ns: Host time spent in timer callbacks (ns)
+ * @max_ns: Longest timer callback (ns)
+ */
+typedef struct mock_timer_stats {
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} mock_timer_stats;
+
+/**
+ * Get the virtual time since boot (us).
+ */
+uint64_t mock_time_us(void);
+
+/**
+ * Advance the virtual clock, running PWM wraps, DMA transfers and timers in time order.
+ * 
+ * @us: Time to advance (us)
+ */
+void mock_advance_us(uint64_t us);
+
+/**
+ * Get PWM level changes logged so far, one entry per channel whose level changed at a wrap.
+ * Levels are logged when the slice latches them, which is when the servo sees them.
+ * 
+ * @count: Output number of entries
+ */
+const mock_pwm_write* mock_pwm_log(uint* count);
+
+/**
+ * Forget all logged PWM level changes.
+ */
+void mock_pwm_log_clear(void);
+
+/**
+ * Get host time spent in timer callbacks since the last reset.
+ * 
+ * @stats: Output statistics
+ */
+void mock_timer_stats_get(mock_timer_stats* stats);
+
+/**
+ * Reset timer callback statistics.
+ */
+void mock_timer_stats_reset(void);
+
+
+#endif  // MOCK_HARDWARE_H
@@ -0,0 +1,24 @@
+#ifndef MOCK_PICO_CRITICAL_SECTION_H
+#define MOCK_PICO_CRITICAL_SECTION_H
+
+#include <stdbool.h>
+
+// Single host thread, a critical section only has to exist
+typedef struct critical_section {
+    bool initialized;
+} critical_section_t;
+
+static inline void critical_section_init(critical_section_t* crit_sec) {
+    crit_sec->initialized = true;
+}
+
+static inline void critical_section_enter_blocking(critical_section_t* crit_sec) {
+    (void)crit_sec;
+}
+
+static inline void critical_section_exit(critical_section_t* crit_sec) {
+    (void)crit_sec;
+}
+
+
+#endif  // MOCK_PICO_CRITICAL_SECTION_H
@@ -0,0 +1,21 @@
+#ifndef MOCK_PICO_FLASH_H
+#define MOCK_PICO_FLASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PICO_OK 0
+
+// Core 1 is not emulated, there is no other core to park during flash writes
+static inline bool flash_safe_execute_core_init(void) {
+    return true;
+}
+
+static inline int flash_safe_execute(void (*func)(void*), void* param, uint32_t enter_exit_timeout_ms) {
+    (void)enter_exit_timeout_ms;
+    func(param);
+    return PICO_OK;
+}
+
+
+#endif  // MOCK_PICO_FLASH_H
@@ -0,0 +1,12 @@
+#ifndef MOCK_PICO_MULTICORE_H
+#define MOCK_PICO_MULTICORE_H
+
+#include <stdint.h>
+
+// Core 1 is not emulated, use robotic_arm_start() on the host
+void multicore_launch_core1(void (*entry)(void));
+void multicore_fifo_push_blocking(uint32_t data);
+uint32_t multicore_fifo_pop_blocking(void);
+
+
+#endif  // MOCK_PICO_MULTICORE_H
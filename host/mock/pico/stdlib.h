@@ -0,0 +1,33 @@
+#ifndef MOCK_PICO_STDLIB_H
+#define MOCK_PICO_STDLIB_H
+
+// Host stand-in for the Pico SDK standard library, see mock_hardware.h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+typedef unsigned int uint;
+
+#define PICO_ERROR_TIMEOUT -1
+
+static inline void tight_loop_contents(void) {}
+
+/**
+ * Advance the virtual clock, running PWM wraps and timers that fall due.
+ * 
+ * @us: Time to sleep (us)
+ */
+void sleep_us(uint64_t us);
+
+/**
+ * Advance the virtual clock, running PWM wraps and timers that fall due.
+ * 
+ * @ms: Time to sleep (ms)
+ */
+void sleep_ms(uint32_t ms);
+
+
+#endif  // MOCK_PICO_STDLIB_H
@@ -0,0 +1,65 @@
+#ifndef MOCK_PICO_TIME_H
+#define MOCK_PICO_TIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Virtual time since boot (us)
+typedef uint64_t absolute_time_t;
+
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t* timer);
+
+/**
+ * @delay_us: Period, negative to count from the start of the previous callback
+ * @callback: Called when the timer falls due, return false to stop
+ * @user_data: Passed to callback through the timer
+ * @next_us: Virtual time of the next call
+ * @alive: Whether the timer is still scheduled
+ */
+struct repeating_timer {
+    int64_t delay_us;
+    repeating_timer_callback_t callback;
+    void* user_data;
+    uint64_t next_us;
+    bool alive;
+};
+
+uint64_t time_us_64(void);
+
+static inline uint32_t time_us_32(void) {
+    return (uint32_t)time_us_64();
+}
+absolute_time_t get_absolute_time(void);
+
+static inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) {
+    return t + us;
+}
+
+static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) {
+    return (int64_t)(to - from);
+}
+
+static inline uint32_t to_ms_since_boot(absolute_time_t t) {
+    return (uint32_t)(t / 1000);
+}
+
+/**
+ * Advance the virtual clock to a time, running PWM wraps and timers on the way.
+ * 
+ * @t: Time to wait for
+ */
+void busy_wait_until(absolute_time_t t);
+
+/**
+ * Same as busy_wait_until(), the virtual clock has no sleep states.
+ * 
+ * @t: Time to wait for
+ */
+void sleep_until(absolute_time_t t);
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out);
+bool cancel_repeating_timer(repeating_timer_t* timer);
+
+
+#endif  // MOCK_PICO_TIME_H
@@ -1,94 +1,550 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "pico/stdlib.h"
 #include "robotic_arm.h"
+#include "sort_sequences.h"
+#include "arm_protocol.h"
+#include "servo_benchmark.h"
+#include "arm_stats.h"
+#include "arm_trace.h"
+#include "arm_kinematics.h"
+#include "sort_planner.h"
+#include "arm_teach.h"
+#include "arm_boot.h"
+#include "hardware/watchdog.h"
 #include "string.h"
 
-/// 初始化機械手臂的伺服馬達參數與 GPIO 腳位
-void robotic_arm_starter(robotic_arm* robot_arm, servo* motor) {
-    if (!robot_arm || !motor) {
-        fprintf(stderr, "Invalid robotic arm or servo pointer.\n");
-        return;
+// 1 = 由 core 1 執行動作，core 0 只處理 USB 串列輸入；0 = 以計時器中斷在 core 0 執行動作
+#ifndef ROBOTIC_ARM_USE_CORE1
+#define ROBOTIC_ARM_USE_CORE1 1
+#endif
+
+// 一塊板子驅動幾個分類站（每站一支手臂），分類站的索引即序列協定中的位址
+#ifndef ARM_STATIONS
+#define ARM_STATIONS 1
+#endif
+_Static_assert(ARM_STATIONS >= 1 && ARM_STATIONS <= 2, "main.c defines pin maps for up to 2 stations");
+
+// 最多同時追蹤幾個尚未回報 DONE 的分類工作
+#define SORT_JOB_PENDING_MAX 16
+
+// 手臂閒置多久後才回到原點 (ms)，期間收到的下一個物品直接從分類箱出發
+#define SORT_PARK_DELAY_MS 1000
+
+/// 已排入佇列、等待回報完成的分類工作
+typedef struct sort_job {
+    uint8_t seq;          // JOB 封包序號
+    uint8_t index;        // 在封包中的第幾個工作
+    uint8_t bin;          // 分類箱指令（a/m/g/p）
+    bool started;         // 第一個動作段是否已開始
+    bool speculative;     // 推測工作，等待 CONFIRM 才會放開物品
+    uint32_t start_mark;  // segments_started 超過此值時工作開始
+    uint32_t done_mark;   // segments_done 到達此值時工作完成
+    uint32_t received_us; // 收到指令的時間
+    uint32_t started_us;  // 第一個動作段開始的時間
+} sort_job;
+
+/// 分類站：一支手臂與它的姿勢表、路徑規劃、工作追蹤表，各站互不影響
+typedef struct sort_station {
+    uint8_t address;                              // 序列協定中的位址
+    robotic_arm* robot;                           // 這一站的手臂
+    const robotic_arm_servo_config* configs;      // 各軸的 GPIO 腳位與規格
+    arm_pose_cache pose_cache;                    // 開機時解好的夾取、分類箱與原點姿勢，執行時直接查表
+    sort_planner planner;                         // 從佇列中最後一個姿勢規劃下一個物品的路徑
+    bool park_waiting;                            // 手臂閒置中，等待回到原點
+    uint32_t park_idle_us;                        // 手臂開始閒置的時間
+    sort_job pending_jobs[SORT_JOB_PENDING_MAX];  // 等待回報完成的分類工作
+    uint8_t pending_head;
+    uint8_t pending_tail;
+} sort_station;
+
+/// 手臂幾何（連桿長度與伺服馬達零點），用於笛卡兒座標與角度的換算
+const arm_kinematics arm_geometry = ARM_KINEMATICS_DEFAULT;
+
+/// 以原始位元組輸出追蹤資料，不經過換行轉換
+void trace_write_usb(const uint8_t* data, uint length) {
+    for (uint i = 0; i < length; i++) {
+        putchar_raw(data[i]);
     }
+}
 
-    // 將同一顆馬達設定複製給每個軸
-    for (uint8_t i = 0; i < robot_arm->number; i++) {
-        memcpy(&robot_arm->servos[i], motor, sizeof(servo));
-        robotic_arm_set_servo_pin(robot_arm, i, i + 16); // GPIO 16 起始
+/// 分類箱指令對應的循環時間統計項目，不是分類箱時回傳 ARM_STATS_METRICS
+arm_stats_metric sort_job_cycle_metric(uint8_t bin) {
+    switch (bin | 0x20) { // 轉小寫
+        case 'a': return ARM_STATS_CYCLE_A;
+        case 'm': return ARM_STATS_CYCLE_M;
+        case 'g': return ARM_STATS_CYCLE_G;
+        case 'p': return ARM_STATS_CYCLE_P;
+        default: return ARM_STATS_METRICS;
     }
+}
+
+/// 四軸機械手臂，與伺服馬達一起放在靜態記憶體，不使用 malloc
+#define ARM_SERVOS 4
+ROBOTIC_ARM_DEFINE(arm, ARM_SERVOS);
+
+/// MG996R 的規格，停放角度為斷電時手臂靜止的姿勢（即原點），開機時依序從此緩慢移到起始角度；pin 為 GPIO 腳位，速度 (度/秒) 與加速度 (度/秒^2) 為負載下的上限，0 表示使用固定的舊版時間
+#define ARM_SERVO_MG996R(servo_pin, lower, upper, velocity, acceleration) \
+    { .pin = (servo_pin), .angle_range = 180.0f, .period = 20000, .min_duty = 500, .max_duty = 2500, \
+      .angle = 90.0f, .park_angle = 90.0f, .angle_lower_bound = (lower), .angle_upper_bound = (upper), \
+      .max_velocity = (velocity), .max_acceleration = (acceleration) }
+
+/// 各軸設定，編譯期決定：GPIO 16 起始，servo 1 (肩部) 承受整支手臂的重量，角度範圍與速度、加速度上限較低
+const robotic_arm_servo_config arm_servo_configs[ARM_SERVOS] = {
+    ARM_SERVO_MG996R(16, 0.0f, 180.0f, 180.0f, 720.0f),
+    ARM_SERVO_MG996R(17, 3.0f, 177.0f, 120.0f, 480.0f),
+    ARM_SERVO_MG996R(18, 0.0f, 180.0f, 180.0f, 720.0f),
+    ARM_SERVO_MG996R(19, 0.0f, 180.0f, 180.0f, 720.0f)
+};
+
+#if ARM_STATIONS > 1
+/// 第二個分類站的手臂：GPIO 10 起始，使用 PWM slice 5 與 6，不與第一支手臂共用 slice
+ROBOTIC_ARM_DEFINE(arm_b, ARM_SERVOS);
 
-    // 針對 servo 1 設定角度範圍限制
-    robotic_arm_set_servo_limits(robot_arm, 1, 3.0f, 177.0f);
+const robotic_arm_servo_config arm_b_servo_configs[ARM_SERVOS] = {
+    ARM_SERVO_MG996R(10, 0.0f, 180.0f, 180.0f, 720.0f),
+    ARM_SERVO_MG996R(11, 3.0f, 177.0f, 120.0f, 480.0f),
+    ARM_SERVO_MG996R(12, 0.0f, 180.0f, 180.0f, 720.0f),
+    ARM_SERVO_MG996R(13, 0.0f, 180.0f, 180.0f, 720.0f)
+};
+#endif
+
+/// 各分類站，同一個排程器輪流推進每支手臂的動作佇列
+sort_station stations[ARM_STATIONS] = {
+    { .address = 0, .robot = &arm, .configs = arm_servo_configs },
+#if ARM_STATIONS > 1
+    { .address = 1, .robot = &arm_b, .configs = arm_b_servo_configs },
+#endif
+};
+
+/// 文字指令作用的分類站，以 '#' 加上位址切換
+sort_station* selected_station = &stations[0];
+
+/// 初始化機械手臂的伺服馬達參數與 GPIO 腳位，腳位與其他分類站衝突時回傳 false
+bool robotic_arm_starter(sort_station* station) {
+    robotic_arm* robot_arm = station->robot;
+    if (!robotic_arm_init(robot_arm, station->configs)) {
+        fprintf(stderr, "Failed to initialize robotic arm %d.\n", station->address);
+        return false;
+    }
+
+    // 看門狗重置後從重置前的姿勢開始軟啟動，而不是停放姿勢（只保存第一站的姿勢）
+    if (station->address == 0) {
+        arm_boot_restore_pose(robot_arm);
+    }
 
     // 啟動控制 PWM 輸出
-    robotic_arm_start(robot_arm);
+#if ROBOTIC_ARM_USE_CORE1
+    return robotic_arm_start_core1(robot_arm);
+#else
+    return robotic_arm_start(robot_arm);
+#endif
 }
 
-/// 自訂模式：根據輸入字元觸發一連串的預設動作（例如 a/m/g/p）
-void robotic_arm_custom_control_mode(robotic_arm* robot_arm) {
-    uint8_t control_servos[robot_arm->number];
-    float target_angles[robot_arm->number];
-    robotic_arm_signal control_signal = {
-        .indexes = control_servos,
-        .angles = target_angles,
-        .number = 0
-    };
+/// 讀取一行指令到 line，超過緩衝長度的字元會被捨棄；等待輸入時持續餵看門狗，打字慢也不會重置
+void robotic_arm_read_line(char* line, int size) {
+    int len = 0;
+    while (true) {
+        watchdog_update();
+        int c = getchar_timeout_us(1000);
+        if (c == PICO_ERROR_TIMEOUT) continue;
+        if (c == '\n' || c == '\r') break;
+        if (len < size - 1) line[len++] = (char)c;
+    }
+    line[len] = '\0';
+}
 
-    // 預先定義四組動作序列（A = all, M = metal, G = glass, P = plastic）
-    char pick_and_return[][40] = {
-        "3 0 150 1 40 2 126",// 3 = 馬達數量，0 = 馬達編號，150 = 角度，依序是馬達0角度150，馬達1角度40，馬達2角度126
-        "1 3 165",
-        "1 1 90",
-        "1 0 90"
-    };
-    char throw_and_return[][40] = {
-        "1 3 90",
-        "3 0 90 1 90 2 90"
+/// 除錯用：讀取一行 "number index angle ..." 文字並直接移動手臂
+void robotic_arm_debug_command(sort_station* station) {
+    robotic_arm* robot_arm = station->robot;
+    char line[40];
+    robotic_arm_read_line(line, sizeof(line));
+    robotic_arm_move_by_string(robot_arm, line);
+    // 手動移動後，下一個物品從目前姿勢開始規劃
+    robotic_arm_wait(robot_arm);
+    sort_planner_sync(&station->planner, robot_arm);
+}
+
+/// 除錯用：讀取一行 "x y z"（毫米）並以逆運動學移動夾爪，從可行解中選擇關節移動量最小者
+void robotic_arm_point_command(sort_station* station) {
+    robotic_arm* robot_arm = station->robot;
+    char line[40];
+    robotic_arm_read_line(line, sizeof(line));
+
+    arm_point target;
+    if (sscanf(line, "%f %f %f", &target.x, &target.y, &target.z) != 3) {
+        fprintf(stderr, "Expected x y z in millimetres.\n");
+        return;
+    }
+    arm_ik_solution solution;
+    if (arm_kinematics_inverse(&arm_geometry, robot_arm->servos, &target, &solution) == 0) {
+        fprintf(stderr, "Point is out of reach.\n");
+        return;
+    }
+    // 等前面的動作完成，目前角度才是實際出發的姿勢
+    robotic_arm_wait(robot_arm);
+    float current[ARM_KINEMATICS_JOINTS];
+    for (uint8_t i = 0; i < ARM_KINEMATICS_JOINTS; i++) current[i] = robot_arm->servos[i].angle;
+    const float* angles = arm_kinematics_select(&solution, current);
+    printf("Moving to %.1f %.1f %.1f degrees.\n", angles[0], angles[1], angles[2]);
+
+    robotic_arm_segment segment;
+    arm_kinematics_segment(&segment, angles);
+    robotic_arm_queue_segment(robot_arm, &segment);
+    robotic_arm_wait(robot_arm);
+    sort_planner_sync(&station->planner, robot_arm);
+}
+
+/// 教導模式："r 名稱" 開始錄製、"s" 停止並存入 flash、"p 名稱 [速度]" 重播、"l" 列出錄製、"d 名稱" 刪除
+void robotic_arm_teach_command(sort_station* station) {
+    robotic_arm* robot_arm = station->robot;
+    char line[40];
+    robotic_arm_read_line(line, sizeof(line));
+
+    char action = '\0';
+    char name[ARM_TEACH_NAME_SIZE] = "";
+    float speed = 1.0f;
+    int fields = sscanf(line, " %c %15s %f", &action, name, &speed);
+    if (fields < 1) {
+        fprintf(stderr, "Expected r, s, p, l or d.\n");
+        return;
+    }
+    switch (action) {
+        case 'r':
+            // 錄製期間以 '$' 或 '@' 手動移動手臂，每個動作週期記錄一次
+            if (fields >= 2 && arm_teach_record(robot_arm, name)) {
+                printf("Recording %s, move the arm and send ^s to stop.\n", name);
+            }
+            break;
+        case 's':
+            arm_teach_stop();
+            break;
+        case 'p':
+            // 直接從 flash 讀取重播，不複製到 RAM
+            if (fields >= 2 && arm_teach_play(robot_arm, name, speed, 0)) {
+                robotic_arm_wait(robot_arm);
+                sort_planner_sync(&station->planner, robot_arm);
+            }
+            break;
+        case 'l':
+            arm_teach_list();
+            break;
+        case 'd':
+            if (fields >= 2 && arm_teach_delete(name)) {
+                printf("Recording %s deleted.\n", name);
+            }
+            break;
+        default:
+            fprintf(stderr, "Expected r, s, p, l or d.\n");
+            break;
+    }
+}
+
+/// 還能接受幾個分類工作（以佇列空間與追蹤表空間較小者為準）
+uint8_t sort_job_free_slots(sort_station* station) {
+    robotic_arm* robot_arm = station->robot;
+    // 保留一格給回到原點的動作段
+    uint8_t room = robotic_arm_queue_room(robot_arm);
+    uint8_t by_queue = room > 1 ? (room - 1) / SORT_PLANNER_ITEM_SEGMENTS : 0;
+    uint8_t by_table = SORT_JOB_PENDING_MAX - 1 - (uint8_t)((station->pending_head + SORT_JOB_PENDING_MAX - station->pending_tail) % SORT_JOB_PENDING_MAX);
+    return by_queue < by_table ? by_queue : by_table;
+}
+
+/// 整個分類工作一次排入佇列，空間不足時不排入任何動作並回傳 false
+bool sort_job_queue(sort_station* station, uint8_t seq, uint8_t index, uint8_t command) {
+    robotic_arm* robot_arm = station->robot;
+    uint8_t next = (station->pending_head + 1) % SORT_JOB_PENDING_MAX;
+    if (next == station->pending_tail) {
+        return false;
+    }
+    // 只有 core 0 排入動作段，排入前的計數就是這個工作第一段的編號
+    uint32_t start_mark = robot_arm->segments_queued;
+    if (!sort_planner_queue_item(&station->planner, robot_arm, command)) {
+        return false;
+    }
+    station->pending_jobs[station->pending_head] = (sort_job){
+        .seq = seq,
+        .index = index,
+        .bin = command,
+        .started = false,
+        .speculative = false,
+        .start_mark = start_mark,
+        .done_mark = robot_arm->segments_queued,
+        .received_us = time_us_32()
     };
-    char action_a[][40] = {"3 0 90 1 65 2 145"}; // 動作 A：3個馬達分別到指定角度
-    char action_m[][40] = {"3 0 85 1 25 2 47"};
-    char action_g[][40] = {"3 0 36 1 65 2 140"};
-    char action_p[][40] = {"3 0 51 1 30 2 40"};
+    station->pending_head = next;
+    return true;
+}
 
-    char action_tip[] = "Enter 'a', 'm', 'g', or 'p' to play actions, 'q' to quit:\n";
-    printf(action_tip);
+/// 回報已完成的分類工作（DONE 封包），並記錄指令延遲與分類循環時間
+/// 主迴圈每毫秒內會呼叫一次，時間解析度約 1 ms
+void sort_job_report_done(sort_station* station) {
+    robotic_arm* robot_arm = station->robot;
+    uint32_t now = time_us_32();
+    uint32_t started = robot_arm->segments_started;
+    for (uint8_t i = station->pending_tail; i != station->pending_head; i = (i + 1) % SORT_JOB_PENDING_MAX) {
+        sort_job* job = &station->pending_jobs[i];
+        // 工作依序執行，遇到尚未開始的工作即可停止
+        if (!job->started) {
+            if ((int32_t)(started - job->start_mark) <= 0) break;
+            job->started = true;
+            job->started_us = now;
+            arm_stats_record(ARM_STATS_COMMAND_LATENCY, now - job->received_us);
+        }
+    }
+    while (station->pending_tail != station->pending_head) {
+        sort_job* job = &station->pending_jobs[station->pending_tail];
+        // 推測工作在確認前不會完成；以差值比較，計數器溢位後仍正確
+        if (job->speculative || (int32_t)(robot_arm->segments_done - job->done_mark) < 0) {
+            return;
+        }
+        arm_stats_metric cycle = sort_job_cycle_metric(job->bin);
+        if (cycle != ARM_STATS_METRICS) {
+            arm_stats_record(cycle, now - job->started_us);
+        }
+        arm_protocol_send_status(station->address, job->seq, ARM_PROTOCOL_DONE, job->index, 0);
+        station->pending_tail = (station->pending_tail + 1) % SORT_JOB_PENDING_MAX;
+    }
+}
 
-    // 等待使用者輸入模式字元
+/// 手臂閒置且沒有待完成的工作超過 SORT_PARK_DELAY_MS 後才回到原點
+void sort_job_park(sort_station* station) {
+    robotic_arm* robot_arm = station->robot;
+    if (station->pending_tail != station->pending_head || !robotic_arm_is_idle(robot_arm)) {
+        station->park_waiting = false;
+        return;
+    }
+    uint32_t now = time_us_32();
+    if (!station->park_waiting) {
+        station->park_waiting = true;
+        station->park_idle_us = now;
+        return;
+    }
+    if (now - station->park_idle_us >= SORT_PARK_DELAY_MS * 1000u) {
+        sort_planner_park(&station->planner, robot_arm);
+        station->park_waiting = false;
+    }
+}
+
+/// 佇列中等待確認的推測工作，沒有時回傳 NULL（推測工作一定是最後一個）
+sort_job* sort_job_speculative(sort_station* station) {
+    if (station->pending_head == station->pending_tail) return NULL;
+    sort_job* job = &station->pending_jobs[(station->pending_head + SORT_JOB_PENDING_MAX - 1) % SORT_JOB_PENDING_MAX];
+    return job->speculative ? job : NULL;
+}
+
+/// 推測工作：依暫定的分類箱先夾取並移到分類箱上方，確認或取消前不放開物品
+void sort_job_handle_speculative(sort_station* station, arm_protocol_frame* frame) {
+    robotic_arm* robot_arm = station->robot;
+    uint8_t slots = sort_job_free_slots(station);
+    if (frame->type == ARM_PROTOCOL_SPEC) {
+        uint8_t next = (station->pending_head + 1) % SORT_JOB_PENDING_MAX;
+        uint32_t start_mark = robot_arm->segments_queued;
+        if (next == station->pending_tail || !sort_planner_queue_speculative(&station->planner, robot_arm, frame->payload[0])) {
+            arm_protocol_send_status(station->address, frame->seq, ARM_PROTOCOL_BUSY, 0, slots);
+            return;
+        }
+        station->pending_jobs[station->pending_head] = (sort_job){
+            .seq = frame->seq,
+            .index = 0,
+            .bin = frame->payload[0],
+            .started = false,
+            .speculative = true,
+            .start_mark = start_mark,
+            .received_us = time_us_32()
+        };
+        station->pending_head = next;
+        arm_protocol_send_status(station->address, frame->seq, ARM_PROTOCOL_ACK, 1, sort_job_free_slots(station));
+        return;
+    }
+    sort_job* job = sort_job_speculative(station);
+    if (!job) {
+        uint8_t error[2] = {ARM_PROTOCOL_ERROR_STATE, 0};
+        arm_protocol_send(station->address, frame->seq, ARM_PROTOCOL_ERROR, error, sizeof(error));
+        return;
+    }
+    if (frame->type == ARM_PROTOCOL_CANCEL) {
+        // 停下手臂；已夾住的物品放回夾取點
+        sort_planner_cancel(&station->planner, robot_arm);
+        station->pending_head = (station->pending_head + SORT_JOB_PENDING_MAX - 1) % SORT_JOB_PENDING_MAX;
+        arm_protocol_send_status(station->address, frame->seq, ARM_PROTOCOL_ACK, 0, sort_job_free_slots(station));
+        return;
+    }
+    // CONFIRM：分類箱不同時在移動途中改變目標
+    if (!sort_planner_confirm(&station->planner, robot_arm, frame->payload[0])) {
+        arm_protocol_send_status(station->address, frame->seq, ARM_PROTOCOL_BUSY, 0, slots);
+        return;
+    }
+    job->bin = frame->payload[0];
+    job->speculative = false;
+    job->done_mark = robot_arm->segments_queued;
+    arm_protocol_send_status(station->address, frame->seq, ARM_PROTOCOL_ACK, 1, sort_job_free_slots(station));
+}
+
+/// 處理一個完整的二進位封包：JOB 排入分類工作並回覆 ACK/BUSY，PING 回覆目前可用空間
+void robotic_arm_handle_frame(sort_station* station, arm_protocol_frame* frame) {
+    if (frame->type == ARM_PROTOCOL_PING) {
+        arm_protocol_send_status(station->address, frame->seq, ARM_PROTOCOL_ACK, 0, sort_job_free_slots(station));
+        return;
+    }
+    if (frame->type == ARM_PROTOCOL_SPEC || frame->type == ARM_PROTOCOL_CONFIRM || frame->type == ARM_PROTOCOL_CANCEL) {
+        // SPEC 與 CONFIRM 帶一個分類箱指令，CANCEL 沒有內容
+        uint8_t expected = frame->type == ARM_PROTOCOL_CANCEL ? 0 : 1;
+        if (frame->length != expected || (expected && !sort_planner_is_valid(&station->planner, frame->payload[0]))) {
+            uint8_t error[2] = {ARM_PROTOCOL_ERROR_COMMAND, 0};
+            arm_protocol_send(station->address, frame->seq, ARM_PROTOCOL_ERROR, error, sizeof(error));
+            return;
+        }
+        sort_job_handle_speculative(station, frame);
+        return;
+    }
+    if (frame->type != ARM_PROTOCOL_JOB) {
+        uint8_t error[2] = {ARM_PROTOCOL_ERROR_TYPE, frame->type};
+        arm_protocol_send(station->address, frame->seq, ARM_PROTOCOL_ERROR, error, sizeof(error));
+        return;
+    }
+    // 先檢查所有指令，任何一個無效就整包拒絕，避免手臂做出多餘的夾取
+    for (uint8_t i = 0; i < frame->length; i++) {
+        if (!sort_planner_is_valid(&station->planner, frame->payload[i])) {
+            uint8_t error[2] = {ARM_PROTOCOL_ERROR_COMMAND, i};
+            arm_protocol_send(station->address, frame->seq, ARM_PROTOCOL_ERROR, error, sizeof(error));
+            return;
+        }
+    }
+    uint8_t accepted = 0;
+    while (accepted < frame->length &&
+           sort_job_queue(station, frame->seq, accepted, frame->payload[accepted])) {
+        accepted++;
+    }
+    arm_protocol_send_status(station->address, frame->seq, accepted == frame->length ? ARM_PROTOCOL_ACK : ARM_PROTOCOL_BUSY,
+                             accepted, sort_job_free_slots(station));
+}
+
+/// 自訂模式：根據輸入字元觸發一連串的預設動作（例如 a/m/g/p），或接收二進位 JOB 封包
+void robotic_arm_custom_control_mode(void) {
+    // 姿勢在開機時解好逆運動學（見 src/sort_sequences.c），每個物品由 sort_planner 從上一個分類箱直接規劃到夾取點
+    char action_tip[] = "Enter 'a', 'm', 'g', or 'p' to play actions, '$' followed by a signal string to move directly, '@' followed by x y z to move the gripper to a point, '%' to benchmark, '?' to print statistics, '!' to reset them, '&' to dump the PWM trace, '^' followed by r/s/p/l/d and a name to record, stop, play, list or delete taught paths, '#' followed by an address to select the arm these commands go to:\n";
+    bool host_connected = false;
+
+    arm_protocol_parser parser;
+    arm_protocol_reset(&parser);
+
+    // 不阻塞地讀取輸入，手臂移動期間仍可接收指令並回報完成
     while (true) {
-        int input = getchar();
-        if(input == '\n') continue; // 忽略換行符號
-
-        // 根據輸入選擇動作序列
-        char (*selected_action)[40] = NULL;
-        int action_len = 0;
-        selected_action = pick_and_return;
-        action_len = sizeof(pick_and_return)/sizeof(pick_and_return[0]);
-        for (int i = 0; i < action_len; i++) {
-            robotic_arm_signal_from_string(&control_signal, selected_action[i]);
-            robotic_arm_move(robot_arm, &control_signal);
-            sleep_ms(100); // 每段動作間稍微間隔
-        }
-        switch (input) {
-            case 'a': case 'A': selected_action = action_a; action_len = sizeof(action_a)/sizeof(action_a[0]); break;
-            case 'm': case 'M': selected_action = action_m; action_len = sizeof(action_m)/sizeof(action_m[0]); break;
-            case 'g': case 'G': selected_action = action_g; action_len = sizeof(action_g)/sizeof(action_g[0]); break;
-            case 'p': case 'P': selected_action = action_p; action_len = sizeof(action_p)/sizeof(action_p[0]); break;
-            default:
-                printf("Invalid command.\n%s", action_tip);
+        watchdog_update();
+        // 手臂不等待主機即開機，主機連上串列埠時才印出提示與開機報告
+        if (stdio_usb_connected() != host_connected) {
+            host_connected = !host_connected;
+            if (host_connected) {
+                for (uint8_t i = 0; i < ARM_STATIONS; i++) {
+                    printf("Robotic arm %d initialized with %d servos.\n", stations[i].address, stations[i].robot->number);
+                }
+                arm_boot_print();
+                fputs(action_tip, stdout);  // 提示含有 '%'，不可當成格式字串
+            }
+        }
+        // 每一站各自回報完成並回到原點
+        for (uint8_t i = 0; i < ARM_STATIONS; i++) {
+            sort_job_report_done(&stations[i]);
+            sort_job_park(&stations[i]);
+        }
+        arm_teach_poll();
+        int input = getchar_timeout_us(1000);
+        if (input == PICO_ERROR_TIMEOUT) continue;
+
+        // 0xA5 開頭的位元組交給封包解析器
+        arm_protocol_result result = arm_protocol_feed(&parser, (uint8_t)input);
+        if (result == ARM_PROTOCOL_FRAME) {
+            // 依位址交給對應的分類站
+            if (parser.frame.address >= ARM_STATIONS) {
+                uint8_t error[2] = {ARM_PROTOCOL_ERROR_ADDRESS, parser.frame.address};
+                arm_protocol_send(parser.frame.address, parser.frame.seq, ARM_PROTOCOL_ERROR, error, sizeof(error));
+                continue;
+            }
+            robotic_arm_handle_frame(&stations[parser.frame.address], &parser.frame);
+            continue;
+        }
+        if (result == ARM_PROTOCOL_BAD_CRC) {
+            // 位址與 seq 可能正是出錯的位元組，不回覆給任何一站，避免清掉其他工作的追蹤
+            uint8_t error[2] = {ARM_PROTOCOL_ERROR_CRC, 0};
+            arm_protocol_send(ARM_PROTOCOL_ADDRESS_NONE, 0, ARM_PROTOCOL_ERROR, error, sizeof(error));
+            continue;
+        }
+        if (result == ARM_PROTOCOL_PENDING) continue;
+
+        // 以下為相容舊版的單一字元指令，作用在目前選擇的分類站
+        sort_station* station = selected_station;
+        robotic_arm* robot_arm = station->robot;
+        if(input == '\n' || input == '\r') continue; // 忽略換行符號
+        if(input == '#') {
+            char line[8];
+            robotic_arm_read_line(line, sizeof(line));
+            int address = atoi(line);
+            if (address < 0 || address >= ARM_STATIONS) {
+                fprintf(stderr, "No arm at address %d.\n", address);
                 continue;
+            }
+            selected_station = &stations[address];
+            printf("Commands go to arm %d.\n", address);
+            continue;
+        }
+        if(input == '$') {
+            robotic_arm_debug_command(station);
+            continue;
+        }
+        if(input == '@') {
+            robotic_arm_point_command(station);
+            continue;
+        }
+        if(input == '^') {
+            robotic_arm_teach_command(station);
+            continue;
+        }
+        if(input == '%') {
+            // 量測浮點與定點插值每步所需的 CPU 週期，不會移動馬達
+            servo* motors[ARM_SERVOS];
+            for (uint8_t i = 0; i < robot_arm->number; i++) motors[i] = &robot_arm->servos[i];
+            servos_motion_benchmark(robot_arm->number, motors);
+            continue;
+        }
+        if(input == '?') {
+            // 指令延遲、動作段時間、步進抖動與各分類箱的循環時間直方圖
+            arm_stats_print();
+            for (uint8_t i = 0; i < ARM_STATIONS; i++) {
+                sort_planner_print(&stations[i].planner);
+            }
+            arm_boot_print();
+            continue;
+        }
+        if(input == '!') {
+            arm_stats_reset();
+            printf("Statistics reset.\n");
+            continue;
+        }
+        if(input == '&') {
+            // 二進位追蹤資料，以 tools/trace_decode.py 轉成 CSV 或各軸時間軸
+            if (!arm_trace_dump(trace_write_usb)) {
+                printf("PWM trace is not compiled in, build with -DARM_TRACE=ON.\n");
+            }
+            stdio_flush();
+            continue;
         }
 
-        // 執行動作序列（轉成控制信號並移動）
-        for (int i = 0; i < action_len; i++) {
-            robotic_arm_signal_from_string(&control_signal, selected_action[i]);
-            robotic_arm_move(robot_arm, &control_signal);
-            sleep_ms(100); // 每段動作間稍微間隔
+        // 先確認指令有效才夾取，無效字元不會讓手臂多做一次夾取
+        if (!sort_planner_is_valid(&station->planner, input)) {
+            printf("Invalid command.\n%s", action_tip);
+            continue;
         }
-        selected_action = throw_and_return;
-        action_len = sizeof(throw_and_return)/sizeof(throw_and_return[0]);
-        for (int i = 0; i < action_len; i++) {
-            robotic_arm_signal_from_string(&control_signal, selected_action[i]);
-            robotic_arm_move(robot_arm, &control_signal);
-            sleep_ms(100); // 每段動作間稍微間隔
+
+        if (station->planner.speculative) {
+            printf("A speculative job is waiting for CONFIRM or CANCEL.\n");
+            continue;
+        }
+
+        // 排入規劃好的路徑，手臂在背景移動時即可讀取下一個指令
+        // 佇列已滿時直接拒絕，空轉等待會讓看門狗逾時，也會延誤 DONE 回報與回到原點
+        if (!sort_planner_queue_item(&station->planner, robot_arm, input)) {
+            fprintf(stderr, "Queue is full, send the command again later.\n");
         }
     }
 }
@@ -96,37 +552,40 @@ void robotic_arm_custom_control_mode(robotic_arm* robot_arm) {
 /// 主程式：初始化 servo 與 robotic_arm，啟用自訂控制模式
 int main() {
     stdio_init_all();
+    arm_boot_begin();
 
+#if ARM_BOOT_WAIT_FOR_HOST
     // 等待 USB 串列連線完成
     while (!stdio_usb_connected()) {
         sleep_ms(100);
     }
+#endif
 
-    // 設定 MG996R 伺服馬達參數
-    servo mg996r = {
-        .angle_range = 180.0f,
-        .period = 20000,
-        .min_duty = 500,
-        .max_duty = 2500,
-        .angle = 90.0f,
-        .angle_lower_bound = 0.0f,
-        .angle_upper_bound = 180.0f
-    };
+    // 各站的四軸機械手臂已在靜態記憶體中定義，依序軟啟動以分散啟動電流
+    for (uint8_t i = 0; i < ARM_STATIONS; i++) {
+        sort_station* station = &stations[i];
+        robotic_arm* robot_arm = station->robot;
 
-    // 建立四軸機械手臂
-    robotic_arm* robot_arm = robotic_arm_create(4);
-    if (!robot_arm) {
-        fprintf(stderr, "Failed to create robotic arm.\n");
-        return 1;
+        // 初始化馬達參數與 GPIO 腳位
+        if (!robotic_arm_starter(station)) {
+            return 1;
+        }
+
+        // 夾取、分類箱與原點姿勢只在開機時解一次逆運動學
+        if (!arm_pose_cache_build(&station->pose_cache, &arm_geometry, robot_arm->servos, sort_pose_points, SORT_POSES)) {
+            fprintf(stderr, "Some sort poses are out of reach, check the arm geometry.\n");
+        }
+        sort_planner_init(&station->planner, &station->pose_cache, robot_arm);
     }
 
-    // 初始化馬達參數與 GPIO 腳位
-    robotic_arm_starter(robot_arm, &mg996r);
+    // 開機即開始記錄 PWM 寫入（未編譯追蹤功能時不做任何事）
+    arm_trace_start();
 
-    printf("Robotic arm initialized with %d servos.\n", robot_arm->number);
+    // 記錄開機到可接收指令的時間並啟用看門狗，之後由主迴圈餵狗
+    arm_boot_ready(stations[0].robot);
 
     // 進入自訂控制模式
-    robotic_arm_custom_control_mode(robot_arm);
+    robotic_arm_custom_control_mode();
 
     return 0;
 }
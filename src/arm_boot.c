@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/pwm.h"
+#include "hardware/watchdog.h"
+#include "arm_boot.h"
+
+
+static arm_boot_report boot_report;
+
+// Robotic arm whose pose is saved, the first one made ready
+static robotic_arm* boot_robot = NULL;
+
+/**
+ * Record why the board was reset, call first thing in main().
+ */
+void arm_boot_begin(void) {
+    boot_report.watchdog_reset = watchdog_caused_reboot();
+    boot_report.pose_restored = false;
+    boot_report.start_us = 0;
+    boot_report.ready_us = 0;
+}
+
+/**
+ * After a watchdog reset, make the soft start begin from the levels the servos held before it
+ * instead of the park pose, so a recovering arm does not jump. Call between robotic_arm_init()
+ * and robotic_arm_start().
+ * 
+ * @robot: Robotic arm about to start
+ * 
+ * Return true if a saved pose was found.
+ */
+bool arm_boot_restore_pose(robotic_arm* robot) {
+    // Scratch registers are also kept by a reset from the debugger, trust them only after the watchdog
+    if(!boot_report.watchdog_reset || robot->number > ARM_BOOT_POSE_SERVOS)
+        return false;
+    if(watchdog_hw->scratch[0] != (ARM_BOOT_POSE_MAGIC | robot->number))
+        return false;
+    for(uint8_t i = 0; i < robot->number; i++) {
+        uint16_t level = (uint16_t)(watchdog_hw->scratch[1 + i / 2] >> (16 * (i % 2)));
+        // Servos that were not driven yet keep their park angle
+        if(level == 0)
+            continue;
+        servo* motor = &robot->servos[i];
+        servo_calibrate(motor);
+        float angle = servo_level_to_angle(motor, level);
+        if(angle < motor->angle_lower_bound)
+            angle = motor->angle_lower_bound;
+        if(angle > motor->angle_upper_bound)
+            angle = motor->angle_upper_bound;
+        robot->park_angles[i] = angle;
+    }
+    boot_report.pose_restored = true;
+    return true;
+}
+
+/**
+ * Save the current PWM levels of the servos in the watchdog scratch registers,
+ * called by robotic_arm_tick().
+ * 
+ * @robot: Robotic arm being ticked
+ */
+void arm_boot_save_pose(robotic_arm* robot) {
+    if(robot != boot_robot)
+        return;
+    uint32_t packed[ARM_BOOT_POSE_SERVOS / 2] = {0};
+    for(uint8_t i = 0; i < robot->number; i++) {
+        const servo* motor = &robot->servos[i];
+        uint32_t compare = pwm_hw->slice[motor->slice].cc;
+        uint16_t level = motor->channel ? (uint16_t)(compare >> 16) : (uint16_t)compare;
+        packed[i / 2] |= (uint32_t)level << (16 * (i % 2));
+    }
+    // Scratch registers 4 to 7 belong to the SDK
+    for(uint8_t i = 0; i < ARM_BOOT_POSE_SERVOS / 2; i++)
+        watchdog_hw->scratch[1 + i] = packed[i];
+    watchdog_hw->scratch[0] = ARM_BOOT_POSE_MAGIC | robot->number;
+}
+
+/**
+ * Mark the arm ready to take commands and enable the watchdog.
+ * Feed it with watchdog_update() from the main loop afterwards.
+ * 
+ * @robot: Robotic arm that was started
+ */
+void arm_boot_ready(robotic_arm* robot) {
+    boot_report.start_us = robot->start_us;
+    boot_report.ready_us = (uint32_t)time_us_64();
+    if(robot->number <= ARM_BOOT_POSE_SERVOS)
+        boot_robot = robot;
+#if ARM_BOOT_WATCHDOG_MS > 0
+    watchdog_enable(ARM_BOOT_WATCHDOG_MS, true);
+#endif
+}
+
+/**
+ * Get the boot report, filled in by arm_boot_ready().
+ */
+const arm_boot_report* arm_boot_get_report(void) {
+    return &boot_report;
+}
+
+/**
+ * Print boot reason and times.
+ */
+void arm_boot_print(void) {
+    printf("Boot: %s reset, ready in %lu ms, servo soft start %lu ms%s\n",
+           boot_report.watchdog_reset ? "watchdog" : "power-on",
+           (unsigned long)(boot_report.ready_us / 1000),
+           (unsigned long)(boot_report.start_us / 1000),
+           boot_report.pose_restored ? ", resumed from the saved pose" : "");
+}
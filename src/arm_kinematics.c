@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <math.h>
+#include "pico/stdlib.h"
+#include "arm_kinematics.h"
+
+
+#define KINEMATICS_PI 3.14159265f
+#define KINEMATICS_DEG_TO_RAD (KINEMATICS_PI / 180.0f)
+#define KINEMATICS_RAD_TO_DEG (180.0f / KINEMATICS_PI)
+
+// Rounding slack on the reach limits and servo limits
+#define KINEMATICS_EPSILON 1e-4f
+#define KINEMATICS_ANGLE_SLACK 0.01f
+
+static float kinematics_wrap_degrees(float angle) {
+    while(angle > 180.0f)
+        angle -= 360.0f;
+    while(angle <= -180.0f)
+        angle += 360.0f;
+    return angle;
+}
+
+// Convert joint angles to servo angles and keep them if every servo can reach them
+static bool kinematics_add_solution(const arm_kinematics* kinematics, const servo* motors, const float* joints, arm_ik_solution* solution) {
+    float* angles = solution->angles[solution->count];
+    for(uint8_t i = 0; i < ARM_KINEMATICS_JOINTS; i++) {
+        angles[i] = kinematics->servo_offsets[i] + kinematics->servo_directions[i] * joints[i];
+        if(motors == NULL)
+            continue;
+        if(angles[i] < motors[i].angle_lower_bound - KINEMATICS_ANGLE_SLACK ||
+           angles[i] > motors[i].angle_upper_bound + KINEMATICS_ANGLE_SLACK)
+            return false;
+    }
+    solution->count++;
+    return true;
+}
+
+/**
+ * Calculate where the gripper tip is for servo angles.
+ * 
+ * @kinematics: Arm geometry
+ * @angles: Servo angles of the positioning joints (degrees)
+ * @point: Output gripper tip position
+ */
+void arm_kinematics_forward(const arm_kinematics* kinematics, const float* angles, arm_point* point) {
+    float joints[ARM_KINEMATICS_JOINTS];
+    for(uint8_t i = 0; i < ARM_KINEMATICS_JOINTS; i++)
+        joints[i] = (angles[i] - kinematics->servo_offsets[i]) * kinematics->servo_directions[i] * KINEMATICS_DEG_TO_RAD;
+    float reach = kinematics->upper_arm * cosf(joints[1]) + kinematics->forearm * cosf(joints[1] + joints[2]);
+    point->x = reach * cosf(joints[0]);
+    point->y = reach * sinf(joints[0]);
+    point->z = kinematics->base_height + kinematics->upper_arm * sinf(joints[1]) + kinematics->forearm * sinf(joints[1] + joints[2]);
+}
+
+/**
+ * Calculate every set of servo angles that puts the gripper tip at a point.
+ * 
+ * @kinematics: Arm geometry
+ * @motors: Servos of the positioning joints to respect the angle limits of, NULL for no limits
+ * @target: Point to reach
+ * @solution: Output solutions
+ * 
+ * Return the number of solutions, 0 if the point is out of reach.
+ */
+uint8_t arm_kinematics_inverse(const arm_kinematics* kinematics, const servo* motors, const arm_point* target, arm_ik_solution* solution) {
+    solution->count = 0;
+    float upper = kinematics->upper_arm;
+    float fore = kinematics->forearm;
+    float height = target->z - kinematics->base_height;
+    float reach = sqrtf(target->x * target->x + target->y * target->y);
+    // Straight up or down the base axis every yaw works, keep the current forward direction
+    float yaw = reach > KINEMATICS_EPSILON ? atan2f(target->y, target->x) * KINEMATICS_RAD_TO_DEG : 0.0f;
+
+    float cos_elbow = (reach * reach + height * height - upper * upper - fore * fore) / (2.0f * upper * fore);
+    if(cos_elbow > 1.0f + KINEMATICS_EPSILON || cos_elbow < -1.0f - KINEMATICS_EPSILON)
+        return 0;
+    cos_elbow = fminf(fmaxf(cos_elbow, -1.0f), 1.0f);
+    float bend = acosf(cos_elbow);
+
+    // Facing the target, then turned away reaching back over the base, elbow up before elbow down
+    for(uint8_t side = 0; side < 2; side++) {
+        float side_reach = side ? -reach : reach;
+        float side_yaw = side ? kinematics_wrap_degrees(yaw + 180.0f) : yaw;
+        for(uint8_t branch = 0; branch < 2; branch++) {
+            // Elbow up bends the forearm down from the upper arm, the other way round when reaching back
+            float elbow = (branch == side) ? -bend : bend;
+            float shoulder = atan2f(height, side_reach) - atan2f(fore * sinf(elbow), upper + fore * cosf(elbow));
+            float joints[ARM_KINEMATICS_JOINTS] = {
+                side_yaw,
+                kinematics_wrap_degrees(shoulder * KINEMATICS_RAD_TO_DEG),
+                elbow * KINEMATICS_RAD_TO_DEG
+            };
+            kinematics_add_solution(kinematics, motors, joints, solution);
+            // Fully stretched or folded arms have a single elbow solution
+            if(bend < KINEMATICS_EPSILON || bend > KINEMATICS_PI - KINEMATICS_EPSILON)
+                break;
+        }
+    }
+    return solution->count;
+}
+
+/**
+ * Choose one solution of an inverse kinematics result.
+ * 
+ * @solution: Solutions to choose from, count must be at least 1
+ * @current: Current servo angles to choose the solution with the least total joint travel from,
+ *           NULL for the first (preferred) solution
+ */
+const float* arm_kinematics_select(const arm_ik_solution* solution, const float* current) {
+    uint8_t best = 0;
+    if(current == NULL)
+        return solution->angles[best];
+    float best_travel = 0.0f;
+    for(uint8_t s = 0; s < solution->count; s++) {
+        float travel = 0.0f;
+        for(uint8_t i = 0; i < ARM_KINEMATICS_JOINTS; i++)
+            travel += fabsf(solution->angles[s][i] - current[i]);
+        if(s == 0 || travel < best_travel) {
+            best = s;
+            best_travel = travel;
+        }
+    }
+    return solution->angles[best];
+}
+
+/**
+ * Solve fixed poses once so they can be looked up in constant time while sorting.
+ * 
+ * @cache: Cache to fill
+ * @kinematics: Arm geometry
+ * @motors: Servos of the positioning joints, NULL for no limits
+ * @points: Positions of the poses
+ * @number: Number of poses, at most ARM_POSE_CACHE_SIZE
+ * 
+ * Return false if a pose is out of reach, its cache entry then has no solution.
+ */
+bool arm_pose_cache_build(arm_pose_cache* cache, const arm_kinematics* kinematics, const servo* motors, const arm_point* points, uint8_t number) {
+    if(number > ARM_POSE_CACHE_SIZE) {
+        fprintf(stderr, "Too many poses for the pose cache\n");
+        number = ARM_POSE_CACHE_SIZE;
+    }
+    bool reachable = true;
+    cache->number = number;
+    for(uint8_t p = 0; p < number; p++) {
+        if(arm_kinematics_inverse(kinematics, motors, &points[p], &cache->poses[p]) == 0) {
+            fprintf(stderr, "Pose %u at (%.1f, %.1f, %.1f) is out of reach\n",
+                    p, points[p].x, points[p].y, points[p].z);
+            reachable = false;
+        }
+    }
+    return reachable;
+}
+
+/**
+ * Look up the solutions of a cached pose.
+ * 
+ * @cache: Cache built by arm_pose_cache_build()
+ * @pose: Index of the pose in the points given to arm_pose_cache_build()
+ * 
+ * Return NULL if the pose is unknown or out of reach.
+ */
+const arm_ik_solution* arm_pose_cache_get(const arm_pose_cache* cache, uint8_t pose) {
+    if(pose >= cache->number || cache->poses[pose].count == 0)
+        return NULL;
+    return &cache->poses[pose];
+}
+
+/**
+ * Fill a segment moving the positioning joints to servo angles of a solution.
+ * 
+ * @segment: Segment to fill, holds and flags are cleared
+ * @angles: Servo angles of the positioning joints, e.g. from arm_kinematics_select()
+ */
+void arm_kinematics_segment(robotic_arm_segment* segment, const float* angles) {
+    segment->number = ARM_KINEMATICS_JOINTS;
+    for(uint8_t i = 0; i < ARM_KINEMATICS_JOINTS; i++) {
+        segment->indexes[i] = i;
+        segment->angles[i] = angles[i];
+    }
+    segment->hold_ms = 0;
+    segment->flags = 0;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "arm_protocol.h"
+
+
+// Parser states, in frame order
+#define PARSER_SOF 0
+#define PARSER_LENGTH 1
+#define PARSER_SEQ 2
+#define PARSER_ADDRESS 3
+#define PARSER_TYPE 4
+#define PARSER_PAYLOAD 5
+#define PARSER_CRC 6
+// Rest of an aborted frame, dropped until the next SOF, a newline or a pause of
+// ARM_PROTOCOL_BYTE_TIMEOUT_US, so its bytes never reach the ASCII commands
+#define PARSER_DISCARD 7
+
+/**
+ * Reset a parser to wait for the next start of frame.
+ * 
+ * @parser: Parser to reset
+ */
+void arm_protocol_reset(arm_protocol_parser* parser) {
+    parser->state = PARSER_SOF;
+    parser->received = 0;
+    parser->crc = 0;
+}
+
+/**
+ * Feed a received byte to a parser.
+ * The frame is valid in parser->frame when ARM_PROTOCOL_FRAME is returned.
+ * After a bad length, a bad CRC or a pause inside a frame, the following bytes are dropped
+ * until the next SOF, a newline or another pause, so a corrupt frame never runs ASCII commands.
+ * 
+ * @parser: Parser to feed
+ * @byte: Received byte
+ */
+arm_protocol_result arm_protocol_feed(arm_protocol_parser* parser, uint8_t byte) {
+    uint32_t now = time_us_32();
+    if(parser->state != PARSER_SOF && now - parser->last_byte_us > ARM_PROTOCOL_BYTE_TIMEOUT_US) {
+        // A pause ends the bytes being dropped; a frame the host stopped sending halfway is
+        // dropped together with any late rest of it
+        if(parser->state == PARSER_DISCARD)
+            arm_protocol_reset(parser);
+        else
+            parser->state = PARSER_DISCARD;
+    }
+    parser->last_byte_us = now;
+    arm_protocol_frame* frame = &parser->frame;
+    switch(parser->state) {
+        case PARSER_SOF:
+            if(byte != ARM_PROTOCOL_SOF)
+                return ARM_PROTOCOL_IDLE;
+            parser->state = PARSER_LENGTH;
+            return ARM_PROTOCOL_PENDING;
+        case PARSER_DISCARD:
+            arm_protocol_reset(parser);
+            if(byte == ARM_PROTOCOL_SOF)
+                parser->state = PARSER_LENGTH;
+            else if(byte != '\n' && byte != '\r')
+                parser->state = PARSER_DISCARD;
+            return ARM_PROTOCOL_PENDING;
+        case PARSER_LENGTH:
+            // SOF is never a valid length, the previous one was a stray byte of dropped data
+            if(byte == ARM_PROTOCOL_SOF)
+                return ARM_PROTOCOL_PENDING;
+            if(byte > ARM_PROTOCOL_MAX_PAYLOAD) {
+                arm_protocol_reset(parser);
+                parser->state = PARSER_DISCARD;
+                return ARM_PROTOCOL_PENDING;
+            }
+            frame->length = byte;
+            parser->state = PARSER_SEQ;
+            return ARM_PROTOCOL_PENDING;
+        case PARSER_SEQ:
+            frame->seq = byte;
+            parser->state = PARSER_ADDRESS;
+            return ARM_PROTOCOL_PENDING;
+        case PARSER_ADDRESS:
+            frame->address = byte;
+            parser->state = PARSER_TYPE;
+            return ARM_PROTOCOL_PENDING;
+        case PARSER_TYPE:
+            frame->type = byte;
+            parser->received = 0;
+            parser->state = frame->length ? PARSER_PAYLOAD : PARSER_CRC;
+            return ARM_PROTOCOL_PENDING;
+        case PARSER_PAYLOAD:
+            frame->payload[parser->received++] = byte;
+            if(parser->received == frame->length) {
+                parser->received = 0;
+                parser->state = PARSER_CRC;
+            }
+            return ARM_PROTOCOL_PENDING;
+        case PARSER_CRC:
+            parser->crc |= (uint16_t)byte << (8 * parser->received++);
+            if(parser->received < 2)
+                return ARM_PROTOCOL_PENDING;
+            break;
+        default:
+            arm_protocol_reset(parser);
+            return ARM_PROTOCOL_IDLE;
+    }
+    uint8_t header[4] = {frame->length, frame->seq, frame->address, frame->type};
+    uint16_t crc = arm_protocol_crc16(0xFFFF, header, sizeof(header));
+    crc = arm_protocol_crc16(crc, frame->payload, frame->length);
+    bool valid = crc == parser->crc;
+    arm_protocol_reset(parser);
+    // A byte lost inside this frame took the start of the next one as CRC, drop its rest
+    if(!valid)
+        parser->state = PARSER_DISCARD;
+    return valid ? ARM_PROTOCOL_FRAME : ARM_PROTOCOL_BAD_CRC;
+}
+
+/**
+ * Calculate CRC-16/CCITT-FALSE.
+ * 
+ * @crc: CRC of the previous bytes, 0xFFFF to start
+ * @data: Bytes to add
+ * @length: Number of bytes to add
+ */
+uint16_t arm_protocol_crc16(uint16_t crc, const uint8_t* data, uint length) {
+    for(uint i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for(uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+/**
+ * Send a frame over stdio without newline translation.
+ * 
+ * @address: Address of the arm sending the frame
+ * @seq: Sequence number of the frame
+ * @type: Frame type
+ * @payload: Payload bytes
+ * @length: Payload length, at most ARM_PROTOCOL_MAX_PAYLOAD
+ */
+void arm_protocol_send(uint8_t address, uint8_t seq, uint8_t type, const uint8_t* payload, uint8_t length) {
+    if(length > ARM_PROTOCOL_MAX_PAYLOAD) {
+        fprintf(stderr, "Protocol payload too long.\n");
+        return;
+    }
+    uint8_t header[4] = {length, seq, address, type};
+    uint16_t crc = arm_protocol_crc16(0xFFFF, header, sizeof(header));
+    crc = arm_protocol_crc16(crc, payload, length);
+    putchar_raw(ARM_PROTOCOL_SOF);
+    for(uint8_t i = 0; i < sizeof(header); i++)
+        putchar_raw(header[i]);
+    for(uint8_t i = 0; i < length; i++)
+        putchar_raw(payload[i]);
+    putchar_raw(crc & 0xFF);
+    putchar_raw(crc >> 8);
+    stdio_flush();
+}
+
+/**
+ * Send a status frame with a timestamp appended to its payload.
+ * 
+ * @address: Address of the arm sending the frame
+ * @seq: Sequence number of the frame
+ * @type: ARM_PROTOCOL_ACK, ARM_PROTOCOL_BUSY or ARM_PROTOCOL_DONE
+ * @first: First payload byte
+ * @second: Second payload byte, skipped for ARM_PROTOCOL_DONE
+ */
+void arm_protocol_send_status(uint8_t address, uint8_t seq, uint8_t type, uint8_t first, uint8_t second) {
+    uint8_t payload[6];
+    uint8_t length = 0;
+    payload[length++] = first;
+    if(type != ARM_PROTOCOL_DONE)
+        payload[length++] = second;
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+    for(uint8_t i = 0; i < 4; i++)
+        payload[length++] = (now_ms >> (8 * i)) & 0xFF;
+    arm_protocol_send(address, seq, type, payload, length);
+}
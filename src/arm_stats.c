@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "arm_stats.h"
+
+
+arm_stats_histogram arm_stats[ARM_STATS_METRICS];
+
+static const char* const arm_stats_names[ARM_STATS_METRICS] = {
+    [ARM_STATS_COMMAND_LATENCY] = "command latency",
+    [ARM_STATS_SEGMENT] = "segment",
+    [ARM_STATS_STEP_JITTER] = "step jitter",
+    [ARM_STATS_STEP_LATE] = "late step",
+    [ARM_STATS_CYCLE_A] = "cycle a",
+    [ARM_STATS_CYCLE_M] = "cycle m",
+    [ARM_STATS_CYCLE_G] = "cycle g",
+    [ARM_STATS_CYCLE_P] = "cycle p"
+};
+
+/**
+ * Clear all histograms.
+ */
+void arm_stats_reset(void) {
+    spin_lock_t* lock = spin_lock_instance(ARM_STATS_SPIN_LOCK);
+    uint32_t interrupts = spin_lock_blocking(lock);
+    memset(arm_stats, 0, sizeof(arm_stats));
+    spin_unlock(lock, interrupts);
+}
+
+/**
+ * Print count, mean and max of every metric with its non-empty histogram buckets.
+ */
+void arm_stats_print(void) {
+    for(uint metric = 0; metric < ARM_STATS_METRICS; metric++) {
+        // Copy first so the printed numbers agree with each other while the arm keeps recording
+        spin_lock_t* lock = spin_lock_instance(ARM_STATS_SPIN_LOCK);
+        uint32_t interrupts = spin_lock_blocking(lock);
+        arm_stats_histogram histogram = arm_stats[metric];
+        spin_unlock(lock, interrupts);
+        printf("%s: count %lu", arm_stats_names[metric], (unsigned long)histogram.count);
+        if(histogram.count == 0) {
+            printf("\n");
+            continue;
+        }
+        printf(", mean %llu us, max %lu us\n", (unsigned long long)(histogram.sum / histogram.count),
+               (unsigned long)histogram.max);
+        for(uint bucket = 0; bucket < ARM_STATS_BUCKETS; bucket++) {
+            if(histogram.buckets[bucket] == 0)
+                continue;
+            uint32_t low = bucket ? 1u << (bucket - 1) : 0;
+            uint32_t high = bucket ? (uint32_t)((1ull << bucket) - 1) : 0;
+            printf("  %10lu - %10lu us: %lu\n", (unsigned long)low, (unsigned long)high,
+                   (unsigned long)histogram.buckets[bucket]);
+        }
+    }
+}
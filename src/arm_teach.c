@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "pico/critical_section.h"
+#include "hardware/flash.h"
+#include "hardware/pwm.h"
+#include "hardware/sync.h"
+#include "arm_teach.h"
+
+
+// Longest frame: mask byte and a 3 byte varint per servo
+#define TEACH_FRAME_MAX (1 + 3 * SERVO_MOTION_MAX_SERVOS)
+
+// Frame bytes a slot can hold after its header page
+#define TEACH_SLOT_CAPACITY (ARM_TEACH_SLOT_SIZE - FLASH_PAGE_SIZE)
+
+/**
+ * @offset: Flash offset to erase or program, sector or page aligned
+ * @data: Bytes to program, NULL to erase
+ * @length: Bytes to erase or program, a multiple of the sector or page size
+ */
+typedef struct teach_flash_op {
+    uint32_t offset;
+    const uint8_t* data;
+    uint32_t length;
+} teach_flash_op;
+
+// Recorder, sampled on the motion core and written to flash on the core that started it
+static volatile bool teach_recording = false;
+static robotic_arm* teach_robot = NULL;
+static uint teach_slot = 0;
+static arm_teach_header teach_header;
+static uint16_t teach_levels[SERVO_MOTION_MAX_SERVOS];
+static bool teach_first = true;
+static uint32_t teach_still = 0;
+static uint32_t teach_length = 0;
+static uint32_t teach_written = 0;
+static volatile bool teach_full = false;
+static uint8_t teach_pages[ARM_TEACH_PAGE_BUFFERS][FLASH_PAGE_SIZE];
+static volatile bool teach_page_ready[ARM_TEACH_PAGE_BUFFERS];
+static uint teach_page = 0;
+static uint teach_page_used = 0;
+static critical_section_t teach_lock;
+static bool teach_lock_ready = false;
+
+// Replayer, prepared by arm_teach_play() and stepped by the motion tick
+static robotic_arm* volatile replay_robot = NULL;
+static bool replay_started;
+static const uint8_t* replay_read;
+static const uint8_t* replay_end;
+static uint32_t replay_repeat;
+static uint32_t replay_phase_q8;
+static uint32_t replay_step_q8;
+static int32_t replay_from[SERVO_MOTION_MAX_SERVOS];
+static int32_t replay_to[SERVO_MOTION_MAX_SERVOS];
+static uint16_t replay_levels[SERVO_MOTION_MAX_SERVOS];
+static uint8_t replay_slices[SERVO_MOTION_MAX_SERVOS];
+static uint8_t replay_channels[SERVO_MOTION_MAX_SERVOS];
+
+static const arm_teach_header* teach_slot_header(uint slot) {
+    return (const arm_teach_header*)(XIP_BASE + ARM_TEACH_FLASH_OFFSET + slot * ARM_TEACH_SLOT_SIZE);
+}
+
+static bool teach_slot_used(uint slot) {
+    const arm_teach_header* header = teach_slot_header(slot);
+    return header->magic == ARM_TEACH_MAGIC && header->version == ARM_TEACH_VERSION;
+}
+
+// Runs with interrupts off and the other core parked, see flash_safe_execute()
+static void teach_flash_apply(void* param) {
+    teach_flash_op* op = (teach_flash_op*)param;
+    if(op->data)
+        flash_range_program(op->offset, op->data, op->length);
+    else
+        flash_range_erase(op->offset, op->length);
+}
+
+static bool teach_flash(uint32_t offset, const uint8_t* data, uint32_t length) {
+    if(offset < ARM_TEACH_IMAGE_END) {
+        fprintf(stderr, "Recording slots overlap the program image, lower ARM_TEACH_SLOTS or ARM_TEACH_SLOT_SECTORS.\n");
+        return false;
+    }
+    teach_flash_op op = {.offset = offset, .data = data, .length = length};
+    if(flash_safe_execute(teach_flash_apply, &op, ARM_TEACH_FLASH_TIMEOUT_MS) != PICO_OK) {
+        fprintf(stderr, "Flash write at 0x%lx failed.\n", (unsigned long)offset);
+        return false;
+    }
+    return true;
+}
+
+// Level a PWM output currently holds
+static uint16_t teach_read_level(const servo* motor) {
+    uint32_t compare = pwm_hw->slice[motor->slice].cc;
+    return (uint16_t)(motor->channel ? compare >> PWM_CH0_CC_B_LSB : compare >> PWM_CH0_CC_A_LSB);
+}
+
+static uint teach_varint(uint8_t* out, uint32_t value) {
+    uint length = 0;
+    while(value >= 0x80) {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+// Append a frame to the page buffers, false without writing anything once the slot or the buffers are full
+static bool teach_put(const uint8_t* data, uint length) {
+    if(teach_length + length > TEACH_SLOT_CAPACITY)
+        return false;
+    // A frame is shorter than a page, it fits if the buffer it may spill into is free
+    uint room = teach_page_ready[teach_page] ? 0 : FLASH_PAGE_SIZE - teach_page_used;
+    if(room > 0 && !teach_page_ready[(teach_page + 1) % ARM_TEACH_PAGE_BUFFERS])
+        room += FLASH_PAGE_SIZE;
+    if(length > room)
+        return false;
+    for(uint i = 0; i < length; i++) {
+        teach_pages[teach_page][teach_page_used++] = data[i];
+        if(teach_page_used == FLASH_PAGE_SIZE) {
+            // Publish the page to the writer before moving on to the next buffer
+            __mem_fence_release();
+            teach_page_ready[teach_page] = true;
+            teach_page = (teach_page + 1) % ARM_TEACH_PAGE_BUFFERS;
+            teach_page_used = 0;
+        }
+    }
+    teach_length += length;
+    return true;
+}
+
+// Close the run of unchanged ticks with a repeat frame
+static bool teach_put_still(void) {
+    if(teach_still == 0)
+        return true;
+    uint8_t frame[1 + 5];
+    frame[0] = 0;
+    uint length = 1 + teach_varint(&frame[1], teach_still - 1);
+    if(!teach_put(frame, length))
+        return false;
+    teach_still = 0;
+    return true;
+}
+
+static uint32_t replay_varint(void) {
+    uint32_t value = 0;
+    for(uint shift = 0; replay_read < replay_end && shift < 32; shift += 7) {
+        uint8_t byte = *replay_read++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80))
+            break;
+    }
+    return value;
+}
+
+// Decode the levels of the next tick into replay_to, false after the last frame
+static bool replay_next(uint8_t number) {
+    if(replay_repeat > 0) {
+        replay_repeat--;
+        return true;
+    }
+    if(replay_read >= replay_end)
+        return false;
+    uint8_t mask = *replay_read++;
+    if(mask == 0) {
+        replay_repeat = replay_varint();
+        return true;
+    }
+    for(uint8_t i = 0; i < number; i++) {
+        if(!(mask & (1u << i)))
+            continue;
+        uint32_t zigzag = replay_varint();
+        replay_to[i] += (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+    }
+    return true;
+}
+
+/**
+ * Start recording the servo levels of a robotic arm at every motion tick.
+ * Erases the slot of a recording with the same name, or a free slot. Move the arm with the
+ * usual commands meanwhile and call arm_teach_poll() often to write the frames to flash.
+ * 
+ * @robot: Robotic arm to record, must be started
+ * @name: Name of the recording, at most ARM_TEACH_NAME_SIZE - 1 characters
+ * 
+ * Return false if already recording or replaying, or no slot is free.
+ */
+bool arm_teach_record(robotic_arm* robot, const char* name) {
+    if(teach_robot || replay_robot) {
+        fprintf(stderr, "A recording or replay is in progress.\n");
+        return false;
+    }
+    if(strlen(name) == 0 || strlen(name) >= ARM_TEACH_NAME_SIZE) {
+        fprintf(stderr, "Recording names have 1 to %d characters.\n", ARM_TEACH_NAME_SIZE - 1);
+        return false;
+    }
+    // One mask bit per servo in a frame
+    if(robot->number > 8) {
+        fprintf(stderr, "Too many servos to record.\n");
+        return false;
+    }
+    // Re-record over the same name, otherwise take the first free slot
+    const arm_teach_header* existing = arm_teach_find(name);
+    uint slot = ARM_TEACH_SLOTS;
+    for(uint s = 0; s < ARM_TEACH_SLOTS && slot == ARM_TEACH_SLOTS; s++) {
+        if(existing ? teach_slot_header(s) == existing : !teach_slot_used(s))
+            slot = s;
+    }
+    if(slot == ARM_TEACH_SLOTS) {
+        fprintf(stderr, "No free recording slot, delete a recording first.\n");
+        return false;
+    }
+    if(!teach_flash(ARM_TEACH_FLASH_OFFSET + slot * ARM_TEACH_SLOT_SIZE, NULL, ARM_TEACH_SLOT_SIZE))
+        return false;
+    if(!teach_lock_ready) {
+        critical_section_init(&teach_lock);
+        teach_lock_ready = true;
+    }
+    memset(&teach_header, 0xFF, sizeof(teach_header));
+    teach_header.magic = ARM_TEACH_MAGIC;
+    teach_header.version = ARM_TEACH_VERSION;
+    teach_header.number = robot->number;
+    teach_header.period = robot->period;
+    teach_header.steps = 0;
+    memset(teach_header.name, 0, sizeof(teach_header.name));
+    strcpy(teach_header.name, name);
+    teach_robot = robot;
+    teach_slot = slot;
+    teach_first = true;
+    teach_still = 0;
+    teach_length = 0;
+    teach_written = 0;
+    teach_full = false;
+    for(uint p = 0; p < ARM_TEACH_PAGE_BUFFERS; p++)
+        teach_page_ready[p] = false;
+    teach_page = 0;
+    teach_page_used = 0;
+    __mem_fence_release();
+    teach_recording = true;
+    return true;
+}
+
+/**
+ * Record the servo levels of the current motion tick, called by robotic_arm_tick().
+ * 
+ * @robot: Robotic arm being ticked
+ */
+void arm_teach_sample(robotic_arm* robot) {
+    if(!teach_recording || robot != teach_robot)
+        return;
+    critical_section_enter_blocking(&teach_lock);
+    if(!teach_recording) {
+        critical_section_exit(&teach_lock);
+        return;
+    }
+    uint8_t number = teach_header.number;
+    if(teach_first) {
+        for(uint8_t i = 0; i < number; i++) {
+            teach_levels[i] = teach_read_level(&robot->servos[i]);
+            teach_header.start_levels[i] = teach_levels[i];
+        }
+        teach_first = false;
+        critical_section_exit(&teach_lock);
+        return;
+    }
+    uint8_t frame[TEACH_FRAME_MAX];
+    uint length = 1;
+    frame[0] = 0;
+    for(uint8_t i = 0; i < number; i++) {
+        uint16_t level = teach_read_level(&robot->servos[i]);
+        int32_t delta = (int32_t)level - teach_levels[i];
+        if(delta == 0)
+            continue;
+        frame[0] |= 1u << i;
+        // Zigzag keeps small moves either way in one byte
+        length += teach_varint(&frame[length], ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+        teach_levels[i] = level;
+    }
+    teach_header.steps++;
+    if(frame[0] == 0)
+        teach_still++;
+    else if(!teach_put_still() || !teach_put(frame, length)) {
+        // Slot full or flash writes falling behind, keep what was recorded
+        teach_header.steps -= teach_still + 1;
+        teach_still = 0;
+        teach_full = true;
+        teach_recording = false;
+    }
+    critical_section_exit(&teach_lock);
+}
+
+/**
+ * Write recorded frames to flash, call from the core that started the recording.
+ * Stops and saves the recording by itself once its slot is full.
+ */
+void arm_teach_poll(void) {
+    if(teach_robot == NULL)
+        return;
+    uint32_t slot_offset = ARM_TEACH_FLASH_OFFSET + teach_slot * ARM_TEACH_SLOT_SIZE;
+    // Pages fill the buffers in order, so the next page to write is always in the same buffer
+    uint page = (teach_written / FLASH_PAGE_SIZE) % ARM_TEACH_PAGE_BUFFERS;
+    while(teach_page_ready[page]) {
+        __mem_fence_acquire();
+        if(!teach_flash(slot_offset + FLASH_PAGE_SIZE + teach_written, teach_pages[page], FLASH_PAGE_SIZE))
+            break;
+        teach_written += FLASH_PAGE_SIZE;
+        teach_page_ready[page] = false;
+        page = (page + 1) % ARM_TEACH_PAGE_BUFFERS;
+    }
+    if(teach_full) {
+        printf("Recording %s is full.\n", teach_header.name);
+        arm_teach_stop();
+    }
+}
+
+/**
+ * Stop recording and save the recording.
+ * 
+ * Return false if nothing was recording or writing to flash failed.
+ */
+bool arm_teach_stop(void) {
+    if(teach_robot == NULL)
+        return false;
+    critical_section_enter_blocking(&teach_lock);
+    teach_recording = false;
+    critical_section_exit(&teach_lock);
+    // The sampler is done, close the last run and pad the last page with erased bytes
+    if(!teach_put_still()) {
+        teach_header.steps -= teach_still;
+        teach_still = 0;
+    }
+    if(teach_page_used > 0) {
+        memset(&teach_pages[teach_page][teach_page_used], 0xFF, FLASH_PAGE_SIZE - teach_page_used);
+        teach_page_ready[teach_page] = true;
+        teach_page_used = 0;
+    }
+    teach_full = false;
+    arm_teach_poll();
+    bool saved = teach_written >= teach_length;
+    if(saved) {
+        static uint8_t page[FLASH_PAGE_SIZE];
+        teach_header.length = teach_length;
+        memset(page, 0xFF, sizeof(page));
+        memcpy(page, &teach_header, sizeof(teach_header));
+        saved = teach_flash(ARM_TEACH_FLASH_OFFSET + teach_slot * ARM_TEACH_SLOT_SIZE, page, FLASH_PAGE_SIZE);
+    }
+    if(saved)
+        printf("Recording %s saved, %lu steps in %lu bytes.\n", teach_header.name,
+               (unsigned long)teach_header.steps, (unsigned long)teach_header.length);
+    teach_robot = NULL;
+    return saved;
+}
+
+/**
+ * Check whether a recording is in progress.
+ */
+bool arm_teach_is_recording(void) {
+    return teach_robot != NULL;
+}
+
+/**
+ * Find a saved recording.
+ * 
+ * @name: Name of the recording
+ * 
+ * Return the header of the recording in flash, NULL if there is none.
+ */
+const arm_teach_header* arm_teach_find(const char* name) {
+    for(uint s = 0; s < ARM_TEACH_SLOTS; s++) {
+        const arm_teach_header* header = teach_slot_header(s);
+        if(teach_slot_used(s) && strncmp(header->name, name, ARM_TEACH_NAME_SIZE) == 0)
+            return header;
+    }
+    return NULL;
+}
+
+/**
+ * Queue a saved recording to be replayed. The arm first moves to the start of the recording
+ * like any segment, then plays the frames straight from flash.
+ * 
+ * @robot: Robotic arm to replay on, the one the recording was made with
+ * @name: Name of the recording
+ * @speed: Speed relative to the recording, from 0 to ARM_TEACH_MAX_SPEED, 1 for the original speed
+ * @hold_ms: Time to stay still after the last frame
+ * 
+ * Return false if the recording is missing or does not fit the arm, the speed is out of range,
+ * another replay is queued, a recording is in progress or the queue is full.
+ */
+bool arm_teach_play(robotic_arm* robot, const char* name, float speed, uint16_t hold_ms) {
+    const arm_teach_header* header = arm_teach_find(name);
+    if(!header) {
+        fprintf(stderr, "No recording named %s.\n", name);
+        return false;
+    }
+    if(header->number != robot->number) {
+        fprintf(stderr, "Recording %s has %u servos, the arm has %u.\n", name, header->number, robot->number);
+        return false;
+    }
+    if(!(speed > 0 && speed <= ARM_TEACH_MAX_SPEED)) {
+        fprintf(stderr, "Replay speed must be above 0 and at most %.1f.\n", ARM_TEACH_MAX_SPEED);
+        return false;
+    }
+    if(teach_robot || replay_robot) {
+        fprintf(stderr, "A recording or replay is in progress.\n");
+        return false;
+    }
+    // Move to where the recording starts like any other segment, the frames follow
+    robotic_arm_segment segment;
+    segment.number = robot->number;
+    segment.hold_ms = hold_ms;
+    segment.flags = ROBOTIC_ARM_SEGMENT_REPLAY;
+    for(uint8_t i = 0; i < robot->number; i++) {
+        servo* motor = &robot->servos[i];
+        segment.indexes[i] = i;
+        segment.angles[i] = servo_level_to_angle(motor, header->start_levels[i]);
+        replay_from[i] = header->start_levels[i];
+        replay_to[i] = header->start_levels[i];
+        replay_slices[i] = motor->slice;
+        replay_channels[i] = motor->channel;
+    }
+    // Frames are read in place through XIP, nothing is copied to RAM
+    replay_read = (const uint8_t*)header + FLASH_PAGE_SIZE;
+    replay_end = replay_read + header->length;
+    replay_repeat = 0;
+    replay_phase_q8 = 0;
+    replay_started = false;
+    replay_step_q8 = (uint32_t)lroundf(256.0f * speed * robot->period / header->period);
+    if(replay_step_q8 == 0)
+        replay_step_q8 = 1;
+    replay_robot = robot;
+    if(!robotic_arm_queue_segment(robot, &segment)) {
+        replay_robot = NULL;
+        fprintf(stderr, "Motion queue is full.\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Play the next motion tick of the queued replay, called by robotic_arm_tick().
+ * 
+ * @robot: Robotic arm being ticked
+ * 
+ * Return false once the last frame was played, the servos then rest at its levels.
+ */
+bool arm_teach_replay_step(robotic_arm* robot) {
+    if(robot != replay_robot)
+        return false;
+    uint8_t number = robot->number;
+    bool playing = true;
+    replay_started = true;
+    replay_phase_q8 += replay_step_q8;
+    while(replay_phase_q8 >= 256) {
+        replay_phase_q8 -= 256;
+        for(uint8_t i = 0; i < number; i++)
+            replay_from[i] = replay_to[i];
+        if(!replay_next(number)) {
+            playing = false;
+            replay_phase_q8 = 0;
+            break;
+        }
+    }
+    // Slower than recorded, interpolate between the two frames around the replay position
+    for(uint8_t i = 0; i < number; i++)
+        replay_levels[i] = (uint16_t)(replay_from[i] + (((replay_to[i] - replay_from[i]) * (int32_t)replay_phase_q8 + 128) >> 8));
+    servos_commit_levels(number, replay_slices, replay_channels, replay_levels);
+    if(!playing)
+        arm_teach_replay_stop(robot);
+    return playing;
+}
+
+/**
+ * Stop the replay where it is, or drop it if its frames did not start yet.
+ * Called when its segment is cancelled.
+ * 
+ * @robot: Robotic arm being ticked
+ */
+void arm_teach_replay_stop(robotic_arm* robot) {
+    if(robot != replay_robot)
+        return;
+    // Servos rest at the levels played last, later motions start from there
+    for(uint8_t i = 0; replay_started && i < robot->number; i++) {
+        servo* motor = &robot->servos[i];
+        motor->level = replay_levels[i];
+        motor->angle = servo_level_to_angle(motor, replay_levels[i]);
+        motor->velocity = 0;
+    }
+    replay_robot = NULL;
+}
+
+/**
+ * Erase a saved recording.
+ * 
+ * @name: Name of the recording
+ * 
+ * Return false if there is no such recording or erasing failed.
+ */
+bool arm_teach_delete(const char* name) {
+    const arm_teach_header* header = arm_teach_find(name);
+    if(!header) {
+        fprintf(stderr, "No recording named %s.\n", name);
+        return false;
+    }
+    if(teach_robot || replay_robot) {
+        fprintf(stderr, "A recording or replay is in progress.\n");
+        return false;
+    }
+    // The header sector is enough, a slot without magic is free
+    uint32_t offset = (uint32_t)((uintptr_t)header - XIP_BASE);
+    return teach_flash(offset, NULL, FLASH_SECTOR_SIZE);
+}
+
+/**
+ * Print name, length and size of every saved recording.
+ */
+void arm_teach_list(void) {
+    uint count = 0;
+    for(uint s = 0; s < ARM_TEACH_SLOTS; s++) {
+        if(!teach_slot_used(s))
+            continue;
+        const arm_teach_header* header = teach_slot_header(s);
+        printf("Recording %-15s %8.2f s %6lu bytes\n", header->name,
+               header->steps * (header->period / 1e6f), (unsigned long)header->length);
+        count++;
+    }
+    printf("%u of %d recording slots used.\n", count, ARM_TEACH_SLOTS);
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/critical_section.h"
+#include "arm_trace.h"
+
+
+#if ARM_TRACE_ENABLED
+
+// Longest record: header, 5 byte time delta, 5 byte segment id and 3 byte level
+#define ARM_TRACE_RECORD_MAX 14
+
+/**
+ * @start_us: Time the first record of the block is relative to
+ * @segment: Segment id when the block started
+ * @used: Bytes of records in data
+ * @absolute: Outputs with a level recorded in this block, later levels are deltas
+ * @data: Records
+ */
+typedef struct arm_trace_block {
+    uint32_t start_us;
+    uint32_t segment;
+    uint16_t used;
+    uint16_t absolute;
+    uint8_t data[ARM_TRACE_BLOCK_SIZE];
+} arm_trace_block;
+
+static arm_trace_block trace_blocks[ARM_TRACE_BLOCKS];
+static uint trace_oldest = 0;
+static uint trace_count = 0;
+static uint32_t trace_last_us = 0;
+static uint32_t trace_segment = 0;
+static uint32_t trace_block_segment = 0;
+static uint16_t trace_levels[ARM_TRACE_OUTPUT_MASK + 1];
+static volatile bool trace_running = false;
+static critical_section_t trace_lock;
+static bool trace_lock_ready = false;
+
+static uint trace_varint(uint8_t* out, uint32_t value) {
+    uint length = 0;
+    while(value >= 0x80) {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+// Open a new block after the newest one, dropping the oldest block if the ring is full
+static arm_trace_block* trace_new_block(uint32_t now) {
+    if(trace_count == ARM_TRACE_BLOCKS) {
+        trace_oldest = (trace_oldest + 1) % ARM_TRACE_BLOCKS;
+        trace_count--;
+    }
+    arm_trace_block* block = &trace_blocks[(trace_oldest + trace_count) % ARM_TRACE_BLOCKS];
+    trace_count++;
+    block->start_us = now;
+    block->segment = trace_segment;
+    block->used = 0;
+    block->absolute = 0;
+    trace_last_us = now;
+    trace_block_segment = trace_segment;
+    return block;
+}
+
+// Encode a record against the state of a block
+static uint trace_encode(arm_trace_block* block, uint8_t* record, uint32_t now, uint8_t output, uint16_t level) {
+    uint8_t header = output & ARM_TRACE_OUTPUT_MASK;
+    bool segment_changed = trace_segment != trace_block_segment;
+    bool absolute = !(block->absolute & (1u << (output & ARM_TRACE_OUTPUT_MASK)));
+    if(segment_changed)
+        header |= ARM_TRACE_SEGMENT;
+    if(absolute)
+        header |= ARM_TRACE_ABSOLUTE;
+    uint length = 0;
+    record[length++] = header;
+    length += trace_varint(&record[length], now - trace_last_us);
+    if(segment_changed)
+        length += trace_varint(&record[length], trace_segment);
+    if(absolute) {
+        length += trace_varint(&record[length], level);
+    }
+    else {
+        // Zigzag keeps small negative deltas in one byte
+        int32_t delta = (int32_t)level - trace_levels[output & ARM_TRACE_OUTPUT_MASK];
+        length += trace_varint(&record[length], ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+    }
+    return length;
+}
+
+/**
+ * Record a PWM level written to an output, timestamped with time_us_32().
+ * Does nothing unless the trace was started with arm_trace_start().
+ * 
+ * @output: PWM output, slice * 2 + channel
+ * @level: Level written
+ */
+void arm_trace_record(uint8_t output, uint16_t level) {
+    if(!trace_running)
+        return;
+    critical_section_enter_blocking(&trace_lock);
+    uint32_t now = time_us_32();
+    uint8_t record[ARM_TRACE_RECORD_MAX];
+    arm_trace_block* block = trace_count ? &trace_blocks[(trace_oldest + trace_count - 1) % ARM_TRACE_BLOCKS] : NULL;
+    uint length = block ? trace_encode(block, record, now, output, level) : 0;
+    if(!block || block->used + length > ARM_TRACE_BLOCK_SIZE) {
+        block = trace_new_block(now);
+        length = trace_encode(block, record, now, output, level);
+    }
+    for(uint i = 0; i < length; i++)
+        block->data[block->used + i] = record[i];
+    block->used += length;
+    block->absolute |= 1u << (output & ARM_TRACE_OUTPUT_MASK);
+    trace_levels[output & ARM_TRACE_OUTPUT_MASK] = level;
+    trace_last_us = now;
+    trace_block_segment = trace_segment;
+    critical_section_exit(&trace_lock);
+}
+
+/**
+ * Set the segment id stored with the following records.
+ * 
+ * @segment: Segment id, e.g. robotic_arm segments_started
+ */
+void arm_trace_set_segment(uint32_t segment) {
+    trace_segment = segment;
+}
+
+#endif
+
+/**
+ * Clear the trace and start recording.
+ */
+void arm_trace_start(void) {
+#if ARM_TRACE_ENABLED
+    if(!trace_lock_ready) {
+        critical_section_init(&trace_lock);
+        trace_lock_ready = true;
+    }
+    critical_section_enter_blocking(&trace_lock);
+    trace_oldest = 0;
+    trace_count = 0;
+    trace_running = true;
+    critical_section_exit(&trace_lock);
+#endif
+}
+
+/**
+ * Stop recording, the trace is kept for arm_trace_dump().
+ */
+void arm_trace_stop(void) {
+#if ARM_TRACE_ENABLED
+    trace_running = false;
+#endif
+}
+
+/**
+ * Write the trace as a binary blob, oldest block first. Recording pauses while dumping.
+ * Blob: ARM_TRACE_MAGIC, version (u8), block size (u16), number of blocks (u16),
+ * then per block: start time us (u32), segment id (u32), used bytes (u16) and the records.
+ * Record: header (u8), time delta to the previous record us (varint),
+ * [segment id (varint)], level or level delta (varint). Numbers are little endian.
+ * 
+ * @write: Writer for the blob, called several times
+ * 
+ * Return false if the trace recorder is not compiled in.
+ */
+bool arm_trace_dump(arm_trace_writer write) {
+#if ARM_TRACE_ENABLED
+    bool running = trace_running;
+    // Wait for a record in progress on the other core, then keep the blocks still while writing
+    if(trace_lock_ready) {
+        critical_section_enter_blocking(&trace_lock);
+        trace_running = false;
+        critical_section_exit(&trace_lock);
+    }
+    uint8_t header[9] = {
+        ARM_TRACE_MAGIC[0], ARM_TRACE_MAGIC[1], ARM_TRACE_MAGIC[2], ARM_TRACE_MAGIC[3], ARM_TRACE_VERSION,
+        ARM_TRACE_BLOCK_SIZE & 0xFF, ARM_TRACE_BLOCK_SIZE >> 8, trace_count & 0xFF, trace_count >> 8
+    };
+    write(header, sizeof(header));
+    for(uint i = 0; i < trace_count; i++) {
+        arm_trace_block* block = &trace_blocks[(trace_oldest + i) % ARM_TRACE_BLOCKS];
+        uint8_t block_header[10];
+        for(uint b = 0; b < 4; b++) {
+            block_header[b] = (uint8_t)(block->start_us >> (8 * b));
+            block_header[4 + b] = (uint8_t)(block->segment >> (8 * b));
+        }
+        block_header[8] = block->used & 0xFF;
+        block_header[9] = block->used >> 8;
+        write(block_header, sizeof(block_header));
+        write(block->data, block->used);
+    }
+    trace_running = running;
+    return true;
+#else
+    (void)write;
+    return false;
+#endif
+}
@@ -0,0 +1,79 @@
+#ifndef ARM_BOOT_H
+#define ARM_BOOT_H
+
+#include "pico/stdlib.h"
+#include "robotic_arm.h"
+
+// 1 to hold the boot until a USB host opens the serial port, 0 to start the arm headless
+#ifndef ARM_BOOT_WAIT_FOR_HOST
+#define ARM_BOOT_WAIT_FOR_HOST 0
+#endif
+
+// Watchdog timeout once the arm is ready, at most 8388, 0 to leave the watchdog off (ms)
+#ifndef ARM_BOOT_WATCHDOG_MS
+#define ARM_BOOT_WATCHDOG_MS 5000
+#endif
+
+// Servos whose pose the watchdog scratch registers hold across a reset, two levels per register
+#define ARM_BOOT_POSE_SERVOS 6
+
+// Scratch register 0 of a saved pose ("ARM" and the number of servos)
+#define ARM_BOOT_POSE_MAGIC 0x41524D00u
+
+/**
+ * @watchdog_reset: The last reset was caused by the watchdog
+ * @pose_restored: Soft start began from the pose saved before the reset instead of the park pose
+ * @start_us: Time the servo soft start took (us)
+ * @ready_us: Time from reset until the arm took commands (us)
+ */
+typedef struct arm_boot_report {
+    bool watchdog_reset;
+    bool pose_restored;
+    uint32_t start_us;
+    uint32_t ready_us;
+} arm_boot_report;
+
+/**
+ * Record why the board was reset, call first thing in main().
+ */
+void arm_boot_begin(void);
+
+/**
+ * After a watchdog reset, make the soft start begin from the levels the servos held before it
+ * instead of the park pose, so a recovering arm does not jump. Call between robotic_arm_init()
+ * and robotic_arm_start().
+ * 
+ * @robot: Robotic arm about to start
+ * 
+ * Return true if a saved pose was found.
+ */
+bool arm_boot_restore_pose(robotic_arm* robot);
+
+/**
+ * Save the current PWM levels of the servos in the watchdog scratch registers,
+ * called by robotic_arm_tick().
+ * 
+ * @robot: Robotic arm being ticked
+ */
+void arm_boot_save_pose(robotic_arm* robot);
+
+/**
+ * Mark the arm ready to take commands and enable the watchdog.
+ * Feed it with watchdog_update() from the main loop afterwards.
+ * 
+ * @robot: Robotic arm that was started
+ */
+void arm_boot_ready(robotic_arm* robot);
+
+/**
+ * Get the boot report, filled in by arm_boot_ready().
+ */
+const arm_boot_report* arm_boot_get_report(void);
+
+/**
+ * Print boot reason and times.
+ */
+void arm_boot_print(void);
+
+
+#endif  // ARM_BOOT_H
@@ -0,0 +1,148 @@
+#ifndef ARM_KINEMATICS_H
+#define ARM_KINEMATICS_H
+
+#include "robotic_arm.h"
+
+// Positioning joints solved by the kinematics: base yaw, shoulder and elbow, servos 0 to 2
+#define ARM_KINEMATICS_JOINTS 3
+
+// Inverse kinematics solutions per target: base facing or turned away, elbow up or down
+#define ARM_KINEMATICS_BRANCHES 4
+
+// Maximum number of poses in a pose cache
+#ifndef ARM_POSE_CACHE_SIZE
+#define ARM_POSE_CACHE_SIZE 8
+#endif
+
+// Default link lengths of the arm (mm)
+#ifndef ARM_KINEMATICS_BASE_HEIGHT
+#define ARM_KINEMATICS_BASE_HEIGHT 70.0f
+#endif
+#ifndef ARM_KINEMATICS_UPPER_ARM
+#define ARM_KINEMATICS_UPPER_ARM 105.0f
+#endif
+#ifndef ARM_KINEMATICS_FOREARM
+#define ARM_KINEMATICS_FOREARM 100.0f
+#endif
+
+/**
+ * Point in the base frame: x forward when the base servo is at 90 degrees,
+ * y to the left, z up from the table (mm)
+ */
+typedef struct arm_point {
+    float x;
+    float y;
+    float z;
+} arm_point;
+
+/**
+ * Joint angles are base yaw from x, shoulder elevation from the table, and elbow bend
+ * from the upper arm direction, positive upwards. Servo angle = offset + direction * joint angle.
+ * 
+ * @base_height: Height of the shoulder axis above the table (mm)
+ * @upper_arm: Shoulder axis to elbow axis (mm)
+ * @forearm: Elbow axis to the gripper tip (mm)
+ * @servo_offsets: Servo angles at joint angle 0 (degrees)
+ * @servo_directions: 1 if the servo angle grows with the joint angle, -1 otherwise
+ */
+typedef struct arm_kinematics {
+    float base_height;
+    float upper_arm;
+    float forearm;
+    float servo_offsets[ARM_KINEMATICS_JOINTS];
+    float servo_directions[ARM_KINEMATICS_JOINTS];
+} arm_kinematics;
+
+/**
+ * Kinematics of the default arm, servos at 90/90/90 hold the upper arm up and the forearm level forward.
+ */
+#define ARM_KINEMATICS_DEFAULT                          \
+{                                                       \
+    .base_height = ARM_KINEMATICS_BASE_HEIGHT,          \
+    .upper_arm = ARM_KINEMATICS_UPPER_ARM,              \
+    .forearm = ARM_KINEMATICS_FOREARM,                  \
+    .servo_offsets = {90.0f, 0.0f, 0.0f},               \
+    .servo_directions = {1.0f, 1.0f, -1.0f}             \
+}
+
+/**
+ * @count: Number of solutions within the servo limits
+ * @angles: Servo angles of each solution, front elbow-up branch first when it is valid
+ */
+typedef struct arm_ik_solution {
+    uint8_t count;
+    float angles[ARM_KINEMATICS_BRANCHES][ARM_KINEMATICS_JOINTS];
+} arm_ik_solution;
+
+/**
+ * @number: Number of cached poses
+ * @poses: Inverse kinematics solutions of each pose, indexed by pose
+ */
+typedef struct arm_pose_cache {
+    uint8_t number;
+    arm_ik_solution poses[ARM_POSE_CACHE_SIZE];
+} arm_pose_cache;
+
+/**
+ * Calculate where the gripper tip is for servo angles.
+ * 
+ * @kinematics: Arm geometry
+ * @angles: Servo angles of the positioning joints (degrees)
+ * @point: Output gripper tip position
+ */
+void arm_kinematics_forward(const arm_kinematics* kinematics, const float* angles, arm_point* point);
+
+/**
+ * Calculate every set of servo angles that puts the gripper tip at a point.
+ * 
+ * @kinematics: Arm geometry
+ * @motors: Servos of the positioning joints to respect the angle limits of, NULL for no limits
+ * @target: Point to reach
+ * @solution: Output solutions
+ * 
+ * Return the number of solutions, 0 if the point is out of reach.
+ */
+uint8_t arm_kinematics_inverse(const arm_kinematics* kinematics, const servo* motors, const arm_point* target, arm_ik_solution* solution);
+
+/**
+ * Choose one solution of an inverse kinematics result.
+ * 
+ * @solution: Solutions to choose from, count must be at least 1
+ * @current: Current servo angles to choose the solution with the least total joint travel from,
+ *           NULL for the first (preferred) solution
+ */
+const float* arm_kinematics_select(const arm_ik_solution* solution, const float* current);
+
+/**
+ * Solve fixed poses once so they can be looked up in constant time while sorting.
+ * 
+ * @cache: Cache to fill
+ * @kinematics: Arm geometry
+ * @motors: Servos of the positioning joints, NULL for no limits
+ * @points: Positions of the poses
+ * @number: Number of poses, at most ARM_POSE_CACHE_SIZE
+ * 
+ * Return false if a pose is out of reach, its cache entry then has no solution.
+ */
+bool arm_pose_cache_build(arm_pose_cache* cache, const arm_kinematics* kinematics, const servo* motors, const arm_point* points, uint8_t number);
+
+/**
+ * Look up the solutions of a cached pose.
+ * 
+ * @cache: Cache built by arm_pose_cache_build()
+ * @pose: Index of the pose in the points given to arm_pose_cache_build()
+ * 
+ * Return NULL if the pose is unknown or out of reach.
+ */
+const arm_ik_solution* arm_pose_cache_get(const arm_pose_cache* cache, uint8_t pose);
+
+/**
+ * Fill a segment moving the positioning joints to servo angles of a solution.
+ * 
+ * @segment: Segment to fill, holds and flags are cleared
+ * @angles: Servo angles of the positioning joints, e.g. from arm_kinematics_select()
+ */
+void arm_kinematics_segment(robotic_arm_segment* segment, const float* angles);
+
+
+#endif  // ARM_KINEMATICS_H
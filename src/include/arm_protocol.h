@@ -0,0 +1,148 @@
+#ifndef ARM_PROTOCOL_H
+#define ARM_PROTOCOL_H
+
+/*
+ * Frame layout, multi-byte fields are little endian:
+ *   SOF | length | seq | address | type | payload[length] | crc16
+ * address selects the arm on boards driving several, replies carry the address of their arm.
+ * crc16 is CRC-16/CCITT-FALSE over length, seq, address, type and payload.
+ */
+
+// Start of frame byte, never used by the ASCII commands
+#define ARM_PROTOCOL_SOF 0xA5
+
+// Maximum payload length of a frame
+#define ARM_PROTOCOL_MAX_PAYLOAD 32
+
+// Address of replies that belong to no arm, sent with seq 0: ERROR for a frame whose CRC failed,
+// its address and seq cannot be trusted
+#define ARM_PROTOCOL_ADDRESS_NONE 0xFF
+
+// Frame is dropped when the next byte takes longer than this (us)
+#define ARM_PROTOCOL_BYTE_TIMEOUT_US 100000
+
+// Host to arm: payload is one bin command byte per sort job
+#define ARM_PROTOCOL_JOB 0x01
+// Host to arm: empty payload, answered by ACK with no job accepted
+#define ARM_PROTOCOL_PING 0x02
+// Host to arm: payload is the provisional bin command byte of one job, the arm picks the item
+// and moves over the bin but keeps holding it until CONFIRM, answered like JOB
+#define ARM_PROTOCOL_SPEC 0x03
+// Host to arm: payload is the final bin command byte of the speculative job, answered by ACK,
+// DONE later carries the seq of the SPEC frame
+#define ARM_PROTOCOL_CONFIRM 0x04
+// Host to arm: empty payload, drops the speculative job and puts a picked item back, answered by ACK
+#define ARM_PROTOCOL_CANCEL 0x05
+
+// Arm to host: every job accepted, payload is accepted (u8), free job slots (u8), time ms (u32)
+#define ARM_PROTOCOL_ACK 0x81
+// Arm to host: queue full, only the first accepted jobs will run, payload as ACK
+#define ARM_PROTOCOL_BUSY 0x82
+// Arm to host: a job finished, seq of its JOB frame, payload is job index (u8), time ms (u32)
+#define ARM_PROTOCOL_DONE 0x83
+// Arm to host: frame rejected, payload is error code (u8), position (u8)
+#define ARM_PROTOCOL_ERROR 0x84
+
+// Error codes of ARM_PROTOCOL_ERROR frames
+#define ARM_PROTOCOL_ERROR_CRC 0x01
+#define ARM_PROTOCOL_ERROR_TYPE 0x02
+#define ARM_PROTOCOL_ERROR_COMMAND 0x03
+#define ARM_PROTOCOL_ERROR_STATE 0x04     // CONFIRM or CANCEL without a speculative job
+#define ARM_PROTOCOL_ERROR_ADDRESS 0x05   // No arm at the address, position is the address
+
+/**
+ * Result of feeding a byte to the parser.
+ * 
+ * @ARM_PROTOCOL_IDLE: Byte is not part of a frame
+ * @ARM_PROTOCOL_PENDING: Byte consumed, frame not complete yet or dropped with an aborted frame
+ * @ARM_PROTOCOL_FRAME: Byte completed a valid frame
+ * @ARM_PROTOCOL_BAD_CRC: Byte completed a frame with wrong CRC, frame dropped
+ */
+typedef enum arm_protocol_result {
+    ARM_PROTOCOL_IDLE,
+    ARM_PROTOCOL_PENDING,
+    ARM_PROTOCOL_FRAME,
+    ARM_PROTOCOL_BAD_CRC
+} arm_protocol_result;
+
+/**
+ * @seq: Sequence number chosen by the sender (uint8_t)
+ * @address: Arm the frame is for or from (uint8_t)
+ * @type: Frame type (uint8_t)
+ * @length: Payload length (uint8_t)
+ * @payload: Payload bytes (uint8_t[])
+ */
+typedef struct arm_protocol_frame {
+    uint8_t seq;
+    uint8_t address;
+    uint8_t type;
+    uint8_t length;
+    uint8_t payload[ARM_PROTOCOL_MAX_PAYLOAD];
+} arm_protocol_frame;
+
+/**
+ * @state: Field expected next (uint8_t)
+ * @received: Payload or CRC bytes received so far (uint8_t)
+ * @crc: CRC received from the frame (uint16_t)
+ * @last_byte_us: Time of the last byte (uint32_t)
+ * @frame: Frame being received (arm_protocol_frame)
+ */
+typedef struct arm_protocol_parser {
+    uint8_t state;
+    uint8_t received;
+    uint16_t crc;
+    uint32_t last_byte_us;
+    arm_protocol_frame frame;
+} arm_protocol_parser;
+
+/**
+ * Reset a parser to wait for the next start of frame.
+ * 
+ * @parser: Parser to reset
+ */
+void arm_protocol_reset(arm_protocol_parser* parser);
+
+/**
+ * Feed a received byte to a parser.
+ * The frame is valid in parser->frame when ARM_PROTOCOL_FRAME is returned.
+ * After a bad length, a bad CRC or a pause inside a frame, the following bytes are dropped
+ * until the next SOF, a newline or another pause, so a corrupt frame never runs ASCII commands.
+ * 
+ * @parser: Parser to feed
+ * @byte: Received byte
+ */
+arm_protocol_result arm_protocol_feed(arm_protocol_parser* parser, uint8_t byte);
+
+/**
+ * Calculate CRC-16/CCITT-FALSE.
+ * 
+ * @crc: CRC of the previous bytes, 0xFFFF to start
+ * @data: Bytes to add
+ * @length: Number of bytes to add
+ */
+uint16_t arm_protocol_crc16(uint16_t crc, const uint8_t* data, uint length);
+
+/**
+ * Send a frame over stdio without newline translation.
+ * 
+ * @address: Address of the arm sending the frame
+ * @seq: Sequence number of the frame
+ * @type: Frame type
+ * @payload: Payload bytes
+ * @length: Payload length, at most ARM_PROTOCOL_MAX_PAYLOAD
+ */
+void arm_protocol_send(uint8_t address, uint8_t seq, uint8_t type, const uint8_t* payload, uint8_t length);
+
+/**
+ * Send a status frame with a timestamp appended to its payload.
+ * 
+ * @address: Address of the arm sending the frame
+ * @seq: Sequence number of the frame
+ * @type: ARM_PROTOCOL_ACK, ARM_PROTOCOL_BUSY or ARM_PROTOCOL_DONE
+ * @first: First payload byte
+ * @second: Second payload byte, skipped for ARM_PROTOCOL_DONE
+ */
+void arm_protocol_send_status(uint8_t address, uint8_t seq, uint8_t type, uint8_t first, uint8_t second);
+
+
+#endif  // ARM_PROTOCOL_H
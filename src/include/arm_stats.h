@@ -0,0 +1,97 @@
+#ifndef ARM_STATS_H
+#define ARM_STATS_H
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+// 1 to record motion and latency statistics, 0 to compile the recording out
+#ifndef ARM_STATS_ENABLED
+#define ARM_STATS_ENABLED 1
+#endif
+
+// Hardware spin lock guarding the histograms, one of the striped locks the SDK leaves for short
+// critical sections
+#ifndef ARM_STATS_SPIN_LOCK
+#define ARM_STATS_SPIN_LOCK PICO_SPINLOCK_ID_STRIPED_FIRST
+#endif
+
+// Bucket 0 counts zeros, bucket i counts values from 2^(i-1) to 2^i - 1
+#define ARM_STATS_BUCKETS 33
+
+// Metrics recorded by the firmware, all in us
+typedef enum arm_stats_metric {
+    ARM_STATS_COMMAND_LATENCY,  // Sort command received to its first segment started
+    ARM_STATS_SEGMENT,          // Segment started to segment finished, hold included
+    ARM_STATS_STEP_JITTER,      // Difference between actual and intended time between two steps
+    ARM_STATS_STEP_LATE,        // Lateness of steps performed half a period or more after their deadline
+    ARM_STATS_CYCLE_A,          // Sort cycle of bin a, first pick segment started to last throw segment finished
+    ARM_STATS_CYCLE_M,          // Sort cycle of bin m
+    ARM_STATS_CYCLE_G,          // Sort cycle of bin g
+    ARM_STATS_CYCLE_P,          // Sort cycle of bin p
+    ARM_STATS_METRICS
+} arm_stats_metric;
+
+/**
+ * @buckets: Number of values in each power of two range
+ * @count: Number of values recorded
+ * @max: Largest value recorded
+ * @sum: Sum of all values recorded
+ */
+typedef struct arm_stats_histogram {
+    uint32_t buckets[ARM_STATS_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+} arm_stats_histogram;
+
+// Histograms of all metrics. Segments, step jitter and late steps are recorded both by direct
+// moves on core 0 and by the motion executor on core 1 or in the timer interrupt, so every
+// update holds ARM_STATS_SPIN_LOCK
+extern arm_stats_histogram arm_stats[ARM_STATS_METRICS];
+
+/**
+ * Record a value of a metric, a few instructions and no division under a hardware spin lock.
+ * Safe to call from both cores and from interrupts.
+ *
+ * @metric: Metric to record
+ * @value: Value to record (us)
+ */
+static inline void arm_stats_record(arm_stats_metric metric, uint32_t value) {
+#if ARM_STATS_ENABLED
+    arm_stats_histogram* histogram = &arm_stats[metric];
+    spin_lock_t* lock = spin_lock_instance(ARM_STATS_SPIN_LOCK);
+    uint32_t interrupts = spin_lock_blocking(lock);
+    histogram->buckets[value ? 32 - __builtin_clz(value) : 0]++;
+    histogram->count++;
+    histogram->sum += value;
+    if(value > histogram->max)
+        histogram->max = value;
+    spin_unlock(lock, interrupts);
+#else
+    (void)metric;
+    (void)value;
+#endif
+}
+
+/**
+ * Record how far the time between two steps was from the intended period.
+ *
+ * @interval: Measured time between the two steps (us)
+ * @period: Intended time between steps (us)
+ */
+static inline void arm_stats_record_jitter(uint32_t interval, uint32_t period) {
+    arm_stats_record(ARM_STATS_STEP_JITTER, interval > period ? interval - period : period - interval);
+}
+
+/**
+ * Clear all histograms.
+ */
+void arm_stats_reset(void);
+
+/**
+ * Print count, mean and max of every metric with its non-empty histogram buckets.
+ */
+void arm_stats_print(void);
+
+
+#endif  // ARM_STATS_H
@@ -0,0 +1,171 @@
+#ifndef ARM_TEACH_H
+#define ARM_TEACH_H
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "robotic_arm.h"
+
+// Recording slots reserved at the end of flash, each slot holds one named recording
+#ifndef ARM_TEACH_SLOTS
+#define ARM_TEACH_SLOTS 4
+#endif
+
+// Flash sectors per slot, the first page of a slot holds its header and the rest the frames
+#ifndef ARM_TEACH_SLOT_SECTORS
+#define ARM_TEACH_SLOT_SECTORS 4
+#endif
+
+#define ARM_TEACH_SLOT_SIZE (ARM_TEACH_SLOT_SECTORS * FLASH_SECTOR_SIZE)
+
+// RAM page buffers between the sampler and the flash writer, enough for a few seconds of motion
+// while the writing core is busy waiting for a move
+#ifndef ARM_TEACH_PAGE_BUFFERS
+#define ARM_TEACH_PAGE_BUFFERS 8
+#endif
+
+// Flash offset of the first slot, keep the program image below it
+#ifndef ARM_TEACH_FLASH_OFFSET
+#define ARM_TEACH_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - ARM_TEACH_SLOTS * ARM_TEACH_SLOT_SIZE)
+#endif
+
+// Flash offset where the program image ends, from the linker script. Flash writes below it are
+// refused, so slots that grew into the image never erase the firmware
+#ifndef ARM_TEACH_IMAGE_END
+extern char __flash_binary_end;
+#define ARM_TEACH_IMAGE_END ((uint32_t)((uintptr_t)&__flash_binary_end - XIP_BASE))
+#endif
+
+// Time core 1 may take to park before a flash write gives up (ms)
+#define ARM_TEACH_FLASH_TIMEOUT_MS 100
+
+// Longest recording name, including the terminating zero
+#define ARM_TEACH_NAME_SIZE 16
+
+// Fastest replay speed, recordings jogged near the servo limits exceed them when played faster
+#define ARM_TEACH_MAX_SPEED 2.0f
+
+// First word of a used slot ("ATCH" little endian) and its format version
+#define ARM_TEACH_MAGIC 0x48435441u
+#define ARM_TEACH_VERSION 1
+
+/**
+ * Header in the first page of a slot, written when the recording stops.
+ * Frames follow from the second page, one frame per motion tick:
+ * a mask byte with bit i set for every servo i whose level changed, then the zigzag varint
+ * level delta of each of those servos; or a zero mask byte and a varint n, the previous levels
+ * repeated for n + 1 ticks.
+ * 
+ * @magic: ARM_TEACH_MAGIC, an erased slot reads 0xFFFFFFFF
+ * @version: ARM_TEACH_VERSION
+ * @number: Number of servos recorded
+ * @period: Motion tick period the recording was sampled at (us)
+ * @steps: Number of frames
+ * @length: Bytes of frames
+ * @name: Name of the recording, zero terminated
+ * @start_levels: PWM levels of the servos before the first frame
+ */
+typedef struct arm_teach_header {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t number;
+    uint16_t reserved;
+    uint32_t period;
+    uint32_t steps;
+    uint32_t length;
+    char name[ARM_TEACH_NAME_SIZE];
+    uint16_t start_levels[SERVO_MOTION_MAX_SERVOS];
+} arm_teach_header;
+
+/**
+ * Start recording the servo levels of a robotic arm at every motion tick.
+ * Erases the slot of a recording with the same name, or a free slot. Move the arm with the
+ * usual commands meanwhile and call arm_teach_poll() often to write the frames to flash.
+ * 
+ * @robot: Robotic arm to record, must be started
+ * @name: Name of the recording, at most ARM_TEACH_NAME_SIZE - 1 characters
+ * 
+ * Return false if already recording or replaying, or no slot is free.
+ */
+bool arm_teach_record(robotic_arm* robot, const char* name);
+
+/**
+ * Record the servo levels of the current motion tick, called by robotic_arm_tick().
+ * 
+ * @robot: Robotic arm being ticked
+ */
+void arm_teach_sample(robotic_arm* robot);
+
+/**
+ * Write recorded frames to flash, call from the core that started the recording.
+ * Stops and saves the recording by itself once its slot is full.
+ */
+void arm_teach_poll(void);
+
+/**
+ * Stop recording and save the recording.
+ * 
+ * Return false if nothing was recording or writing to flash failed.
+ */
+bool arm_teach_stop(void);
+
+/**
+ * Check whether a recording is in progress.
+ */
+bool arm_teach_is_recording(void);
+
+/**
+ * Find a saved recording.
+ * 
+ * @name: Name of the recording
+ * 
+ * Return the header of the recording in flash, NULL if there is none.
+ */
+const arm_teach_header* arm_teach_find(const char* name);
+
+/**
+ * Queue a saved recording to be replayed. The arm first moves to the start of the recording
+ * like any segment, then plays the frames straight from flash.
+ * 
+ * @robot: Robotic arm to replay on, the one the recording was made with
+ * @name: Name of the recording
+ * @speed: Speed relative to the recording, from 0 to ARM_TEACH_MAX_SPEED, 1 for the original speed
+ * @hold_ms: Time to stay still after the last frame
+ * 
+ * Return false if the recording is missing or does not fit the arm, the speed is out of range,
+ * another replay is queued, a recording is in progress or the queue is full.
+ */
+bool arm_teach_play(robotic_arm* robot, const char* name, float speed, uint16_t hold_ms);
+
+/**
+ * Play the next motion tick of the queued replay, called by robotic_arm_tick().
+ * 
+ * @robot: Robotic arm being ticked
+ * 
+ * Return false once the last frame was played, the servos then rest at its levels.
+ */
+bool arm_teach_replay_step(robotic_arm* robot);
+
+/**
+ * Stop the replay where it is, or drop it if its frames did not start yet.
+ * Called when its segment is cancelled.
+ * 
+ * @robot: Robotic arm being ticked
+ */
+void arm_teach_replay_stop(robotic_arm* robot);
+
+/**
+ * Erase a saved recording.
+ * 
+ * @name: Name of the recording
+ * 
+ * Return false if there is no such recording or erasing failed.
+ */
+bool arm_teach_delete(const char* name);
+
+/**
+ * Print name, length and size of every saved recording.
+ */
+void arm_teach_list(void);
+
+
+#endif  // ARM_TEACH_H
@@ -0,0 +1,93 @@
+#ifndef ARM_TRACE_H
+#define ARM_TRACE_H
+
+#include "pico/stdlib.h"
+
+// 1 to compile in the PWM write trace recorder, 0 to compile every trace call out
+#ifndef ARM_TRACE_ENABLED
+#define ARM_TRACE_ENABLED 0
+#endif
+
+// Bytes of records per trace block, each block can be decoded on its own
+#ifndef ARM_TRACE_BLOCK_SIZE
+#define ARM_TRACE_BLOCK_SIZE 256
+#endif
+
+// Number of trace blocks in the ring, the oldest block is dropped when the ring is full
+#ifndef ARM_TRACE_BLOCKS
+#define ARM_TRACE_BLOCKS 16
+#endif
+
+// First bytes of a trace dump, followed by a format version byte
+#define ARM_TRACE_MAGIC "ATRC"
+#define ARM_TRACE_VERSION 1
+
+// Record header bits, the low 4 bits hold the PWM output (slice * 2 + channel)
+#define ARM_TRACE_OUTPUT_MASK 0x0F
+#define ARM_TRACE_SEGMENT 0x10      // Segment id changed, varint segment id follows the time delta
+#define ARM_TRACE_ABSOLUTE 0x20     // Varint level instead of a zigzag varint delta to the last level of the output
+
+/**
+ * Write part of a trace dump.
+ * 
+ * @data: Bytes to write
+ * @length: Number of bytes
+ */
+typedef void (*arm_trace_writer)(const uint8_t* data, uint length);
+
+#if ARM_TRACE_ENABLED
+
+/**
+ * Record a PWM level written to an output, timestamped with time_us_32().
+ * Does nothing unless the trace was started with arm_trace_start().
+ * 
+ * @output: PWM output, slice * 2 + channel
+ * @level: Level written
+ */
+void arm_trace_record(uint8_t output, uint16_t level);
+
+/**
+ * Set the segment id stored with the following records.
+ * 
+ * @segment: Segment id, e.g. robotic_arm segments_started
+ */
+void arm_trace_set_segment(uint32_t segment);
+
+#else
+
+static inline void arm_trace_record(uint8_t output, uint16_t level) {
+    (void)output;
+    (void)level;
+}
+
+static inline void arm_trace_set_segment(uint32_t segment) {
+    (void)segment;
+}
+
+#endif
+
+/**
+ * Clear the trace and start recording.
+ */
+void arm_trace_start(void);
+
+/**
+ * Stop recording, the trace is kept for arm_trace_dump().
+ */
+void arm_trace_stop(void);
+
+/**
+ * Write the trace as a binary blob, oldest block first. Recording pauses while dumping.
+ * Blob: ARM_TRACE_MAGIC, version (u8), block size (u16), number of blocks (u16),
+ * then per block: start time us (u32), segment id (u32), used bytes (u16) and the records.
+ * Record: header (u8), time delta to the previous record us (varint),
+ * [segment id (varint)], level or level delta (varint). Numbers are little endian.
+ * 
+ * @write: Writer for the blob, called several times
+ * 
+ * Return false if the trace recorder is not compiled in.
+ */
+bool arm_trace_dump(arm_trace_writer write);
+
+
+#endif  // ARM_TRACE_H
@@ -2,14 +2,124 @@
 #define ROBOTIC_ARM_H
 
 #include "servo_control.h"
+#include "servo_dma.h"
+
+// Maximum number of segments waiting in the motion queue of a robotic arm
+#ifndef ROBOTIC_ARM_QUEUE_SIZE
+#define ROBOTIC_ARM_QUEUE_SIZE 32
+#endif
+
+// Robotic arms one board can drive at once, ticked one after another by the same scheduler
+#ifndef ROBOTIC_ARM_MAX_ARMS
+#define ROBOTIC_ARM_MAX_ARMS 4
+#endif
+
+// Time between driving one servo and the next at start, 0 to drive all servos at once (ms)
+#ifndef ROBOTIC_ARM_SOFT_START_MS
+#define ROBOTIC_ARM_SOFT_START_MS 300
+#endif
+
+// Segment flag: blend into the next queued segment instead of stopping at target angles
+#define ROBOTIC_ARM_SEGMENT_VIA 0x01
+
+// Segment flag: play the motion by DMA, falls back to timer steps if DMA is unavailable
+#define ROBOTIC_ARM_SEGMENT_DMA 0x02
+
+// Segment flag: after reaching the target angles, play the recording prepared by arm_teach_play()
+#define ROBOTIC_ARM_SEGMENT_REPLAY 0x04
+
+/**
+ * @number: Number of servos to move, 0 to only hold (uint8_t)
+ * @indexes: Indexes of servos to move (uint8_t[])
+ * @angles: Target angles (float[])
+ * @hold_ms: Time to stay still after servos reached target angles, ignored by via segments (uint16_t)
+ * @flags: ROBOTIC_ARM_SEGMENT_* flags (uint8_t)
+ */
+typedef struct robotic_arm_segment {
+    uint8_t number;
+    uint8_t indexes[SERVO_MOTION_MAX_SERVOS];
+    float angles[SERVO_MOTION_MAX_SERVOS];
+    uint16_t hold_ms;
+    uint8_t flags;
+} robotic_arm_segment;
+
+/**
+ * @name: Name of the sequence, for logs (const char*)
+ * @length: Number of segments (uint8_t)
+ * @segments: Segments to move in order (const robotic_arm_segment*)
+ */
+typedef struct robotic_arm_sequence {
+    const char* name;
+    uint8_t length;
+    const robotic_arm_segment* segments;
+} robotic_arm_sequence;
+
+/**
+ * Macro to define a robotic arm sequence from a const segment array at compile time.
+ *
+ * @seq_name: Name of the sequence (const char*)
+ * @segment_array: Array of segments, not a pointer (const robotic_arm_segment[])
+ */
+#define ROBOTIC_ARM_SEQUENCE(seq_name, segment_array)                               \
+{                                                                                  \
+    .name = (seq_name),                                                            \
+    .length = sizeof(segment_array) / sizeof((segment_array)[0]),                  \
+    .segments = (segment_array)                                                    \
+}
 
 /**
  * @number: Number of servos in robotic arm (uint8_t)
  * @servos: Servos in robotic arm (servo*)
+ * @park_angles: Angles the servos rest at while unpowered, see ROBOTIC_ARM_SOFT_START_MS (float[])
+ * @start_us: Time robotic_arm_start() took to bring the servos up (uint32_t)
+ * @queue: Segments waiting to be moved (robotic_arm_segment[])
+ * @queue_head: Index where the next segment is queued (uint8_t)
+ * @queue_tail: Index of the next segment to move (uint8_t)
+ * @busy: Whether a segment is being moved or held (bool)
+ * @segments_queued: Number of segments ever queued, wraps around (uint32_t)
+ * @segments_started: Number of segments ever started, wraps around (uint32_t)
+ * @segments_done: Number of segments ever finished, wraps around (uint32_t)
+ * @hold_ticks: Remaining motion ticks to hold the current segment (uint)
+ * @replaying: Whether the current segment plays a recording after its motion (bool)
+ * @segment_start_us: Time the current segment started, for statistics (uint32_t)
+ * @last_tick_us: Time of the previous motion tick, for statistics (uint32_t)
+ * @motion: Motion of the current segment (servos_motion)
+ * @period: Time between two motion ticks (us) (uint)
+ * @dma: DMA playback of segments flagged ROBOTIC_ARM_SEGMENT_DMA (servos_dma_playback)
+ * @dma_ready: Whether DMA channels were claimed for dma (bool)
+ * @request: Retarget or cancel request waiting for the motion executor, 0 if none (uint8_t)
+ * @request_segment: Segment id the request applies to (uint32_t)
+ * @request_data: New segment of a retarget request (robotic_arm_segment)
+ * @request_result: Whether the executor could apply the request (bool)
+ * @scheduled: Whether the scheduler is ticking the arm (bool)
+ * @core1_started: Whether the scheduler ticks the arm on core 1 (bool)
  */
 typedef struct robotic_arm {
     uint8_t number;
     servo* servos;
+    float park_angles[SERVO_MOTION_MAX_SERVOS];
+    uint32_t start_us;
+    robotic_arm_segment queue[ROBOTIC_ARM_QUEUE_SIZE];
+    volatile uint8_t queue_head;
+    volatile uint8_t queue_tail;
+    volatile bool busy;
+    volatile uint32_t segments_queued;
+    volatile uint32_t segments_started;
+    volatile uint32_t segments_done;
+    uint hold_ticks;
+    bool replaying;
+    uint32_t segment_start_us;
+    uint32_t last_tick_us;
+    servos_motion motion;
+    uint period;
+    servos_dma_playback dma;
+    bool dma_ready;
+    volatile uint8_t request;
+    uint32_t request_segment;
+    robotic_arm_segment request_data;
+    volatile bool request_result;
+    volatile bool scheduled;
+    bool core1_started;
 } robotic_arm;
 
 /**
@@ -35,11 +145,61 @@ typedef struct robotic_arm_signal {
 for(tmp = 0, servo_ptr = &(robot_ptr)->servos[tmp]; servo_ptr; tmp += 1, servo_ptr = (tmp < robot_ptr->number) ? &(robot_ptr)->servos[tmp] : NULL)
 
 /**
- * Create a robotic arm that have number of servos.
+ * @pin: GPIO pin connected to the servo, must support hardware PWM (uint)
+ * @angle_range: Range of angle the servo can move, usually 180 degrees (float)
+ * @period: PWM signal period (us) (uint)
+ * @min_duty: Duty cycle at 0 degree (us) (uint)
+ * @max_duty: Duty cycle at 180 degree (us) (uint)
+ * @angle: Angle the servo is set to at start (float)
+ * @park_angle: Angle the servo rests at while unpowered, soft start moves from here to angle (float)
+ * @angle_lower_bound: Limit of the lowest angle the servo can move (float)
+ * @angle_upper_bound: Limit of the highest angle the servo can move (float)
+ * @max_velocity: Velocity limit under load, 0 for the fixed legacy timing (degrees/s) (float)
+ * @max_acceleration: Acceleration limit under load, 0 for the fixed legacy timing (degrees/s^2) (float)
+ */
+typedef struct robotic_arm_servo_config {
+    uint pin;
+    float angle_range;
+    uint period;
+    uint min_duty;
+    uint max_duty;
+    float angle;
+    float park_angle;
+    float angle_lower_bound;
+    float angle_upper_bound;
+    float max_velocity;
+    float max_acceleration;
+} robotic_arm_servo_config;
+
+/**
+ * Macro to define a robotic arm and its servos in static storage at compile time.
+ * Initialize it with robotic_arm_init() before use.
+ *
+ * @name: Name of the robotic_arm variable
+ * @servo_number: Number of servos, 1 to SERVO_MOTION_MAX_SERVOS
+ */
+#define ROBOTIC_ARM_DEFINE(name, servo_number)                                      \
+_Static_assert((servo_number) > 0 && (servo_number) <= SERVO_MOTION_MAX_SERVOS,    \
+               "Robotic arm " #name " needs 1 to SERVO_MOTION_MAX_SERVOS servos"); \
+static servo name##_servos[servo_number];                                          \
+static robotic_arm name = {                                                        \
+    .number = (servo_number),                                                      \
+    .servos = name##_servos                                                        \
+}
+
+/**
+ * Reset a robotic arm defined by ROBOTIC_ARM_DEFINE() and set up its servos.
+ * Servos are not driven until robotic_arm_start() or robotic_arm_start_core1().
+ * The pins are checked against every other initialized arm, a PWM slice can only be shared
+ * by servos on different channels with the same period.
+ * 
+ * @robot: Robotic arm to initialize
+ * @configs: Configuration of every servo, robot->number entries
  * 
- * @number: Number of servos in robotic arm
+ * Return false if the arm has more servos than SERVO_MOTION_MAX_SERVOS, ROBOTIC_ARM_MAX_ARMS
+ * arms are initialized already or a pin conflicts.
  */
-robotic_arm* robotic_arm_create(uint8_t number);
+bool robotic_arm_init(robotic_arm* robot, const robotic_arm_servo_config* configs);
 
 /**
  * Set GPIO pin of a robotic arm servo.
@@ -69,6 +229,16 @@ void robotic_arm_set_servo_datasheet(robotic_arm* robot, uint8_t index, servo* s
  */
 void robotic_arm_set_servo_limits(robotic_arm* robot, uint8_t index, float angle_lower_bound, float angle_upper_bound);
 
+/**
+ * Set velocity and acceleration limits for a robotic arm servo, 0 for the fixed legacy timing.
+ * 
+ * @robot: Robotic arm to set
+ * @index: Index of servo in robotic arm to set
+ * @max_velocity: Velocity limit under load (degrees/s)
+ * @max_acceleration: Acceleration limit under load (degrees/s^2)
+ */
+void robotic_arm_set_servo_dynamics(robotic_arm* robot, uint8_t index, float max_velocity, float max_acceleration);
+
 /**
  * Set a robotic arm servo to angle immediately.
  * 
@@ -79,15 +249,35 @@ void robotic_arm_set_servo_limits(robotic_arm* robot, uint8_t index, float angle
 void robotic_arm_set_servo_angle(robotic_arm* robot, uint8_t index, float angle);
 
 /**
- * Start robotic arm.
+ * Start robotic arm and add it to the scheduler on the motion timer.
+ * One timer ticks every started arm in turn, so all arms need the same servo period.
  * Make sure all servos are properly set before calling this.
  * 
  * @robot: Robotic arm to start
+ * 
+ * Return false if the arm is started already, its period differs from the other arms,
+ * the other arms run on core 1 or the timer cannot start.
  */
-void robotic_arm_start(robotic_arm* robot);
+bool robotic_arm_start(robotic_arm* robot);
+
+/**
+ * Start robotic arm and add it to the scheduler running on core 1.
+ * Core 1 initializes the servos and owns them afterwards,
+ * queue motions with robotic_arm_move_async() from core 0.
+ * The other arms on core 1 pause while the servos of this one soft start, start all arms at boot.
+ * Make sure all servos are properly set before calling this.
+ * 
+ * @robot: Robotic arm to start
+ * 
+ * Return false if the arm is started already, its period differs from the other arms
+ * or the other arms run on the motion timer.
+ */
+bool robotic_arm_start_core1(robotic_arm* robot);
 
 /**
  * Smoothly move a robotic arm servo to angle.
+ * Waits for queued motions to finish first.
+ * Once the arm is started the move is queued to the scheduler and waited for.
  * 
  * @robot: Robotic arm to move
  * @index: Index of servo in robotic arm to move
@@ -97,12 +287,130 @@ void robotic_arm_move_servo(robotic_arm* robot, uint8_t index, float angle);
 
 /**
  * Smoothly move multiple robotic arm servos to angles at once.
+ * Waits for queued motions to finish first.
+ * Once the arm is started the move is queued to the scheduler and waited for.
  * 
  * @robot: Robotic arm to move
  * @signal: Control signal
  */
 void robotic_arm_move(robotic_arm* robot, robotic_arm_signal* signal);
 
+/**
+ * Queue a segment to be moved in background by the motion timer.
+ * 
+ * @robot: Robotic arm to move
+ * @segment: Segment to queue, copied into the queue
+ * 
+ * Return false if the queue is full.
+ */
+bool robotic_arm_queue_segment(robotic_arm* robot, const robotic_arm_segment* segment);
+
+/**
+ * Get the number of segments that can still be queued.
+ * 
+ * @robot: Robotic arm to check
+ */
+uint8_t robotic_arm_queue_room(robotic_arm* robot);
+
+/**
+ * Queue all segments of a sequence to be moved in background.
+ * Queues nothing unless the whole sequence fits in the queue.
+ * 
+ * @robot: Robotic arm to move
+ * @sequence: Sequence to queue
+ * 
+ * Return false if the queue has not enough room for the sequence.
+ */
+bool robotic_arm_play_sequence(robotic_arm* robot, const robotic_arm_sequence* sequence);
+
+/**
+ * Smoothly move multiple robotic arm servos to angles in background.
+ * Returns immediately, segments queued before are moved first.
+ * 
+ * @robot: Robotic arm to move
+ * @signal: Control signal, copied into the queue
+ * @hold_ms: Time to stay still after servos reached target angles
+ * 
+ * Return false if signal is invalid or the queue is full.
+ */
+bool robotic_arm_move_async(robotic_arm* robot, robotic_arm_signal* signal, uint16_t hold_ms);
+
+/**
+ * Smoothly move multiple robotic arm servos to angles in background by DMA.
+ * Like robotic_arm_move_async(), but every step is loaded into the PWM slices by DMA
+ * at the PWM wrap, so the motion timer only checks when the move is over.
+ * 
+ * @robot: Robotic arm to move
+ * @signal: Control signal, copied into the queue
+ * @hold_ms: Time to stay still after servos reached target angles
+ * 
+ * Return false if signal is invalid or the queue is full.
+ */
+bool robotic_arm_move_dma(robotic_arm* robot, robotic_arm_signal* signal, uint16_t hold_ms);
+
+/**
+ * Move robotic arm servos in background along one continuous path through waypoints.
+ * Servos keep moving through intermediate waypoints unless told to stop there,
+ * and always stop at the last waypoint. Queues nothing unless the whole path fits.
+ * 
+ * @robot: Robotic arm to move
+ * @waypoints: Control signals to pass in order
+ * @must_stop: Whether to stop at each waypoint, NULL to stop only at the last one
+ * @count: Number of waypoints
+ * 
+ * Return false if a waypoint is invalid or the queue has not enough room.
+ */
+bool robotic_arm_move_path(robotic_arm* robot, robotic_arm_signal* waypoints, const bool* must_stop, uint8_t count);
+
+/**
+ * Check whether a robotic arm finished all queued motions.
+ * 
+ * @robot: Robotic arm to check
+ */
+bool robotic_arm_is_idle(robotic_arm* robot);
+
+/**
+ * Block until a robotic arm finished all queued motions, feeding the watchdog and writing
+ * taught frames to flash meanwhile. Call from the core that queues segments.
+ * 
+ * @robot: Robotic arm to wait
+ */
+void robotic_arm_wait(robotic_arm* robot);
+
+/**
+ * Change the target of a queued segment, or of the segment being moved without stopping:
+ * servos turn towards the new target from their current angles and velocities.
+ * Segment ids count from 0 in queueing order, a segment gets the value segments_queued had
+ * before it was queued. Call from the core that queues segments, waits up to one motion tick.
+ * 
+ * @robot: Robotic arm
+ * @segment_id: Id of the segment to change
+ * @segment: New segment, its flags and hold replace the old ones
+ * 
+ * Return false if the segment already finished, is played by DMA or the new segment is invalid.
+ */
+bool robotic_arm_retarget(robotic_arm* robot, uint32_t segment_id, const robotic_arm_segment* segment);
+
+/**
+ * Drop a segment and every segment queued after it. If the segment being moved is dropped,
+ * servos decelerate to a smooth stop instead of finishing it, unless it is played by DMA.
+ * Segments ids continue from the first dropped id. Call from the core that queues segments,
+ * waits up to one motion tick.
+ * 
+ * @robot: Robotic arm
+ * @segment_id: Id of the first segment to drop, see robotic_arm_retarget()
+ */
+void robotic_arm_cancel(robotic_arm* robot, uint32_t segment_id);
+
+/**
+ * Advance queued motions of a robotic arm by one step.
+ * Called by the scheduler for every started arm, on the motion timer started in
+ * robotic_arm_start() or on core 1 after robotic_arm_start_core1().
+ * 
+ * @robot: Robotic arm to advance
+ */
+void robotic_arm_tick(robotic_arm* robot);
+
 /**
  * Print index and angle of a robotic arm servo
  * 
@@ -119,15 +427,16 @@ void robotic_arm_print_servo(robotic_arm* robot, uint8_t index);
 void robotic_arm_print(robotic_arm* robot);
 
 /**
- * Free memory malloced by robotic_arm_create().
+ * Remove a robotic arm from the scheduler, release its DMA channels and pins.
+ * The motion timer stops with the last arm.
  * 
- * @robot: Robotic arm to free
+ * @robot: Robotic arm to stop, must not be ticked by core 1
  */
-void robotic_arm_free(robotic_arm* robot);
+void robotic_arm_deinit(robotic_arm* robot);
 
 /**
  * Transfer string to robotic arm control signal.
- * Make sure signal->indexes and signal->angles are allocated before calling this.
+ * Make sure signal->indexes and signal->angles can hold SERVO_MOTION_MAX_SERVOS entries.
  * 
  * @signal: Robotic arm control signal to set
  * @str: String to transfer, format is "number index angle index angle ..."
@@ -0,0 +1,16 @@
+#ifndef SERVO_BENCHMARK_H
+#define SERVO_BENCHMARK_H
+
+#include "servo_control.h"
+
+/**
+ * Measure CPU cycles per step of the float and fixed-point motion kernels and print them.
+ * Only calculates PWM levels, servos do not move.
+ * 
+ * @number: Number of servos to benchmark with
+ * @motors: Servos to benchmark with, at their current angles
+ */
+void servos_motion_benchmark(uint number, servo** motors);
+
+
+#endif  // SERVO_BENCHMARK_H
@@ -4,49 +4,151 @@
 // PWM wrap value for the servo control
 #define SERVO_PWM_WRAP 40000
 
+// PWM counts before a wrap in which servos_commit() waits for the wrap to pass
+#define SERVO_COMMIT_GUARD 64
+
 // Default system clock frequency (Hz)
 #ifndef SYSTEM_CLOCK
 #define SYSTEM_CLOCK 125000000
 #endif
 
+// Motion profiles, cosine is used when a servo has no velocity or acceleration limit
+#define SERVO_PROFILE_COSINE 0
+#define SERVO_PROFILE_TRAPEZOID 1
+#define SERVO_PROFILE_SCURVE 2
+
+// Profile of motions whose servos all have velocity and acceleration limits
+#ifndef SERVO_MOTION_PROFILE
+#define SERVO_MOTION_PROFILE SERVO_PROFILE_TRAPEZOID
+#endif
+
+// 1 to interpolate motions with integer math only, 0 for the float kernel
+#ifndef SERVO_FIXED_POINT
+#define SERVO_FIXED_POINT 1
+#endif
+
+// Number of intervals in the Q15 easing lookup tables
+#define SERVO_EASING_TABLE_SIZE 256
+
+// Maximum number of servos driven by a single motion
+#ifndef SERVO_MOTION_MAX_SERVOS
+#define SERVO_MOTION_MAX_SERVOS 8
+#endif
+
 /**
+ * Servos stay one record each, not parallel arrays: kinematics, planning and teaching read
+ * whole servos. Fields used while a motion runs come first, the datasheet and limits only
+ * read when a motion starts are kept after them. Motion steps never read this record, they
+ * run on the parallel arrays of servos_motion.
+ * 
+ * @level: PWM level last written or staged, motion steps only update it at the last step
+ * @slice: PWM slice of pin, set by servo_calibrate()
+ * @channel: PWM channel of pin, set by servo_calibrate()
+ * @level_offset: PWM level at 0 degree in Q10, set by servo_calibrate()
+ * @level_slope: PWM levels per degree in Q10, set by servo_calibrate()
+ * @angle: Current angle of the servo in degrees
+ * @velocity: Velocity when the last motion ended, non-zero only between blended motions (degrees/s)
  * @pin: GPIO pin connected to the servo, must support hardware PWM
  * @angle_range: Range of angle the servo can move, usually 180 degrees
  * @period: PWM signal period (us)
  * @min_duty: Duty cycle at 0 degree (us)
  * @max_duty: Duty cycle at 180 degree (us)
- * @angle: Current angle of the servo in degrees
  * @angle_lower_bound: Limit of the lowest angle the servo can move
  * @angle_upper_bound: Limit of the highest angle the servo can move
+ * @max_velocity: Velocity limit of the servo under its load, 0 for the fixed legacy timing (degrees/s)
+ * @max_acceleration: Acceleration limit of the servo under its load, 0 for the fixed legacy timing (degrees/s^2)
  */
 typedef struct servo {
+    uint16_t level;
+    uint8_t slice;
+    uint8_t channel;
+    int32_t level_offset;
+    int32_t level_slope;
+    float angle;
+    float velocity;
     uint pin;
     float angle_range;
     uint period;
     uint min_duty;
     uint max_duty;
-    float angle;
     float angle_lower_bound;
     float angle_upper_bound;
+    float max_velocity;
+    float max_acceleration;
 } servo;
 
+/**
+ * @number: Number of servos in motion
+ * @motors: Servos in motion
+ * @start_angles: Angles of servos when motion started
+ * @angle_differences: Differences between target and start angles
+ * @target_angles: Target angles of servos
+ * @start_tangents: Start velocities scaled to the whole motion (degrees)
+ * @end_tangents: End velocities scaled to the whole motion (degrees)
+ * @end_velocities: Velocities of servos when motion ends (degrees/s)
+ * @blended: Whether motion starts or ends moving, cubic Hermite instead of the profile
+ * @profile: SERVO_PROFILE_* shape shared by all servos so they arrive together
+ * @accel_fraction: Fraction of the motion spent accelerating, and again decelerating (0 to 0.5)
+ * @levels: PWM levels of the last step, committed from here instead of through motors
+ * @slices: PWM slices of the servos, copied from motors so steps never dereference them
+ * @channels: PWM channels of the servos, copied from motors
+ * @start_levels: PWM levels when motion started, for the fixed-point kernel
+ * @level_differences: Differences between target and start PWM levels
+ * @start_tangent_levels: start_tangents converted to PWM levels
+ * @end_tangent_levels: end_tangents converted to PWM levels
+ * @accel_fraction_q15: accel_fraction in Q15
+ * @cruise_velocity_q14: Cruise velocity 1 / (1 - accel_fraction) in Q14
+ * @steps: Total number of steps of motion
+ * @step: Number of steps already performed
+ * @period: Time between two steps (us)
+ * @start_us: Time the first step was performed, the deadlines of later steps count from it (us)
+ */
+typedef struct servos_motion {
+    uint number;
+    servo* motors[SERVO_MOTION_MAX_SERVOS];
+    float start_angles[SERVO_MOTION_MAX_SERVOS];
+    float angle_differences[SERVO_MOTION_MAX_SERVOS];
+    float target_angles[SERVO_MOTION_MAX_SERVOS];
+    float start_tangents[SERVO_MOTION_MAX_SERVOS];
+    float end_tangents[SERVO_MOTION_MAX_SERVOS];
+    float end_velocities[SERVO_MOTION_MAX_SERVOS];
+    bool blended;
+    uint8_t profile;
+    float accel_fraction;
+    uint16_t levels[SERVO_MOTION_MAX_SERVOS];
+    uint8_t slices[SERVO_MOTION_MAX_SERVOS];
+    uint8_t channels[SERVO_MOTION_MAX_SERVOS];
+    int32_t start_levels[SERVO_MOTION_MAX_SERVOS];
+    int32_t level_differences[SERVO_MOTION_MAX_SERVOS];
+    int32_t start_tangent_levels[SERVO_MOTION_MAX_SERVOS];
+    int32_t end_tangent_levels[SERVO_MOTION_MAX_SERVOS];
+    int32_t accel_fraction_q15;
+    int32_t cruise_velocity_q14;
+    uint steps;
+    uint step;
+    uint period;
+    uint32_t start_us;
+} servos_motion;
+
 /**
  * Macro to set information of servo from source.
- *
+ * 
  * @destination: Servo to set (servo*)
  * @source: Servo to copy information (servo*)
  */
-#define SERVO_DATASHEET_COPY(destination, source)            \
-do{                                                     \
-    (destination)->angle_range = (source)->angle_range; \
-    (destination)->period = (source)->period;           \
-    (destination)->min_duty = (source)->min_duty;       \
-    (destination)->max_duty = (source)->max_duty;       \
+#define SERVO_DATASHEET_COPY(destination, source)                 \
+do{                                                               \
+    (destination)->angle_range = (source)->angle_range;           \
+    (destination)->period = (source)->period;                     \
+    (destination)->min_duty = (source)->min_duty;                 \
+    (destination)->max_duty = (source)->max_duty;                 \
+    (destination)->max_velocity = (source)->max_velocity;         \
+    (destination)->max_acceleration = (source)->max_acceleration; \
 }while(0)
 
 /**
  * Macro to select specific servos from an array and store their addresses.
- *
+ * 
  * @picks: Output array to hold pointers to selected servos (servo**)
  * @servos: Array of all servo instances (servo*)
  * @pick_nums: Array of indexes of servos to pick (uint*)
@@ -59,6 +161,41 @@ do{                                                                 \
     }                                                               \
 }while(0)
 
+/**
+ * Calculate the number of steps a servo needs to smoothly move by an angle.
+ * Uses the minimum time under the servo limits when it has them.
+ * 
+ * @motor: Servo to move
+ * @angle_difference: Angle to move by in degrees
+ */
+uint servo_calculate_steps(servo* motor, float angle_difference);
+
+/**
+ * Precompute PWM slice, channel and integer angle to level conversion of a servo.
+ * Called by servo_init() and servos_init(), call again after changing pin or datasheet.
+ * 
+ * @motor: Servo to calibrate
+ */
+void servo_calibrate(servo* motor);
+
+/**
+ * Convert an angle to the PWM level of a servo, clamped to its angle limits.
+ * Make sure the servo is calibrated before calling this.
+ * 
+ * @motor: Servo to convert for
+ * @angle: Angle in degrees
+ */
+uint16_t servo_angle_to_level(servo* motor, float angle);
+
+/**
+ * Convert a PWM level of a servo back to an angle, the middle of the angles that map to it.
+ * Make sure the servo is calibrated before calling this.
+ * 
+ * @motor: Servo to convert for
+ * @level: PWM level
+ */
+float servo_level_to_angle(servo* motor, uint16_t level);
+
 /**
  * Initialize a single servo motor.
  * Make sure all fields in motor are correctly set before calling this.
@@ -86,6 +223,15 @@ void servo_set_pin(servo* motor, uint pin);
  */
 void servo_set_datasheet(servo* motor, float angle_range, uint period, uint min_duty, uint max_duty);
 
+/**
+ * Set velocity and acceleration limits of a servo, 0 for the fixed legacy timing.
+ * 
+ * @motor: Servo to set
+ * @max_velocity: Velocity limit under load (degrees/s)
+ * @max_acceleration: Acceleration limit under load (degrees/s^2)
+ */
+void servo_set_dynamics(servo* motor, float max_velocity, float max_acceleration);
+
 /**
  * Set limits for servo angles.
  * 
@@ -103,6 +249,14 @@ void servo_set_limits(servo* motor, float angle_lower_bound, float angle_upper_b
  */
 void servo_set_angle(servo* motor, float angle);
 
+/**
+ * Set the angle of a servo without writing its PWM level, see servos_commit().
+ * 
+ * @motor: Servo to set angle
+ * @angle: Target angle in degrees
+ */
+void servo_stage_angle(servo* motor, float angle);
+
 /**
  * Move a single servo motor smoothly to the target angle.
  * 
@@ -120,6 +274,18 @@ void servo_smooth(servo* motor, float angle);
  */
 void servos_init(uint number, servo** motors);
 
+/**
+ * Initialize multiple servo motors one after another to limit the inrush current.
+ * Every output starts without pulses, so servos stay limp until their turn. Then each servo
+ * is driven at its park angle, given stagger_ms to settle and moved smoothly to its angle.
+ * 
+ * @number: Number of servos to initialize
+ * @motors: Servos to initialize, angle is where each servo ends up
+ * @park_angles: Angles the servos are expected to rest at while unpowered
+ * @stagger_ms: Time between driving one servo and moving it (ms)
+ */
+void servos_soft_start(uint number, servo** motors, const float* park_angles, uint stagger_ms);
+
 /**
  * Set angles for multiple servos immediately.
  * 
@@ -129,6 +295,27 @@ void servos_init(uint number, servo** motors);
  */
 void servos_set_angle(uint number, servo** motors, float *angles);
 
+/**
+ * Write staged PWM levels of multiple servos so they all take effect in the same PWM period.
+ * All compare values are written together once no slice is in the last SERVO_COMMIT_GUARD
+ * counts before its wrap, so each latches at the next wrap of its slice. Slices enabled
+ * together by servos_init() count in phase and latch at the same wrap.
+ * 
+ * @number: Number of servos to commit
+ * @motors: Servos with staged levels
+ */
+void servos_commit(uint number, servo** motors);
+
+/**
+ * Write PWM levels to slice channels so they all take effect in the same PWM period, see servos_commit().
+ * 
+ * @number: Number of levels to commit
+ * @slices: PWM slice of each level
+ * @channels: PWM channel of each level
+ * @levels: PWM levels to write
+ */
+void servos_commit_levels(uint number, const uint8_t* slices, const uint8_t* channels, const uint16_t* levels);
+
 /**
  * Smoothly move multiple servos to target angles.
  * 
@@ -138,5 +325,98 @@ void servos_set_angle(uint number, servo** motors, float *angles);
  */
 void servos_smooth(uint number, servo** motors, float *angles);
 
+/**
+ * Prepare a smooth motion of multiple servos without moving them.
+ * Servos start with their current velocities and stop at target angles,
+ * all arriving together in the minimum time the slowest servo allows.
+ * Call servos_motion_step_at() every motion->period us to perform it.
+ * 
+ * @motion: Motion to prepare
+ * @number: Number of servos to move, at most SERVO_MOTION_MAX_SERVOS
+ * @motors: Servos to move
+ * @angles: Target angles in degrees
+ */
+void servos_motion_start(servos_motion* motion, uint number, servo** motors, float *angles);
+
+/**
+ * Let a prepared motion pass its target angles without stopping.
+ * Call before the first servos_motion_step().
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * @end_velocities: Velocities at target angles, in motion servo order (degrees/s)
+ */
+void servos_motion_blend(servos_motion* motion, const float* end_velocities);
+
+/**
+ * Calculate PWM levels of a motion step with the float kernel, without moving servos.
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * @step: Step to calculate, from 1 to motion->steps - 1
+ * @angles: Output angles in motion servo order, may be NULL
+ * @levels: Output PWM levels in motion servo order
+ */
+void servos_motion_levels_float(servos_motion* motion, uint step, float* angles, uint16_t* levels);
+
+/**
+ * Calculate PWM levels of a motion step with the fixed-point kernel, without moving servos.
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * @step: Step to calculate, from 1 to motion->steps - 1
+ * @levels: Output PWM levels in motion servo order
+ */
+void servos_motion_levels_fixed(servos_motion* motion, uint step, uint16_t* levels);
+
+/**
+ * Perform the next step of a smooth motion.
+ * Servo angles only update at the last step with the fixed-point kernel.
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * 
+ * Return true if more steps remain, false once servos reached target angles.
+ */
+bool servos_motion_step(servos_motion* motion);
+
+/**
+ * Perform the step of a smooth motion that is due at a time rather than simply the next one.
+ * The first step sets the deadlines, step k is due (k - 1) * motion->period us after it.
+ * A call half a period or more past the deadline is counted as a late step and skips the steps
+ * already due, so the motion still ends on time; an early call does nothing.
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * @now: Current time (us)
+ * 
+ * Return true if more steps remain, false once servos reached target angles.
+ */
+bool servos_motion_step_at(servos_motion* motion, uint32_t now);
+
+/**
+ * Calculate angles and velocities of the servos of a motion at a step, without moving servos.
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * @step: Step to calculate, from 0 to motion->steps
+ * @angles: Output angles in motion servo order
+ * @velocities: Output velocities in motion servo order (degrees/s), may be NULL
+ */
+void servos_motion_state(servos_motion* motion, uint step, float* angles, float* velocities);
+
+/**
+ * Redirect a motion in progress to new target angles, continuing from the angles and velocities
+ * its servos have at the current step. Servos of the motion missing from motors keep their target.
+ * The motion restarts at step 0 with a blended curve slow enough for the acceleration limits.
+ * 
+ * @motion: Motion prepared by servos_motion_start(), possibly partly performed
+ * @number: Number of servos to redirect
+ * @motors: Servos to redirect, may include servos not in the motion yet
+ * @angles: New target angles in degrees
+ */
+void servos_motion_retarget(servos_motion* motion, uint number, servo** motors, const float* angles);
+
+/**
+ * Bring a motion in progress to a smooth stop, each servo decelerating at its acceleration limit.
+ * 
+ * @motion: Motion prepared by servos_motion_start(), possibly partly performed
+ */
+void servos_motion_stop(servos_motion* motion);
+
 
 #endif  // SERVO_CONTROL_H
\ No newline at end of file
@@ -0,0 +1,124 @@
+#ifndef SERVO_DMA_H
+#define SERVO_DMA_H
+
+#include "servo_control.h"
+
+// Motion steps per playback buffer, moves up to twice this are fully precomputed before they start
+#ifndef SERVO_DMA_BLOCK_STEPS
+#define SERVO_DMA_BLOCK_STEPS 64
+#endif
+
+// Maximum number of PWM slices one playback drives, each takes two DMA channels
+#ifndef SERVO_DMA_MAX_SLICES
+#define SERVO_DMA_MAX_SLICES 4
+#endif
+
+// Maximum number of playbacks running at the same time, e.g. one per robotic arm
+#ifndef SERVO_DMA_MAX_PLAYBACKS
+#define SERVO_DMA_MAX_PLAYBACKS 4
+#endif
+
+// Hardware spin lock guarding the list of running playbacks, shared by the cores starting them
+#ifndef SERVO_DMA_SPIN_LOCK
+#define SERVO_DMA_SPIN_LOCK (PICO_SPINLOCK_ID_STRIPED_FIRST + 1)
+#endif
+
+// DMA interrupt line (0 or 1) used to refill playback buffers
+#ifndef SERVO_DMA_IRQ_INDEX
+#define SERVO_DMA_IRQ_INDEX 1
+#endif
+
+/**
+ * @slices: Number of PWM slices with claimed DMA channels
+ * @slice_nums: PWM slice of each claimed channel pair
+ * @channels: DMA channels of each slice, one per buffer
+ * @buffers: Ping-pong buffers of compare words, [buffer][slice][step]
+ * @motion: Motion being played, copied by servos_dma_play()
+ * @slots: Index in slice_nums of the slice of each motion servo
+ * @compares: Compare words of slices before playback, keeps channels outside the motion
+ * @period: PWM period shared by all servos of the playback (us)
+ * @blocks: Number of buffer blocks in the motion
+ * @next_block: Next block to compute into a free buffer
+ * @blocks_done: Number of blocks fully transferred
+ * @channels_done: Number of slices that finished the current block of each buffer
+ * @active_slot: Index of the playback in the list of running playbacks, -1 when stopped
+ * @traced: Levels last recorded in the PWM trace for each motion servo, see servos_dma_trace()
+ * @tracing: Whether the levels of the motion still need to be traced
+ * @busy: Whether a motion is being played
+ */
+typedef struct servos_dma_playback {
+    uint slices;
+    uint8_t slice_nums[SERVO_DMA_MAX_SLICES];
+    int channels[SERVO_DMA_MAX_SLICES][2];
+    uint32_t buffers[2][SERVO_DMA_MAX_SLICES][SERVO_DMA_BLOCK_STEPS];
+    servos_motion motion;
+    uint8_t slots[SERVO_MOTION_MAX_SERVOS];
+    uint32_t compares[SERVO_DMA_MAX_SLICES];
+    uint period;
+    uint blocks;
+    uint next_block;
+    volatile uint blocks_done;
+    uint8_t channels_done[2];
+    int active_slot;
+    uint16_t traced[SERVO_MOTION_MAX_SERVOS];
+    bool tracing;
+    volatile bool busy;
+} servos_dma_playback;
+
+/**
+ * Claim two DMA channels for every PWM slice of servos and install the refill interrupt.
+ * Call on the core that owns the servos, after servos_init().
+ * 
+ * @playback: Playback to initialize
+ * @number: Number of servos the playback may move
+ * @motors: Servos the playback may move
+ * 
+ * Return false if servos have different PWM periods, there are too many slices
+ * or not enough free DMA channels.
+ */
+bool servos_dma_init(servos_dma_playback* playback, uint number, servo** motors);
+
+/**
+ * Play a prepared motion by DMA, each PWM wrap loads the compare values of the next step.
+ * Returns immediately, the CPU only refills a buffer every SERVO_DMA_BLOCK_STEPS steps.
+ * Servo angles, levels and velocities update when the last step was transferred.
+ * Up to SERVO_DMA_MAX_PLAYBACKS playbacks run at the same time if they drive different slices.
+ * Channels of the slices outside the motion are held at their level from when it started,
+ * so servos moved by other means must not share a slice with a running playback.
+ * 
+ * @playback: Playback initialized by servos_dma_init()
+ * @motion: Motion prepared by servos_motion_start(), not stepped yet
+ * 
+ * Return false if this playback is running, another running playback drives one of its slices,
+ * SERVO_DMA_MAX_PLAYBACKS are running, or the motion does not fit the claimed slices
+ * or steps at a different rate than the PWM period.
+ */
+bool servos_dma_play(servos_dma_playback* playback, const servos_motion* motion);
+
+/**
+ * Check whether a playback is still moving servos.
+ * 
+ * @playback: Playback to check
+ */
+bool servos_dma_is_busy(servos_dma_playback* playback);
+
+/**
+ * Record the levels the PWM slices latched for the motion servos in the PWM trace, only those
+ * that changed since the last call. DMA writes the compare words without the CPU, so call this
+ * once per PWM period while the playback is busy and once more after it finished, e.g. from
+ * the motion tick, to keep the trace free of gaps. Does nothing when the trace is compiled out.
+ * 
+ * @playback: Playback to trace
+ */
+void servos_dma_trace(servos_dma_playback* playback);
+
+/**
+ * Stop a playback where it is and release its DMA channels.
+ * Servo angles stay at the start of a stopped motion, set them again before moving.
+ * 
+ * @playback: Playback initialized by servos_dma_init()
+ */
+void servos_dma_release(servos_dma_playback* playback);
+
+
+#endif  // SERVO_DMA_H
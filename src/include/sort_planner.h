@@ -0,0 +1,135 @@
+#ifndef SORT_PLANNER_H
+#define SORT_PLANNER_H
+
+#include "robotic_arm.h"
+#include "arm_kinematics.h"
+#include "sort_sequences.h"
+
+// Servos tracked by the planner: positioning joints and the gripper
+#define SORT_PLANNER_SERVOS (SORT_GRIPPER_SERVO + 1)
+
+// Segments queued per item: pick, grip, lift, bin, release
+#define SORT_PLANNER_ITEM_SEGMENTS 5
+
+/**
+ * Plans sort cycles from the pose the queued motions end at instead of from home,
+ * so consecutive items go straight from one bin drop to the next pick.
+ * 
+ * @poses: Solved sort poses, see arm_pose_cache_build() and sort_pose_points
+ * @segment_flags: Flags added to every planned segment, e.g. ROBOTIC_ARM_SEGMENT_DMA
+ * @pose: Servo angles at the end of the segments queued so far
+ * @fixed_pose: Servo angles at the end of the fixed sequences for the same items
+ * @parked: Whether the queued segments end at home
+ * @items: Number of items planned
+ * @travel_planned: Total joint travel of the planned segments (degrees)
+ * @travel_fixed: Total joint travel the fixed sequences would have moved (degrees)
+ * @speculative: Whether the last item was queued speculatively and waits for a confirmation
+ * @speculative_segment: Id of the first segment of the speculative item, see robotic_arm_retarget()
+ * @lift_pose: Servo angles after lifting the speculative item, where its bin move starts
+ */
+typedef struct sort_planner {
+    const arm_pose_cache* poses;
+    uint8_t segment_flags;
+    float pose[SORT_PLANNER_SERVOS];
+    float fixed_pose[SORT_PLANNER_SERVOS];
+    bool parked;
+    uint32_t items;
+    float travel_planned;
+    float travel_fixed;
+    bool speculative;
+    uint32_t speculative_segment;
+    float lift_pose[SORT_PLANNER_SERVOS];
+} sort_planner;
+
+/**
+ * Start planning from the current servo angles of a robotic arm.
+ * 
+ * @planner: Planner to initialize
+ * @poses: Pose cache built from sort_pose_points
+ * @robot: Robotic arm to plan for, must be idle
+ */
+void sort_planner_init(sort_planner* planner, const arm_pose_cache* poses, robotic_arm* robot);
+
+/**
+ * Continue planning from the current servo angles after the arm was moved outside the planner.
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm, must be idle
+ */
+void sort_planner_sync(sort_planner* planner, robotic_arm* robot);
+
+/**
+ * Check whether a command byte names a bin the planner can reach.
+ * 
+ * @planner: Planner
+ * @command: Command byte, 'a', 'm', 'g' or 'p' in any case
+ */
+bool sort_planner_is_valid(const sort_planner* planner, int command);
+
+/**
+ * Queue one item: pick, lift, drop over the bin and release, starting from where
+ * the queued motions end. The arm stays over the bin afterwards, see sort_planner_park().
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm to queue segments to
+ * @command: Bin command byte, check it with sort_planner_is_valid() first
+ * 
+ * Return false without queueing anything if the command is invalid or the queue has no room.
+ */
+bool sort_planner_queue_item(sort_planner* planner, robotic_arm* robot, int command);
+
+/**
+ * Queue an item for a provisional bin: pick, lift and move over the bin, but keep holding it
+ * until sort_planner_confirm(). Only one speculative item can wait at a time.
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm to queue segments to
+ * @command: Provisional bin command byte, check it with sort_planner_is_valid() first
+ * 
+ * Return false without queueing anything if the command is invalid, the queue has no room
+ * or a speculative item is already waiting.
+ */
+bool sort_planner_queue_speculative(sort_planner* planner, robotic_arm* robot, int command);
+
+/**
+ * Confirm the bin of the speculative item and queue its release. A different bin redirects
+ * the move over the bin while it runs, or moves on from the provisional bin if it already arrived.
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm the item was queued to
+ * @command: Final bin command byte, check it with sort_planner_is_valid() first
+ * 
+ * Return false if no speculative item waits, the command is invalid or the queue has no room.
+ */
+bool sort_planner_confirm(sort_planner* planner, robotic_arm* robot, int command);
+
+/**
+ * Cancel the speculative item: drop its segments, brake the arm to a stop and, if the gripper
+ * already closed, put the item back at the pick pose. Blocks until the arm stopped.
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm the item was queued to
+ * 
+ * Return false if no speculative item waits.
+ */
+bool sort_planner_cancel(sort_planner* planner, robotic_arm* robot);
+
+/**
+ * Queue a return to home unless the queued motions already end there.
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm to queue the segment to
+ * 
+ * Return false if the queue has no room.
+ */
+bool sort_planner_park(sort_planner* planner, robotic_arm* robot);
+
+/**
+ * Print the joint travel of the planned items and of the fixed sequences for the same items.
+ * 
+ * @planner: Planner
+ */
+void sort_planner_print(const sort_planner* planner);
+
+
+#endif  // SORT_PLANNER_H
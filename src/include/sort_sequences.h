@@ -0,0 +1,57 @@
+#ifndef SORT_SEQUENCES_H
+#define SORT_SEQUENCES_H
+
+#include "robotic_arm.h"
+#include "arm_kinematics.h"
+
+// Pause after every stopping segment, lets the gripper settle before the next move
+#define SORT_SEGMENT_HOLD_MS 100
+
+// Gripper servo and its angles holding and releasing an item
+#define SORT_GRIPPER_SERVO 3
+#define SORT_GRIPPER_CLOSED 165
+#define SORT_GRIPPER_OPEN 90
+
+// Shoulder angle lifting a picked item clear of the intake
+#define SORT_LIFT_ANGLE 90
+
+// Sequence picking the item at the intake and lifting it back to the middle
+extern const robotic_arm_sequence sort_sequence_pick;
+
+// Sequence releasing the item over the bin and returning home
+extern const robotic_arm_sequence sort_sequence_throw;
+
+// Fixed gripper positions of the sort cycle, indexes of sort_pose_points
+typedef enum sort_pose {
+    SORT_POSE_HOME,
+    SORT_POSE_PICK,
+    SORT_POSE_BIN_A,
+    SORT_POSE_BIN_M,
+    SORT_POSE_BIN_G,
+    SORT_POSE_BIN_P,
+    SORT_POSES
+} sort_pose;
+
+// Cartesian positions of the sort poses for the default arm kinematics, see arm_pose_cache_build()
+extern const arm_point sort_pose_points[SORT_POSES];
+
+/**
+ * Find the bin sequence played for a command byte.
+ * 
+ * @command: Command byte received from serial, 'a', 'm', 'g' or 'p' in any case
+ * 
+ * Return NULL if command is not a bin command.
+ */
+const robotic_arm_sequence* sort_sequence_find(int command);
+
+/**
+ * Find the bin pose for a command byte.
+ * 
+ * @command: Command byte received from serial, 'a', 'm', 'g' or 'p' in any case
+ * 
+ * Return SORT_POSES if command is not a bin command.
+ */
+sort_pose sort_pose_find(int command);
+
+
+#endif  // SORT_SEQUENCES_H
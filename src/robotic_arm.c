@@ -1,28 +1,380 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/flash.h"
+#include "hardware/sync.h"
+#include "hardware/pwm.h"
+#include "hardware/watchdog.h"
 #include "robotic_arm.h"
+#include "arm_stats.h"
+#include "arm_trace.h"
+#include "arm_teach.h"
+#include "arm_boot.h"
 #include <stdlib.h>
 
 
+// Requests from the queueing core, applied by the motion executor at its next tick
+#define ROBOTIC_ARM_REQUEST_NONE 0
+#define ROBOTIC_ARM_REQUEST_RETARGET 1
+#define ROBOTIC_ARM_REQUEST_CANCEL 2
+
+// Arms initialized on this board, their pins are checked against each other
+static robotic_arm* robotic_arm_claimed[ROBOTIC_ARM_MAX_ARMS];
+
+// Arms ticked by the scheduler in the order they were started, all on scheduler_period
+static robotic_arm* volatile scheduler_arms[ROBOTIC_ARM_MAX_ARMS];
+static volatile uint8_t scheduler_count = 0;
+static uint scheduler_period = 0;
+static repeating_timer_t scheduler_timer;
+static bool scheduler_timer_started = false;
+static bool scheduler_core1_started = false;
+
+// Arm handed to core 1 to start, cleared by core 1 once the arm is scheduled
+static robotic_arm* volatile scheduler_pending = NULL;
+
+// Tick every scheduled arm once, in the order they were started
+static void robotic_arm_scheduler_tick(void) {
+    uint8_t count = scheduler_count;
+    for(uint8_t i = 0; i < count; i++)
+        robotic_arm_tick(scheduler_arms[i]);
+}
+
+// Add a started arm to the scheduler, count is written last so a running tick never sees a gap
+static void robotic_arm_schedule(robotic_arm* robot) {
+    scheduler_arms[scheduler_count] = robot;
+    __mem_fence_release();
+    robot->scheduled = true;
+    scheduler_count++;
+}
+
+// Determine the motion tick period of a robotic arm and check that the scheduler can take it
+static bool robotic_arm_check_schedule(robotic_arm* robot) {
+    robot->period = 1;
+    for(uint8_t i = 0; i < robot->number; i++) {
+        if(robot->servos[i].period > robot->period)
+            robot->period = robot->servos[i].period;
+    }
+    if(robot->scheduled) {
+        fprintf(stderr, "Robotic arm is already started.\n");
+        return false;
+    }
+    if(scheduler_count >= ROBOTIC_ARM_MAX_ARMS) {
+        fprintf(stderr, "Too many robotic arms started.\n");
+        return false;
+    }
+    if(scheduler_count > 0 && robot->period != scheduler_period) {
+        fprintf(stderr, "Robotic arms ticked together need the same servo period.\n");
+        return false;
+    }
+    scheduler_period = robot->period;
+    return true;
+}
+
+// Check that two servos can share the PWM hardware, false if they drive the same output
+// or share a slice with different periods
+static bool robotic_arm_pins_compatible(uint pin, uint period, uint other_pin, uint other_period) {
+    if(pwm_gpio_to_slice_num(pin) != pwm_gpio_to_slice_num(other_pin))
+        return true;
+    if(pwm_gpio_to_channel(pin) == pwm_gpio_to_channel(other_pin)) {
+        fprintf(stderr, "GPIO %u and GPIO %u drive the same PWM output.\n", pin, other_pin);
+        return false;
+    }
+    if(period != other_period) {
+        fprintf(stderr, "GPIO %u and GPIO %u share a PWM slice with different periods.\n", pin, other_pin);
+        return false;
+    }
+    return true;
+}
+
+// Check the pin map of a robotic arm against itself and every other initialized arm
+static bool robotic_arm_check_pins(robotic_arm* robot, const robotic_arm_servo_config* configs) {
+    for(uint8_t i = 0; i < robot->number; i++) {
+        const robotic_arm_servo_config* config = &configs[i];
+        for(uint8_t j = 0; j < i; j++) {
+            if(!robotic_arm_pins_compatible(config->pin, config->period, configs[j].pin, configs[j].period))
+                return false;
+        }
+        for(uint8_t k = 0; k < ROBOTIC_ARM_MAX_ARMS; k++) {
+            robotic_arm* other = robotic_arm_claimed[k];
+            if(!other || other == robot)
+                continue;
+            for(uint8_t j = 0; j < other->number; j++) {
+                if(!robotic_arm_pins_compatible(config->pin, config->period, other->servos[j].pin, other->servos[j].period))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Whether a servo of the arm shares a PWM slice with a servo of another initialized arm
+static bool robotic_arm_shares_slices(robotic_arm* robot) {
+    for(uint8_t k = 0; k < ROBOTIC_ARM_MAX_ARMS; k++) {
+        robotic_arm* other = robotic_arm_claimed[k];
+        if(!other || other == robot)
+            continue;
+        for(uint8_t i = 0; i < robot->number; i++) {
+            for(uint8_t j = 0; j < other->number; j++) {
+                if(robot->servos[i].slice == other->servos[j].slice)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Remember an initialized arm so the pins of later arms are checked against it
+static bool robotic_arm_claim(robotic_arm* robot) {
+    robotic_arm** free_slot = NULL;
+    for(uint8_t k = 0; k < ROBOTIC_ARM_MAX_ARMS; k++) {
+        if(robotic_arm_claimed[k] == robot)
+            return true;
+        if(!robotic_arm_claimed[k] && !free_slot)
+            free_slot = &robotic_arm_claimed[k];
+    }
+    if(!free_slot) {
+        fprintf(stderr, "Too many robotic arms.\n");
+        return false;
+    }
+    *free_slot = robot;
+    return true;
+}
+
+// Initialize all servos of a robotic arm, its motion tick period is set by robotic_arm_check_schedule()
+static void robotic_arm_start_servos(robotic_arm* robot) {
+    servo* servos[SERVO_MOTION_MAX_SERVOS];
+    for(uint8_t i = 0; i < robot->number; i++)
+        servos[i] = &robot->servos[i];
+    uint32_t start = time_us_32();
+#if ROBOTIC_ARM_SOFT_START_MS > 0
+    servos_soft_start(robot->number, servos, robot->park_angles, ROBOTIC_ARM_SOFT_START_MS);
+#else
+    servos_init(robot->number, servos);
+#endif
+    robot->start_us = time_us_32() - start;
+    // Claimed once, on the core that owns the servos so it also takes the refill interrupt
+    if(!robot->dma_ready)
+        robot->dma_ready = servos_dma_init(&robot->dma, robot->number, servos);
+}
+
+// Core 1 entry, starts the arms handed over by robotic_arm_start_core1() and ticks them forever
+static void robotic_arm_core1_entry(void) {
+    // Lets core 0 park this core while it writes recordings to flash
+    flash_safe_execute_core_init();
+    absolute_time_t next_tick = get_absolute_time();
+    while(true) {
+        robotic_arm* pending = scheduler_pending;
+        if(pending) {
+            __mem_fence_acquire();
+            // Servos are started here so this core owns them and takes their DMA interrupt
+            robotic_arm_start_servos(pending);
+            robotic_arm_schedule(pending);
+            scheduler_pending = NULL;
+            next_tick = get_absolute_time();
+        }
+        robotic_arm_scheduler_tick();
+        // Busy wait keeps the step cadence independent of core 0 interrupts
+        uint period = scheduler_period ? scheduler_period : 1000;
+        next_tick = delayed_by_us(next_tick, period);
+        // After a stall, such as a flash write, resume from now instead of ticking the missed
+        // periods in a burst, the steps catch up by their deadlines
+        if(absolute_time_diff_us(next_tick, get_absolute_time()) > (int64_t)period)
+            next_tick = delayed_by_us(get_absolute_time(), period);
+        busy_wait_until(next_tick);
+    }
+}
+
+
+// Copy a control signal into a stopping segment, false if the signal does not fit the arm
+static bool robotic_arm_segment_from_signal(robotic_arm* robot, robotic_arm_segment* segment, robotic_arm_signal* signal) {
+    if(signal->number > robot->number || signal->number > SERVO_MOTION_MAX_SERVOS) {
+        fprintf(stderr, "Too many servos specified in signal.\n");
+        return false;
+    }
+    segment->number = signal->number;
+    segment->hold_ms = 0;
+    segment->flags = 0;
+    for(uint8_t i = 0; i < signal->number; i++) {
+        if(signal->indexes[i] >= robot->number) {
+            fprintf(stderr, "Index out of range.\n");
+            return false;
+        }
+        segment->indexes[i] = signal->indexes[i];
+        segment->angles[i] = signal->angles[i];
+    }
+    return true;
+}
+
+/*
+ * Calculate velocities to pass the end of a via segment when the next segment is already queued.
+ * Each servo keeps moving only if it moves the same way in both segments, using the harmonic mean
+ * of both average velocities so the path never overshoots a waypoint.
+ */
+static void robotic_arm_blend_velocities(robotic_arm* robot, const robotic_arm_segment* segment, const robotic_arm_segment* next, float* velocities) {
+    float via_angles[SERVO_MOTION_MAX_SERVOS];
+    for(uint8_t i = 0; i < robot->number; i++)
+        via_angles[i] = robot->servos[i].angle;
+    for(uint8_t i = 0; i < segment->number; i++)
+        via_angles[segment->indexes[i]] = segment->angles[i];
+    uint next_steps = 1;
+    for(uint8_t i = 0; i < next->number; i++) {
+        uint8_t index = next->indexes[i];
+        uint steps = servo_calculate_steps(&robot->servos[index], next->angles[i] - via_angles[index]);
+        if(steps > next_steps)
+            next_steps = steps;
+    }
+    float steps_per_second = 1e6f / robot->motion.period;
+    for(uint8_t i = 0; i < segment->number; i++) {
+        velocities[i] = 0;
+        for(uint8_t j = 0; j < next->number; j++) {
+            if(next->indexes[j] != segment->indexes[i])
+                continue;
+            float before = robot->motion.angle_differences[i] / robot->motion.steps;
+            float after = (next->angles[j] - segment->angles[i]) / next_steps;
+            if(before * after > 0)
+                velocities[i] = 2 * before * after / (before + after) * steps_per_second;
+        }
+    }
+}
+
+// Motion timer callback, advances the robotic arm passed as user data
+// Apply a retarget request on the executor side, the queueing core waits meanwhile
+static bool robotic_arm_apply_retarget(robotic_arm* robot, uint32_t segment_id, const robotic_arm_segment* segment) {
+    uint32_t started = robot->segments_started;
+    if(robot->busy && segment_id == started - 1) {
+        if((robot->dma_ready && servos_dma_is_busy(&robot->dma)) || robot->replaying)
+            return false;
+        servo* action_servos[SERVO_MOTION_MAX_SERVOS];
+        SERVOS_PICK(action_servos, robot->servos, segment->indexes, segment->number);
+        servos_motion_retarget(&robot->motion, segment->number, action_servos, segment->angles);
+        robot->hold_ticks = (uint32_t)segment->hold_ms * 1000 / robot->period;
+        return true;
+    }
+    uint8_t queued = (robot->queue_head + ROBOTIC_ARM_QUEUE_SIZE - robot->queue_tail) % ROBOTIC_ARM_QUEUE_SIZE;
+    uint32_t offset = segment_id - started;
+    if(offset >= queued)
+        return false;
+    robot->queue[(robot->queue_tail + offset) % ROBOTIC_ARM_QUEUE_SIZE] = *segment;
+    return true;
+}
+
+// Apply a cancel request on the executor side, the queueing core waits meanwhile
+static void robotic_arm_apply_cancel(robotic_arm* robot, uint32_t segment_id) {
+    uint32_t started = robot->segments_started;
+    uint8_t queued = (robot->queue_head + ROBOTIC_ARM_QUEUE_SIZE - robot->queue_tail) % ROBOTIC_ARM_QUEUE_SIZE;
+    // Queued segments from segment_id on are dropped, the queueing core is waiting so head is safe to move
+    int32_t keep = (int32_t)(segment_id - started);
+    if(keep < 0)
+        keep = 0;
+    if(keep < queued) {
+        for(uint8_t k = keep; k < queued; k++) {
+            if(robot->queue[(robot->queue_tail + k) % ROBOTIC_ARM_QUEUE_SIZE].flags & ROBOTIC_ARM_SEGMENT_REPLAY)
+                arm_teach_replay_stop(robot);
+        }
+        robot->queue_head = (robot->queue_tail + keep) % ROBOTIC_ARM_QUEUE_SIZE;
+        robot->segments_queued = started + keep;
+    }
+    // The segment being moved is dropped too, brake instead of finishing or holding it
+    if(robot->busy && (int32_t)(segment_id - (started - 1)) <= 0) {
+        if(robot->dma_ready && servos_dma_is_busy(&robot->dma))
+            return;
+        // A replay past its approach motion stops where it is, the finished motion is not redone
+        if(robot->motion.step < robot->motion.steps)
+            servos_motion_stop(&robot->motion);
+        if(robot->replaying)
+            arm_teach_replay_stop(robot);
+        robot->replaying = false;
+        robot->hold_ticks = 0;
+    }
+}
+
+static void robotic_arm_apply_request(robotic_arm* robot) {
+    if(robot->request == ROBOTIC_ARM_REQUEST_NONE)
+        return;
+    __mem_fence_acquire();
+    if(robot->request == ROBOTIC_ARM_REQUEST_RETARGET)
+        robot->request_result = robotic_arm_apply_retarget(robot, robot->request_segment, &robot->request_data);
+    else {
+        robotic_arm_apply_cancel(robot, robot->request_segment);
+        robot->request_result = true;
+    }
+    __mem_fence_release();
+    robot->request = ROBOTIC_ARM_REQUEST_NONE;
+}
+
+// Hand a request to the motion executor and wait until it is applied
+static bool robotic_arm_post_request(robotic_arm* robot, uint8_t request) {
+    __mem_fence_release();
+    robot->request = request;
+    if(!robot->scheduled) {
+        // Nothing ticks the arm, apply the request here
+        robotic_arm_apply_request(robot);
+    }
+    while(robot->request != ROBOTIC_ARM_REQUEST_NONE)
+        tight_loop_contents();
+    __mem_fence_acquire();
+    return robot->request_result;
+}
+
+static bool robotic_arm_timer_callback(repeating_timer_t* timer) {
+    (void)timer;
+    robotic_arm_scheduler_tick();
+    return true;
+}
+
+
 /**
- * Create a robotic arm that have number of servos.
+ * Reset a robotic arm defined by ROBOTIC_ARM_DEFINE() and set up its servos.
+ * Servos are not driven until robotic_arm_start() or robotic_arm_start_core1().
+ * The pins are checked against every other initialized arm, a PWM slice can only be shared
+ * by servos on different channels with the same period.
+ * 
+ * @robot: Robotic arm to initialize
+ * @configs: Configuration of every servo, robot->number entries
  * 
- * @number: Number of servos in robotic arm
+ * Return false if the arm has more servos than SERVO_MOTION_MAX_SERVOS, ROBOTIC_ARM_MAX_ARMS
+ * arms are initialized already or a pin conflicts.
  */
-robotic_arm* robotic_arm_create(uint8_t number) {
-    robotic_arm* robot = malloc(sizeof(robotic_arm));
-    if(!robot) {
-        fprintf(stderr, "Robotic arm malloc failed.\n");
-        return NULL;
+bool robotic_arm_init(robotic_arm* robot, const robotic_arm_servo_config* configs) {
+    if(robot->number > SERVO_MOTION_MAX_SERVOS) {
+        fprintf(stderr, "Too many servos in robotic arm.\n");
+        return false;
     }
-    robot->number = number;
-    robot->servos = malloc(number * sizeof(servo));
-    if(!robot->servos) {
-        fprintf(stderr, "Robotic arm servos malloc failed.\n");
-        free(robot);
-        return NULL;
+    if(robot->scheduled) {
+        fprintf(stderr, "Robotic arm is running, deinit it first.\n");
+        return false;
     }
-    return robot;
+    if(!robotic_arm_check_pins(robot, configs) || !robotic_arm_claim(robot))
+        return false;
+    for(uint8_t i = 0; i < robot->number; i++) {
+        const robotic_arm_servo_config* config = &configs[i];
+        servo* motor = &robot->servos[i];
+        servo_set_pin(motor, config->pin);
+        servo_set_datasheet(motor, config->angle_range, config->period, config->min_duty, config->max_duty);
+        servo_set_limits(motor, config->angle_lower_bound, config->angle_upper_bound);
+        servo_set_dynamics(motor, config->max_velocity, config->max_acceleration);
+        motor->angle = config->angle;
+        motor->velocity = 0;
+        robot->park_angles[i] = config->park_angle;
+    }
+    robot->start_us = 0;
+    robot->queue_head = 0;
+    robot->queue_tail = 0;
+    robot->busy = false;
+    robot->segments_queued = 0;
+    robot->segments_started = 0;
+    robot->segments_done = 0;
+    robot->hold_ticks = 0;
+    robot->replaying = false;
+    robot->segment_start_us = 0;
+    robot->last_tick_us = 0;
+    robot->period = 1;
+    robot->dma_ready = false;
+    robot->request = ROBOTIC_ARM_REQUEST_NONE;
+    robot->request_result = false;
+    robot->scheduled = false;
+    robot->core1_started = false;
+    return true;
 }
 
 /**
@@ -70,6 +422,22 @@ void robotic_arm_set_servo_limits(robotic_arm* robot, uint8_t index, float angle
     servo_set_limits(&robot->servos[index], angle_lower_bound, angle_upper_bound);
 }
 
+/**
+ * Set velocity and acceleration limits for a robotic arm servo, 0 for the fixed legacy timing.
+ * 
+ * @robot: Robotic arm to set
+ * @index: Index of servo in robotic arm to set
+ * @max_velocity: Velocity limit under load (degrees/s)
+ * @max_acceleration: Acceleration limit under load (degrees/s^2)
+ */
+void robotic_arm_set_servo_dynamics(robotic_arm* robot, uint8_t index, float max_velocity, float max_acceleration) {
+    if(index >= robot->number) {
+        fprintf(stderr, "Index out of range.\n");
+        return ;
+    }
+    servo_set_dynamics(&robot->servos[index], max_velocity, max_acceleration);
+}
+
 /**
  * Set a robotic arm servo to angle immediately.
  * 
@@ -86,18 +454,85 @@ void robotic_arm_set_servo_angle(robotic_arm* robot, uint8_t index, float angle)
 }
 
 /**
- * Start robotic arm.
+ * Start robotic arm and add it to the scheduler on the motion timer.
+ * One timer ticks every started arm in turn, so all arms need the same servo period.
  * Make sure all servos are properly set before calling this.
  * 
  * @robot: Robotic arm to start
+ * 
+ * Return false if the arm is started already, its period differs from the other arms,
+ * the other arms run on core 1 or the timer cannot start.
  */
-void robotic_arm_start(robotic_arm* robot) {
-    servo* servos[robot->number];
-    for(uint8_t i = 0; i < robot->number; i++) {
-        servos[i] = &robot->servos[i];
+bool robotic_arm_start(robotic_arm* robot) {
+    if(scheduler_core1_started) {
+        fprintf(stderr, "Robotic arms are ticked on core 1, use robotic_arm_start_core1().\n");
+        return false;
     }
+    if(!robotic_arm_check_schedule(robot))
+        return false;
     // Initialize all servos
-    servos_init(robot->number, servos);
+    robotic_arm_start_servos(robot);
+    if(!scheduler_timer_started) {
+        // Negative delay keeps ticks one PWM period apart regardless of callback duration
+        if(!add_repeating_timer_us(-(int64_t)scheduler_period, robotic_arm_timer_callback, NULL, &scheduler_timer)) {
+            fprintf(stderr, "Robotic arm motion timer start failed.\n");
+            return false;
+        }
+        scheduler_timer_started = true;
+    }
+    robotic_arm_schedule(robot);
+    return true;
+}
+
+/**
+ * Start robotic arm and add it to the scheduler running on core 1.
+ * Core 1 initializes the servos and owns them afterwards,
+ * queue motions with robotic_arm_move_async() from core 0.
+ * The other arms on core 1 pause while the servos of this one soft start, start all arms at boot.
+ * Make sure all servos are properly set before calling this.
+ * 
+ * @robot: Robotic arm to start
+ * 
+ * Return false if the arm is started already, its period differs from the other arms
+ * or the other arms run on the motion timer.
+ */
+bool robotic_arm_start_core1(robotic_arm* robot) {
+    if(scheduler_timer_started) {
+        fprintf(stderr, "Robotic arms are ticked on the motion timer, use robotic_arm_start().\n");
+        return false;
+    }
+    if(!robotic_arm_check_schedule(robot))
+        return false;
+    if(!scheduler_core1_started) {
+        multicore_launch_core1(robotic_arm_core1_entry);
+        scheduler_core1_started = true;
+    }
+    robot->core1_started = true;
+    __mem_fence_release();
+    scheduler_pending = robot;
+    // Wait until core 1 finished initializing the servos
+    while(scheduler_pending)
+        tight_loop_contents();
+    return true;
+}
+
+/*
+ * Move a segment and block until it is done. Once the arm is scheduled the segment goes through
+ * the queue, so the timer or core 1 stays the only one writing its PWM levels.
+ */
+static void robotic_arm_move_blocking(robotic_arm* robot, robotic_arm_segment* segment) {
+    robotic_arm_wait(robot);
+    if(robot->scheduled) {
+        // The queue is empty after waiting, the executor records the segment time
+        robotic_arm_queue_segment(robot, segment);
+        robotic_arm_wait(robot);
+        return;
+    }
+    servo* action_servos[SERVO_MOTION_MAX_SERVOS];
+    SERVOS_PICK(action_servos, robot->servos, segment->indexes, segment->number);
+    uint32_t start = time_us_32();
+    servos_smooth(segment->number, action_servos, segment->angles);
+    arm_stats_record(ARM_STATS_SEGMENT, time_us_32() - start);
 }
 
 /**
@@ -112,7 +547,12 @@ void robotic_arm_move_servo(robotic_arm* robot, uint8_t index, float angle) {
         fprintf(stderr, "Index out of range.\n");
         return ;
     }
-    servo_smooth(&robot->servos[index], angle);
+    robotic_arm_segment segment = {
+        .number = 1,
+        .indexes = {index},
+        .angles = {angle},
+    };
+    robotic_arm_move_blocking(robot, &segment);
 }
 
 /**
@@ -122,9 +562,271 @@ void robotic_arm_move_servo(robotic_arm* robot, uint8_t index, float angle) {
  * @signal: Control signal
  */
 void robotic_arm_move(robotic_arm* robot, robotic_arm_signal* signal) {
-    servo* action_servos[signal->number];
-    SERVOS_PICK(action_servos, robot->servos, signal->indexes, signal->number);
-    servos_smooth(signal->number, action_servos, signal->angles);
+    robotic_arm_segment segment;
+    if(!robotic_arm_segment_from_signal(robot, &segment, signal))
+        return;
+    robotic_arm_move_blocking(robot, &segment);
+}
+
+/**
+ * Queue a segment to be moved in background by the motion timer.
+ * 
+ * @robot: Robotic arm to move
+ * @segment: Segment to queue, copied into the queue
+ * 
+ * Return false if the queue is full.
+ */
+bool robotic_arm_queue_segment(robotic_arm* robot, const robotic_arm_segment* segment) {
+    uint8_t head = robot->queue_head;
+    uint8_t next = (head + 1) % ROBOTIC_ARM_QUEUE_SIZE;
+    if(next == robot->queue_tail)
+        return false;
+    robot->queue[head] = *segment;
+    // Publish the segment before the consumer can see the new head
+    __mem_fence_release();
+    robot->queue_head = next;
+    robot->segments_queued++;
+    return true;
+}
+
+/**
+ * Get the number of segments that can still be queued.
+ * 
+ * @robot: Robotic arm to check
+ */
+uint8_t robotic_arm_queue_room(robotic_arm* robot) {
+    uint8_t used = (robot->queue_head + ROBOTIC_ARM_QUEUE_SIZE - robot->queue_tail) % ROBOTIC_ARM_QUEUE_SIZE;
+    return ROBOTIC_ARM_QUEUE_SIZE - 1 - used;
+}
+
+/**
+ * Queue all segments of a sequence to be moved in background.
+ * Queues nothing unless the whole sequence fits in the queue.
+ * 
+ * @robot: Robotic arm to move
+ * @sequence: Sequence to queue
+ * 
+ * Return false if the queue has not enough room for the sequence.
+ */
+bool robotic_arm_play_sequence(robotic_arm* robot, const robotic_arm_sequence* sequence) {
+    // Only the producer moves head, so the room can only grow while queuing
+    if(sequence->length > robotic_arm_queue_room(robot))
+        return false;
+    for(uint8_t i = 0; i < sequence->length; i++)
+        robotic_arm_queue_segment(robot, &sequence->segments[i]);
+    return true;
+}
+
+/**
+ * Smoothly move multiple robotic arm servos to angles in background.
+ * Returns immediately, segments queued before are moved first.
+ * 
+ * @robot: Robotic arm to move
+ * @signal: Control signal, copied into the queue
+ * @hold_ms: Time to stay still after servos reached target angles
+ * 
+ * Return false if signal is invalid or the queue is full.
+ */
+bool robotic_arm_move_async(robotic_arm* robot, robotic_arm_signal* signal, uint16_t hold_ms) {
+    robotic_arm_segment segment;
+    if(!robotic_arm_segment_from_signal(robot, &segment, signal))
+        return false;
+    segment.hold_ms = hold_ms;
+    return robotic_arm_queue_segment(robot, &segment);
+}
+
+/**
+ * Smoothly move multiple robotic arm servos to angles in background by DMA.
+ * Like robotic_arm_move_async(), but every step is loaded into the PWM slices by DMA
+ * at the PWM wrap, so the motion timer only checks when the move is over.
+ * 
+ * @robot: Robotic arm to move
+ * @signal: Control signal, copied into the queue
+ * @hold_ms: Time to stay still after servos reached target angles
+ * 
+ * Return false if signal is invalid or the queue is full.
+ */
+bool robotic_arm_move_dma(robotic_arm* robot, robotic_arm_signal* signal, uint16_t hold_ms) {
+    robotic_arm_segment segment;
+    if(!robotic_arm_segment_from_signal(robot, &segment, signal))
+        return false;
+    segment.hold_ms = hold_ms;
+    segment.flags = ROBOTIC_ARM_SEGMENT_DMA;
+    return robotic_arm_queue_segment(robot, &segment);
+}
+
+/**
+ * Move robotic arm servos in background along one continuous path through waypoints.
+ * Servos keep moving through intermediate waypoints unless told to stop there,
+ * and always stop at the last waypoint. Queues nothing unless the whole path fits.
+ * 
+ * @robot: Robotic arm to move
+ * @waypoints: Control signals to pass in order
+ * @must_stop: Whether to stop at each waypoint, NULL to stop only at the last one
+ * @count: Number of waypoints
+ * 
+ * Return false if a waypoint is invalid or the queue has not enough room.
+ */
+bool robotic_arm_move_path(robotic_arm* robot, robotic_arm_signal* waypoints, const bool* must_stop, uint8_t count) {
+    robotic_arm_segment segment;
+    for(uint8_t i = 0; i < count; i++) {
+        if(!robotic_arm_segment_from_signal(robot, &segment, &waypoints[i]))
+            return false;
+    }
+    if(count > robotic_arm_queue_room(robot))
+        return false;
+    for(uint8_t i = 0; i < count; i++) {
+        robotic_arm_segment_from_signal(robot, &segment, &waypoints[i]);
+        if(i + 1 < count && !(must_stop && must_stop[i]))
+            segment.flags = ROBOTIC_ARM_SEGMENT_VIA;
+        robotic_arm_queue_segment(robot, &segment);
+    }
+    return true;
+}
+
+/**
+ * Check whether a robotic arm finished all queued motions.
+ * 
+ * @robot: Robotic arm to check
+ */
+bool robotic_arm_is_idle(robotic_arm* robot) {
+    // Read tail before busy, the executor sets busy before it frees a slot
+    uint8_t tail = robot->queue_tail;
+    __mem_fence_acquire();
+    return tail == robot->queue_head && !robot->busy;
+}
+
+/**
+ * Block until a robotic arm finished all queued motions, feeding the watchdog and writing
+ * taught frames to flash meanwhile. Call from the core that queues segments.
+ * 
+ * @robot: Robotic arm to wait
+ */
+void robotic_arm_wait(robotic_arm* robot) {
+    while(!robotic_arm_is_idle(robot)) {
+        // Long replays are not a hang, keep the watchdog from resetting the board
+        watchdog_update();
+        // A long jog while recording would otherwise fill every page buffer and end the recording
+        arm_teach_poll();
+        tight_loop_contents();
+    }
+}
+
+/**
+ * Change the target of a queued segment, or of the segment being moved without stopping:
+ * servos turn towards the new target from their current angles and velocities.
+ * Segment ids count from 0 in queueing order, a segment gets the value segments_queued had
+ * before it was queued. Call from the core that queues segments, waits up to one motion tick.
+ * 
+ * @robot: Robotic arm
+ * @segment_id: Id of the segment to change
+ * @segment: New segment, its flags and hold replace the old ones
+ * 
+ * Return false if the segment already finished, is played by DMA or the new segment is invalid.
+ */
+bool robotic_arm_retarget(robotic_arm* robot, uint32_t segment_id, const robotic_arm_segment* segment) {
+    if(segment->number > robot->number || segment->number > SERVO_MOTION_MAX_SERVOS) {
+        fprintf(stderr, "Too many servos specified in segment.\n");
+        return false;
+    }
+    for(uint8_t i = 0; i < segment->number; i++) {
+        if(segment->indexes[i] >= robot->number) {
+            fprintf(stderr, "Index out of range.\n");
+            return false;
+        }
+    }
+    robot->request_segment = segment_id;
+    robot->request_data = *segment;
+    return robotic_arm_post_request(robot, ROBOTIC_ARM_REQUEST_RETARGET);
+}
+
+/**
+ * Drop a segment and every segment queued after it. If the segment being moved is dropped,
+ * servos decelerate to a smooth stop instead of finishing it, unless it is played by DMA.
+ * Segments ids continue from the first dropped id. Call from the core that queues segments,
+ * waits up to one motion tick.
+ * 
+ * @robot: Robotic arm
+ * @segment_id: Id of the first segment to drop, see robotic_arm_retarget()
+ */
+void robotic_arm_cancel(robotic_arm* robot, uint32_t segment_id) {
+    robot->request_segment = segment_id;
+    robotic_arm_post_request(robot, ROBOTIC_ARM_REQUEST_CANCEL);
+}
+
+/**
+ * Advance queued motions of a robotic arm by one step.
+ * Called by the scheduler for every started arm, on the motion timer started in
+ * robotic_arm_start() or on core 1 after robotic_arm_start_core1().
+ * 
+ * @robot: Robotic arm to advance
+ */
+void robotic_arm_tick(robotic_arm* robot) {
+    uint32_t now = time_us_32();
+    robotic_arm_apply_request(robot);
+    arm_teach_sample(robot);
+    arm_boot_save_pose(robot);
+    if(robot->busy) {
+        arm_stats_record_jitter(now - robot->last_tick_us, robot->period);
+        robot->last_tick_us = now;
+        // DMA writes the levels without the CPU, record them so the PWM trace has no gap
+        if(robot->dma_ready)
+            servos_dma_trace(&robot->dma);
+        if(robot->dma_ready && servos_dma_is_busy(&robot->dma))
+            return;
+        if(robot->motion.step < robot->motion.steps) {
+            servos_motion_step_at(&robot->motion, now);
+            return;
+        }
+        if(robot->replaying) {
+            if(arm_teach_replay_step(robot))
+                return;
+            robot->replaying = false;
+        }
+        if(robot->hold_ticks > 0) {
+            robot->hold_ticks--;
+            return;
+        }
+        arm_stats_record(ARM_STATS_SEGMENT, now - robot->segment_start_us);
+        robot->segments_done++;
+        robot->busy = false;
+    }
+    uint8_t tail = robot->queue_tail;
+    if(tail == robot->queue_head)
+        return;
+    // Read the segment only after its head update was observed
+    __mem_fence_acquire();
+    robotic_arm_segment* segment = &robot->queue[tail];
+    servo* action_servos[SERVO_MOTION_MAX_SERVOS];
+    SERVOS_PICK(action_servos, robot->servos, segment->indexes, segment->number);
+    servos_motion_start(&robot->motion, segment->number, action_servos, segment->angles);
+    if(segment->number == 0)
+        robot->motion.steps = 0;
+    robot->hold_ticks = (uint32_t)segment->hold_ms * 1000 / robot->period;
+    robot->replaying = (segment->flags & ROBOTIC_ARM_SEGMENT_REPLAY) != 0;
+    // Blend into the next segment only if it is already queued, otherwise stop as usual
+    uint8_t next_tail = (tail + 1) % ROBOTIC_ARM_QUEUE_SIZE;
+    if((segment->flags & ROBOTIC_ARM_SEGMENT_VIA) && segment->number > 0 && next_tail != robot->queue_head) {
+        __mem_fence_acquire();
+        float velocities[SERVO_MOTION_MAX_SERVOS];
+        robotic_arm_blend_velocities(robot, segment, &robot->queue[next_tail], velocities);
+        servos_motion_blend(&robot->motion, velocities);
+        robot->hold_ticks = 0;
+    }
+    // Steps played by DMA are already done as far as the timer is concerned. A playback holds the
+    // other channel of its slices still, so an arm sharing a slice with another arm steps by timer
+    if((segment->flags & ROBOTIC_ARM_SEGMENT_DMA) && robot->dma_ready && robot->motion.steps > 1
+       && !robotic_arm_shares_slices(robot) && servos_dma_play(&robot->dma, &robot->motion))
+        robot->motion.step = robot->motion.steps;
+    robot->segment_start_us = now;
+    robot->last_tick_us = now;
+    robot->segments_started++;
+    arm_trace_set_segment(robot->segments_started);
+    // Mark busy before freeing the slot so the arm never looks idle in between
+    robot->busy = true;
+    __mem_fence_release();
+    robot->queue_tail = (tail + 1) % ROBOTIC_ARM_QUEUE_SIZE;
+    servos_motion_step_at(&robot->motion, now);
 }
 
 /**
@@ -152,35 +854,62 @@ void robotic_arm_print(robotic_arm* robot) {
 }
 
 /**
- * Free memory malloced by robotic_arm_create().
+ * Remove a robotic arm from the scheduler, release its DMA channels and pins.
+ * The motion timer stops with the last arm.
  * 
- * @robot: Robotic arm to free
+ * @robot: Robotic arm to stop, must not be ticked by core 1
  */
-void robotic_arm_free(robotic_arm* robot) {
-    free(robot->servos);
-    free(robot);
+void robotic_arm_deinit(robotic_arm* robot) {
+    if(robot->core1_started) {
+        fprintf(stderr, "Robotic arms on core 1 cannot be stopped.\n");
+        return;
+    }
+    if(robot->scheduled) {
+        // The timer interrupt must not tick the arm list while it shrinks
+        uint32_t status = save_and_disable_interrupts();
+        uint8_t count = 0;
+        for(uint8_t i = 0; i < scheduler_count; i++) {
+            if(scheduler_arms[i] != robot)
+                scheduler_arms[count++] = scheduler_arms[i];
+        }
+        scheduler_count = count;
+        restore_interrupts(status);
+        robot->scheduled = false;
+        if(scheduler_count == 0 && scheduler_timer_started) {
+            cancel_repeating_timer(&scheduler_timer);
+            scheduler_timer_started = false;
+        }
+    }
+    if(robot->dma_ready)
+        servos_dma_release(&robot->dma);
+    robot->dma_ready = false;
+    for(uint8_t k = 0; k < ROBOTIC_ARM_MAX_ARMS; k++) {
+        if(robotic_arm_claimed[k] == robot)
+            robotic_arm_claimed[k] = NULL;
+    }
 }
 
 /**
  * Transfer string to robotic arm control signal.
- * Make sure signal->indexes and signal->angles are allocated before calling this.
+ * Make sure signal->indexes and signal->angles can hold SERVO_MOTION_MAX_SERVOS entries.
  * 
  * @signal: Robotic arm control signal to set
  * @str: String to transfer, format is "number index angle index angle ..."
  */
 void robotic_arm_signal_from_string(robotic_arm_signal* signal, char* str) {
     char* endptr;
-    signal->number = strtol(str, &endptr, 10);
+    long number = strtol(str, &endptr, 10);
+    signal->number = 0;
     if (endptr == str || *endptr != ' ') {
         fprintf(stderr, "Invalid signal string format.\n");
         return;
     }
     str = endptr + 1; // Move to the next part of the string
-    if (signal->number <= 0) {
+    if (number <= 0 || number > SERVO_MOTION_MAX_SERVOS) {
         fprintf(stderr, "Invalid number in signal string.\n");
         return;
     }
-    for(int i = 0; i < signal->number; i++) {
+    for(int i = 0; i < number; i++) {
         signal->indexes[i] = strtol(str, &endptr, 10);
         if (endptr == str || *endptr != ' ') {
             fprintf(stderr, "Invalid index in signal string.\n");
@@ -192,8 +921,13 @@ void robotic_arm_signal_from_string(robotic_arm_signal* signal, char* str) {
             fprintf(stderr, "Invalid angle in signal string.\n");
             return;
         }
+        if (*endptr == '\0' && i + 1 < number) {
+            fprintf(stderr, "Signal string ended early.\n");
+            return;
+        }
         str = endptr + 1; // Move to the next part of the string
     }
+    signal->number = number;
 }
 
 /**
@@ -204,8 +938,8 @@ void robotic_arm_signal_from_string(robotic_arm_signal* signal, char* str) {
  */
 void robotic_arm_move_by_string(robotic_arm* robot, char* str) {
     robotic_arm_signal signal;
-    uint8_t servo_indexes[robot->number];
-    float angles[robot->number];
+    uint8_t servo_indexes[SERVO_MOTION_MAX_SERVOS];
+    float angles[SERVO_MOTION_MAX_SERVOS];
     signal.indexes = servo_indexes;
     signal.angles = angles;
     robotic_arm_signal_from_string(&signal, str);
@@ -223,6 +957,12 @@ void robotic_arm_move_by_string(robotic_arm* robot, char* str) {
         fprintf(stderr, "Too many servos specified in signal.\n");
         return;
     }
+    for (int i = 0; i < signal.number; i++) {
+        if (signal.indexes[i] >= robot->number) {
+            fprintf(stderr, "Index out of range.\n");
+            return;
+        }
+    }
     if (signal.number == 1) {
         // If only one servo is specified, move it directly
         robotic_arm_move_servo(robot, signal.indexes[0], signal.angles[0]);
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "hardware/structs/systick.h"
+#include "servo_benchmark.h"
+
+
+// SysTick counts processor cycles down from this value
+#define SYSTICK_RELOAD 0x00FFFFFF
+
+// Start SysTick on the processor clock, the Cortex-M0+ has no cycle counter
+static void systick_start(void) {
+    systick_hw->csr = 0;
+    systick_hw->rvr = SYSTICK_RELOAD;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;
+}
+
+// Cycles since start, a single measurement must stay below 2^24 cycles
+static uint32_t systick_elapsed(uint32_t start) {
+    return (start - systick_hw->cvr) & SYSTICK_RELOAD;
+}
+
+// Run every step of a motion through both kernels, print cycles per step and worst level difference
+static void servos_motion_benchmark_case(const char* name, servos_motion* motion) {
+    uint16_t float_levels[SERVO_MOTION_MAX_SERVOS];
+    uint16_t fixed_levels[SERVO_MOTION_MAX_SERVOS];
+    uint32_t float_cycles = 0;
+    uint32_t fixed_cycles = 0;
+    int max_difference = 0;
+    for(uint step = 1; step < motion->steps; step++) {
+        uint32_t start = systick_hw->cvr;
+        servos_motion_levels_float(motion, step, NULL, float_levels);
+        float_cycles += systick_elapsed(start);
+        start = systick_hw->cvr;
+        servos_motion_levels_fixed(motion, step, fixed_levels);
+        fixed_cycles += systick_elapsed(start);
+        for(uint i = 0; i < motion->number; i++) {
+            int difference = abs((int)float_levels[i] - (int)fixed_levels[i]);
+            if(difference > max_difference)
+                max_difference = difference;
+        }
+    }
+    uint steps = motion->steps > 1 ? motion->steps - 1 : 1;
+    printf("%-10s %4u steps: float %6lu cycles/step, fixed %6lu cycles/step, max difference %d levels\n",
+           name, motion->steps, (unsigned long)(float_cycles / steps), (unsigned long)(fixed_cycles / steps), max_difference);
+}
+
+/**
+ * Measure CPU cycles per step of the float and fixed-point motion kernels and print them.
+ * Only calculates PWM levels, servos do not move.
+ * 
+ * @number: Number of servos to benchmark with
+ * @motors: Servos to benchmark with, at their current angles
+ */
+void servos_motion_benchmark(uint number, servo** motors) {
+    if(number > SERVO_MOTION_MAX_SERVOS)
+        number = SERVO_MOTION_MAX_SERVOS;
+    // Swing every servo to the far side of its range
+    float angles[SERVO_MOTION_MAX_SERVOS];
+    float velocities[SERVO_MOTION_MAX_SERVOS];
+    for(uint i = 0; i < number; i++) {
+        float middle = (motors[i]->angle_lower_bound + motors[i]->angle_upper_bound) / 2;
+        angles[i] = motors[i]->angle < middle ? motors[i]->angle_upper_bound : motors[i]->angle_lower_bound;
+        velocities[i] = angles[i] > motors[i]->angle ? motors[i]->max_velocity / 2 : -motors[i]->max_velocity / 2;
+    }
+    systick_start();
+    servos_motion motion;
+    servos_motion_start(&motion, number, motors, angles);
+    servos_motion_benchmark_case(motion.profile == SERVO_PROFILE_COSINE ? "cosine" : "profile", &motion);
+    motion.profile = SERVO_PROFILE_COSINE;
+    servos_motion_benchmark_case("cosine", &motion);
+    servos_motion_start(&motion, number, motors, angles);
+    servos_motion_blend(&motion, velocities);
+    servos_motion_benchmark_case("blended", &motion);
+    printf("Kernel in use: %s\n", SERVO_FIXED_POINT ? "fixed-point" : "float");
+}
@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "hardware/pwm.h"
+#include "hardware/sync.h"
 #include "servo_control.h"
+#include "arm_stats.h"
+#include "arm_trace.h"
 #include <math.h>
 
 
@@ -22,6 +25,214 @@ float calculate_smooth_ratio(float ratio_of_steps) {
     return 0.5 - cosf(M_PI * ratio_of_steps) / 2;
 }
 
+/**
+ * Acceleration needed by a profile, as a multiple of distance / (duration^2 * f * (1 - f)).
+ * Trapezoid accelerates constantly, S-curve ramps acceleration as sin^2 so its peak is doubled.
+ * 
+ * @profile: SERVO_PROFILE_TRAPEZOID or SERVO_PROFILE_SCURVE
+ */
+float calculate_profile_acceleration_factor(uint8_t profile) {
+    return profile == SERVO_PROFILE_SCURVE ? 2.0f : 1.0f;
+}
+
+/**
+ * Calculate the minimum time (s) to move a distance under velocity and acceleration limits.
+ * 
+ * @profile: SERVO_PROFILE_TRAPEZOID or SERVO_PROFILE_SCURVE
+ * @distance: Absolute distance (degrees)
+ * @max_velocity: Velocity limit (degrees/s)
+ * @max_acceleration: Acceleration limit (degrees/s^2)
+ * @accel_fraction: Output, fraction of the time spent accelerating
+ */
+float calculate_profile_time(uint8_t profile, float distance, float max_velocity, float max_acceleration, float* accel_fraction) {
+    float factor = calculate_profile_acceleration_factor(profile);
+    // Time and distance to reach max velocity
+    float accel_time = factor * max_velocity / max_acceleration;
+    float accel_distance = max_velocity * accel_time / 2;
+    if(distance <= 0) {
+        *accel_fraction = 0.5f;
+        return 0;
+    }
+    if(distance >= 2 * accel_distance) {
+        float time = distance / max_velocity + accel_time;
+        *accel_fraction = accel_time / time;
+        return time;
+    }
+    // Max velocity is never reached, accelerate half the way and decelerate the rest
+    *accel_fraction = 0.5f;
+    return 2 * sqrtf(factor * distance / max_acceleration);
+}
+
+/**
+ * Calculate the position ratio of a profile at a ratio of its duration.
+ * 
+ * @profile: SERVO_PROFILE_TRAPEZOID or SERVO_PROFILE_SCURVE
+ * @accel_fraction: Fraction of the time spent accelerating (0 to 0.5)
+ * @ratio_of_time: Ratio of elapsed and total time (0 to 1)
+ */
+float calculate_profile_ratio(uint8_t profile, float accel_fraction, float ratio_of_time) {
+    // Profiles are symmetric, decelerating mirrors accelerating
+    if(ratio_of_time > 0.5f)
+        return 1 - calculate_profile_ratio(profile, accel_fraction, 1 - ratio_of_time);
+    // Cruise velocity as a ratio of distance over total time
+    float cruise_velocity = 1 / (1 - accel_fraction);
+    if(ratio_of_time >= accel_fraction)
+        return cruise_velocity * (ratio_of_time - accel_fraction / 2);
+    float phase = ratio_of_time / accel_fraction;
+    if(profile == SERVO_PROFILE_SCURVE)
+        return cruise_velocity * accel_fraction * (phase * phase / 2 + (cosf(2 * M_PI * phase) - 1) / (4 * M_PI * M_PI));
+    return cruise_velocity * accel_fraction * phase * phase / 2;
+}
+
+// 0.5 - cos(pi * x) / 2 at x = i / SERVO_EASING_TABLE_SIZE, Q15
+static const uint16_t easing_cosine_q15[SERVO_EASING_TABLE_SIZE + 1] = {
+        0,     1,     5,    11,    20,    31,    44,    60,    79,   100,   123,   149,
+      177,   208,   241,   277,   315,   355,   398,   443,   491,   541,   593,   648,
+      705,   765,   827,   891,   958,  1027,  1098,  1171,  1247,  1325,  1406,  1488,
+     1573,  1660,  1749,  1841,  1935,  2030,  2128,  2229,  2331,  2435,  2542,  2651,
+     2761,  2874,  2989,  3105,  3224,  3345,  3468,  3592,  3719,  3847,  3978,  4110,
+     4244,  4380,  4518,  4657,  4799,  4942,  5087,  5233,  5381,  5531,  5682,  5835,
+     5990,  6146,  6304,  6463,  6624,  6786,  6950,  7115,  7282,  7449,  7619,  7789,
+     7961,  8134,  8308,  8484,  8661,  8839,  9018,  9198,  9379,  9561,  9745,  9929,
+    10114, 10300, 10487, 10676, 10864, 11054, 11245, 11436, 11628, 11821, 12014, 12208,
+    12403, 12598, 12794, 12991, 13188, 13385, 13583, 13781, 13980, 14179, 14378, 14578,
+    14778, 14978, 15179, 15379, 15580, 15781, 15982, 16183, 16384, 16585, 16786, 16987,
+    17188, 17389, 17589, 17790, 17990, 18190, 18390, 18589, 18788, 18987, 19185, 19383,
+    19580, 19777, 19974, 20170, 20365, 20560, 20754, 20947, 21140, 21332, 21523, 21714,
+    21904, 22092, 22281, 22468, 22654, 22839, 23023, 23207, 23389, 23570, 23750, 23929,
+    24107, 24284, 24460, 24634, 24807, 24979, 25149, 25319, 25486, 25653, 25818, 25982,
+    26144, 26305, 26464, 26622, 26778, 26933, 27086, 27237, 27387, 27535, 27681, 27826,
+    27969, 28111, 28250, 28388, 28524, 28658, 28790, 28921, 29049, 29176, 29300, 29423,
+    29544, 29663, 29779, 29894, 30007, 30117, 30226, 30333, 30437, 30539, 30640, 30738,
+    30833, 30927, 31019, 31108, 31195, 31280, 31362, 31443, 31521, 31597, 31670, 31741,
+    31810, 31877, 31941, 32003, 32063, 32120, 32175, 32227, 32277, 32325, 32370, 32413,
+    32453, 32491, 32527, 32560, 32591, 32619, 32645, 32668, 32689, 32708, 32724, 32737,
+    32748, 32757, 32763, 32767, 32768
+};
+
+// S-curve acceleration phase x^2 + (cos(2 * pi * x) - 1) / (2 * pi^2) at x = i / SERVO_EASING_TABLE_SIZE, Q15
+static const uint16_t easing_scurve_q15[SERVO_EASING_TABLE_SIZE + 1] = {
+        0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
+        1,     1,     1,     1,     2,     2,     3,     3,     4,     5,     6,     7,
+        8,    10,    11,    13,    15,    17,    20,    23,    26,    29,    33,    37,
+       41,    46,    51,    56,    62,    69,    75,    83,    90,    99,   108,   117,
+      127,   138,   149,   161,   174,   187,   201,   216,   232,   248,   266,   284,
+      303,   323,   343,   365,   388,   412,   436,   462,   489,   517,   546,   577,
+      608,   641,   675,   710,   746,   784,   823,   863,   905,   948,   992,  1038,
+     1085,  1134,  1185,  1236,  1290,  1345,  1401,  1459,  1519,  1580,  1643,  1708,
+     1774,  1842,  1912,  1983,  2057,  2132,  2209,  2287,  2368,  2450,  2534,  2620,
+     2708,  2798,  2889,  2983,  3078,  3176,  3275,  3376,  3479,  3585,  3692,  3801,
+     3912,  4025,  4140,  4257,  4376,  4497,  4620,  4745,  4872,  5001,  5132,  5265,
+     5400,  5537,  5676,  5817,  5960,  6105,  6252,  6401,  6551,  6704,  6859,  7016,
+     7174,  7335,  7497,  7662,  7828,  7996,  8166,  8338,  8512,  8687,  8865,  9044,
+     9225,  9407,  9592,  9778,  9966, 10156, 10347, 10540, 10735, 10931, 11129, 11329,
+    11530, 11732, 11937, 12142, 12349, 12558, 12768, 12980, 13193, 13407, 13623, 13840,
+    14058, 14278, 14499, 14721, 14944, 15169, 15394, 15621, 15849, 16078, 16308, 16540,
+    16772, 17005, 17239, 17475, 17711, 17948, 18186, 18424, 18664, 18904, 19145, 19387,
+    19630, 19873, 20117, 20362, 20607, 20853, 21100, 21347, 21594, 21843, 22091, 22341,
+    22590, 22840, 23091, 23342, 23593, 23845, 24097, 24349, 24602, 24855, 25108, 25361,
+    25615, 25869, 26123, 26378, 26632, 26887, 27142, 27397, 27652, 27907, 28163, 28418,
+    28674, 28929, 29185, 29441, 29697, 29952, 30208, 30464, 30720, 30976, 31232, 31488,
+    31744, 32000, 32256, 32512, 32768
+};
+
+/**
+ * Look up a Q15 easing table with linear interpolation.
+ * 
+ * @table: Table with SERVO_EASING_TABLE_SIZE + 1 entries
+ * @ratio_q15: Position in the table (0 to 32768)
+ */
+int32_t calculate_table_ratio_q15(const uint16_t* table, int32_t ratio_q15) {
+    int32_t index = ratio_q15 >> 7;
+    if(index >= SERVO_EASING_TABLE_SIZE)
+        return table[SERVO_EASING_TABLE_SIZE];
+    int32_t fraction = ratio_q15 & 0x7F;
+    return table[index] + (((table[index + 1] - table[index]) * fraction) >> 7);
+}
+
+/**
+ * Integer version of calculate_profile_ratio(), also covers the cosine profile.
+ * 
+ * @motion: Motion with profile, accel_fraction_q15 and cruise_velocity_q14 set
+ * @ratio_q15: Ratio of elapsed and total time in Q15
+ */
+int32_t calculate_profile_ratio_q15(const servos_motion* motion, int32_t ratio_q15) {
+    if(motion->profile == SERVO_PROFILE_COSINE)
+        return calculate_table_ratio_q15(easing_cosine_q15, ratio_q15);
+    // Profiles are symmetric, decelerating mirrors accelerating
+    if(ratio_q15 > (1 << 14))
+        return (1 << 15) - calculate_profile_ratio_q15(motion, (1 << 15) - ratio_q15);
+    int32_t f = motion->accel_fraction_q15;
+    if(ratio_q15 >= f)
+        return (motion->cruise_velocity_q14 * (ratio_q15 - f / 2)) >> 14;
+    int32_t phase = (ratio_q15 << 15) / f;
+    // Twice the distance ratio covered by the end of the acceleration phase
+    int32_t shape;
+    if(motion->profile == SERVO_PROFILE_SCURVE)
+        shape = calculate_table_ratio_q15(easing_scurve_q15, phase);
+    else
+        shape = (phase * phase) >> 15;
+    return ((((motion->cruise_velocity_q14 * f) >> 14) * shape) >> 16);
+}
+
+/**
+ * Calculate the number of steps a servo needs to smoothly move by an angle.
+ * 
+ * @motor: Servo to move
+ * @angle_difference: Angle to move by in degrees
+ */
+uint servo_calculate_steps(servo* motor, float angle_difference) {
+    if(motor->max_velocity <= 0 || motor->max_acceleration <= 0)
+        return calculate_steps(angle_difference / motor->angle_range, motor->period);
+    float accel_fraction;
+    float time = calculate_profile_time(SERVO_MOTION_PROFILE, fabsf(angle_difference),
+                                        motor->max_velocity, motor->max_acceleration, &accel_fraction);
+    return (uint)ceilf(time * 1e6f / motor->period);
+}
+
+/**
+ * Precompute PWM slice, channel and integer angle to level conversion of a servo.
+ * Called by servo_init() and servos_init(), call again after changing pin or datasheet.
+ * 
+ * @motor: Servo to calibrate
+ */
+void servo_calibrate(servo* motor) {
+    motor->slice = pwm_gpio_to_slice_num(motor->pin);
+    motor->channel = pwm_gpio_to_channel(motor->pin);
+    // level = duty / period * wrap, duty = angle / angle_range * (max_duty - min_duty) + min_duty
+    float levels_per_us = (float)SERVO_PWM_WRAP / motor->period;
+    motor->level_offset = (int32_t)lroundf(motor->min_duty * levels_per_us * 1024);
+    motor->level_slope = (int32_t)lroundf((motor->max_duty - motor->min_duty) / motor->angle_range * levels_per_us * 1024);
+}
+
+/**
+ * Convert an angle to the PWM level of a servo, clamped to its angle limits.
+ * Make sure the servo is calibrated before calling this.
+ * 
+ * @motor: Servo to convert for
+ * @angle: Angle in degrees
+ */
+uint16_t servo_angle_to_level(servo* motor, float angle) {
+    if(angle < motor->angle_lower_bound)
+        angle = motor->angle_lower_bound;
+    else if(angle > motor->angle_upper_bound)
+        angle = motor->angle_upper_bound;
+    // Angle in Q8, one float multiply and the rest in integer
+    int32_t angle_q8 = (int32_t)(angle * 256.0f);
+    return (motor->level_offset + ((angle_q8 * motor->level_slope) >> 8)) >> 10;
+}
+
+/**
+ * Convert a PWM level of a servo back to an angle, the middle of the angles that map to it.
+ * Make sure the servo is calibrated before calling this.
+ * 
+ * @motor: Servo to convert for
+ * @level: PWM level
+ */
+float servo_level_to_angle(servo* motor, uint16_t level) {
+    return (float)(((int32_t)level << 10) + (1 << 9) - motor->level_offset) / motor->level_slope;
+}
+
 /**
  * Initialize a single servo motor.
  * Make sure all fields in motor are correctly set before calling this.
@@ -29,8 +240,9 @@ float calculate_smooth_ratio(float ratio_of_steps) {
  * @motor: Servo to initialize
  */
 void servo_init(servo* motor) {
+    servo_calibrate(motor);
     gpio_set_function(motor->pin, GPIO_FUNC_PWM);
-    uint slice_num = pwm_gpio_to_slice_num(motor->pin);
+    uint slice_num = motor->slice;
     // 1e6 for convert period (us) to frequency (Hz)
     float clock_devider = (float)SYSTEM_CLOCK / ((float)1e6 / motor->period) / SERVO_PWM_WRAP;
     pwm_set_clkdiv(slice_num, clock_devider);
@@ -65,6 +277,18 @@ void servo_set_datasheet(servo* motor, float angle_range, uint period, uint min_
     motor->max_duty = max_duty;
 }
 
+/**
+ * Set velocity and acceleration limits of a servo, 0 for the fixed legacy timing.
+ * 
+ * @motor: Servo to set
+ * @max_velocity: Velocity limit under load (degrees/s)
+ * @max_acceleration: Acceleration limit under load (degrees/s^2)
+ */
+void servo_set_dynamics(servo* motor, float max_velocity, float max_acceleration) {
+    motor->max_velocity = max_velocity;
+    motor->max_acceleration = max_acceleration;
+}
+
 /**
  * Set limits for servo angles.
  * 
@@ -84,13 +308,23 @@ void servo_set_limits(servo* motor, float angle_lower_bound, float angle_upper_b
  * @angle: Target angle in degrees
  */
 void servo_set_angle(servo* motor, float angle) {
+    servo_stage_angle(motor, angle);
+    pwm_set_chan_level(motor->slice, motor->channel, motor->level);
+    arm_trace_record(motor->slice * 2 + motor->channel, motor->level);
+}
+
+/**
+ * Set the angle of a servo without writing its PWM level, see servos_commit().
+ * 
+ * @motor: Servo to set angle
+ * @angle: Target angle in degrees
+ */
+void servo_stage_angle(servo* motor, float angle) {
     if(angle < motor->angle_lower_bound)
         angle = motor->angle_lower_bound;
     else if(angle > motor->angle_upper_bound)
         angle = motor->angle_upper_bound;
-    float duty = (motor->angle / motor->angle_range) * (motor->max_duty - motor->min_duty) + motor->min_duty;
-    uint16_t level = duty / motor->period * SERVO_PWM_WRAP;
-    pwm_set_gpio_level(motor->pin, level);
+    motor->level = servo_angle_to_level(motor, angle);
     motor->angle = angle;
 }
 
@@ -101,18 +335,30 @@ void servo_set_angle(servo* motor, float angle) {
  * @angle: Target angle in degrees
  */
 void servo_smooth(servo* motor, float angle) {
-    float start_angle = motor->angle;
-    float angle_difference = angle - motor->angle;
-    uint steps = calculate_steps(angle_difference / motor->angle_range, motor->period);
-    for(uint step = 1; step < steps; step++) {
-        // Calculate the smooth transition ratio using a cosine function for easing effect
-        float ratio = calculate_smooth_ratio((float)step / steps);
-        float delta = angle_difference * ratio;
-        servo_set_angle(motor, start_angle + delta);
-        sleep_us(motor->period);
+    servos_smooth(1, &motor, &angle);
+}
+
+// Configure the slices of servos at their PWM period and enable them in phase,
+// outputs at the current angles if drive is set, otherwise without pulses
+static void servos_setup_slices(uint number, servo** motors, bool drive) {
+    uint32_t slice_mask = 0;
+    for(uint i = 0; i < number; i++) {
+        servo_calibrate(motors[i]);
+        gpio_set_function(motors[i]->pin, GPIO_FUNC_PWM);
+        uint slice_num = motors[i]->slice;
+        // 1e6 for convert period (us) to frequency (Hz)
+        float clock_devider = (float)SYSTEM_CLOCK / ((float)1e6 / motors[i]->period) / SERVO_PWM_WRAP;
+        pwm_set_clkdiv(slice_num, clock_devider);
+        pwm_set_wrap(slice_num, SERVO_PWM_WRAP - 1);
+        pwm_set_counter(slice_num, 0);
+        if(drive)
+            servo_set_angle(motors[i], motors[i]->angle);
+        else
+            pwm_set_chan_level(slice_num, motors[i]->channel, 0);
+        slice_mask |= 1u << slice_num;
     }
-    servo_set_angle(motor, angle);
-    motor->angle = angle;
+    // Enable all slices with one register write so their counters wrap together
+    hw_set_bits(&pwm_hw->en, slice_mask);
 }
 
 /**
@@ -123,18 +369,26 @@ void servo_smooth(servo* motor, float angle) {
  * @motors: Servos to initialize
  */
 void servos_init(uint number, servo** motors) {
+    servos_setup_slices(number, motors, true);
+}
+
+/**
+ * Initialize multiple servo motors one after another to limit the inrush current.
+ * Every output starts without pulses, so servos stay limp until their turn. Then each servo
+ * is driven at its park angle, given stagger_ms to settle and moved smoothly to its angle.
+ * 
+ * @number: Number of servos to initialize
+ * @motors: Servos to initialize, angle is where each servo ends up
+ * @park_angles: Angles the servos are expected to rest at while unpowered
+ * @stagger_ms: Time between driving one servo and moving it (ms)
+ */
+void servos_soft_start(uint number, servo** motors, const float* park_angles, uint stagger_ms) {
+    servos_setup_slices(number, motors, false);
     for(uint i = 0; i < number; i++) {
-        gpio_set_function(motors[i]->pin, GPIO_FUNC_PWM);
-        uint slice_num = pwm_gpio_to_slice_num(motors[i]->pin);
-        // 1e6 for convert period (us) to frequency (Hz)
-        float clock_devider = (float)SYSTEM_CLOCK / ((float)1e6 / motors[i]->period) / SERVO_PWM_WRAP;
-        pwm_set_clkdiv(slice_num, clock_devider);
-        pwm_set_wrap(slice_num, SERVO_PWM_WRAP - 1);
-        servo_set_angle(motors[i], motors[i]->angle);
-    }
-    for(uint i = 0; i < number; i++) {
-        uint slice_num = pwm_gpio_to_slice_num(motors[i]->pin);
-        pwm_set_enabled(slice_num, true);
+        float angle = motors[i]->angle;
+        servo_set_angle(motors[i], park_angles[i]);
+        sleep_ms(stagger_ms);
+        servo_smooth(motors[i], angle);
     }
 }
 
@@ -147,8 +401,82 @@ void servos_init(uint number, servo** motors) {
  */
 void servos_set_angle(uint number, servo** motors, float *angles) {
     for(uint i = 0; i < number; i++) {
-        servo_set_angle(motors[i], angles[i]);
+        servo_stage_angle(motors[i], angles[i]);
+    }
+    servos_commit(number, motors);
+}
+
+// Check whether any slice in slice_mask is in the last SERVO_COMMIT_GUARD counts before its wrap
+static bool servos_slices_near_wrap(uint32_t slice_mask) {
+    for(uint slice_num = 0; slice_num < NUM_PWM_SLICES; slice_num++) {
+        if((slice_mask & (1u << slice_num)) && pwm_hw->slice[slice_num].ctr >= SERVO_PWM_WRAP - SERVO_COMMIT_GUARD)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Write staged PWM levels of multiple servos so they all take effect in the same PWM period.
+ * All compare values are written together once no slice is in the last SERVO_COMMIT_GUARD
+ * counts before its wrap, so each latches at the next wrap of its slice. Slices enabled
+ * together by servos_init() count in phase and latch at the same wrap.
+ * 
+ * @number: Number of servos to commit
+ * @motors: Servos with staged levels
+ */
+void servos_commit(uint number, servo** motors) {
+    uint8_t slices[SERVO_MOTION_MAX_SERVOS];
+    uint8_t channels[SERVO_MOTION_MAX_SERVOS];
+    uint16_t levels[SERVO_MOTION_MAX_SERVOS];
+    // Committed in chunks so any number of servos fits the local arrays
+    while(number > 0) {
+        uint count = number < SERVO_MOTION_MAX_SERVOS ? number : SERVO_MOTION_MAX_SERVOS;
+        for(uint i = 0; i < count; i++) {
+            slices[i] = motors[i]->slice;
+            channels[i] = motors[i]->channel;
+            levels[i] = motors[i]->level;
+        }
+        servos_commit_levels(count, slices, channels, levels);
+        motors += count;
+        number -= count;
+    }
+}
+
+/**
+ * Write PWM levels to slice channels so they all take effect in the same PWM period, see servos_commit().
+ * 
+ * @number: Number of levels to commit
+ * @slices: PWM slice of each level
+ * @channels: PWM channel of each level
+ * @levels: PWM levels to write
+ */
+void servos_commit_levels(uint number, const uint8_t* slices, const uint8_t* channels, const uint16_t* levels) {
+    if(number == 0)
+        return;
+    uint32_t compares[NUM_PWM_SLICES];
+    uint32_t slice_mask = 0;
+    uint32_t interrupts = save_and_disable_interrupts();
+    // Merge staged levels into one compare word per slice, other channels keep their level
+    for(uint i = 0; i < number; i++) {
+        uint slice_num = slices[i];
+        if(!(slice_mask & (1u << slice_num))) {
+            compares[slice_num] = pwm_hw->slice[slice_num].cc;
+            slice_mask |= 1u << slice_num;
+        }
+        uint shift = channels[i] ? PWM_CH0_CC_B_LSB : PWM_CH0_CC_A_LSB;
+        compares[slice_num] = (compares[slice_num] & ~(0xFFFFu << shift)) | ((uint32_t)levels[i] << shift);
+    }
+    // Let every imminent wrap pass, slices of arms started apart or sharing a slice may not
+    // count in phase, then no write misses the period of its slice
+    while(servos_slices_near_wrap(slice_mask))
+        tight_loop_contents();
+    for(uint slice_num = 0; slice_num < NUM_PWM_SLICES; slice_num++) {
+        if(slice_mask & (1u << slice_num))
+            pwm_hw->slice[slice_num].cc = compares[slice_num];
     }
+    restore_interrupts(interrupts);
+    for(uint i = 0; i < number; i++)
+        arm_trace_record(slices[i] * 2 + channels[i], levels[i]);
 }
 
 /**
@@ -159,31 +487,402 @@ void servos_set_angle(uint number, servo** motors, float *angles) {
  * @angles: Target angles in degrees
  */
 void servos_smooth(uint number, servo** motors, float *angles) {
-    float start_angles[number];
-    float angle_differences[number];
-    uint max_steps = 0;
-    uint max_period = 1;
+    servos_motion motion;
+    servos_motion_start(&motion, number, motors, angles);
+    // Sleep until absolute deadlines, so step computation and interrupts never add up to a late finish
+    absolute_time_t start = get_absolute_time();
+    uint32_t last_step = time_us_32();
+    uint32_t ticks = 0;
+    while(servos_motion_step_at(&motion, time_us_32())) {
+        ticks++;
+        sleep_until(delayed_by_us(start, (uint64_t)ticks * motion.period));
+        uint32_t now = time_us_32();
+        arm_stats_record_jitter(now - last_step, motion.period);
+        last_step = now;
+    }
+}
+
+/**
+ * Prepare a smooth motion of multiple servos without moving them.
+ * Servos start with their current velocities and stop at target angles,
+ * all arriving together in the minimum time the slowest servo allows.
+ * Call servos_motion_step_at() every motion->period us to perform it.
+ * 
+ * @motion: Motion to prepare
+ * @number: Number of servos to move, at most SERVO_MOTION_MAX_SERVOS
+ * @motors: Servos to move
+ * @angles: Target angles in degrees
+ */
+void servos_motion_start(servos_motion* motion, uint number, servo** motors, float *angles) {
+    if(number > SERVO_MOTION_MAX_SERVOS) {
+        fprintf(stderr, "Too many servos in one motion.\n");
+        number = SERVO_MOTION_MAX_SERVOS;
+    }
+    motion->number = number;
+    motion->steps = 0;
+    motion->step = 0;
+    motion->period = 1;
+    motion->start_us = 0;
+    motion->blended = false;
+    motion->profile = SERVO_MOTION_PROFILE;
+    motion->accel_fraction = 0.5f;
     // Store start angles and angle differences for each servo
-    // Determine the max steps and max period
+    // Determine the max period and whether every servo has limits
     for(uint i = 0; i < number; i++) {
-        start_angles[i] = motors[i]->angle;
-        angle_differences[i] = angles[i] - start_angles[i];
-        uint steps = calculate_steps(angle_differences[i] / motors[i]->angle_range, motors[i]->period);
-        if(steps > max_steps)
-            max_steps = steps;
-        if(motors[i]->period > max_period)
-            max_period = motors[i]->period;
-    }
-    // Perform the smooth transition in steps
-    for(uint step = 1; step < max_steps; step++) {
-        // Calculate the smooth transition ratio using a cosine function for easing effect
-        float ratio = calculate_smooth_ratio((float)step / max_steps);
-        // Set the servo angles based on the start angles and angle differences with ratio
+        motion->motors[i] = motors[i];
+        motion->start_angles[i] = motors[i]->angle;
+        motion->target_angles[i] = angles[i];
+        motion->angle_differences[i] = angles[i] - motion->start_angles[i];
+        motion->end_velocities[i] = 0;
+        motion->end_tangents[i] = 0;
+        if(motors[i]->velocity != 0)
+            motion->blended = true;
+        if(motors[i]->max_velocity <= 0 || motors[i]->max_acceleration <= 0)
+            motion->profile = SERVO_PROFILE_COSINE;
+        if(motors[i]->period > motion->period)
+            motion->period = motors[i]->period;
+    }
+    if(motion->profile == SERVO_PROFILE_COSINE) {
+        // Fixed legacy timing, the servo with the most steps decides
         for(uint i = 0; i < number; i++) {
-            float delta = angle_differences[i] * ratio;
-            servo_set_angle(motors[i], start_angles[i] + delta);
+            uint steps = servo_calculate_steps(motors[i], motion->angle_differences[i]);
+            if(steps > motion->steps)
+                motion->steps = steps;
         }
-        sleep_us(max_period);
     }
-    servos_set_angle(number, motors, angles);
-}
\ No newline at end of file
+    else {
+        // Profile shape of the slowest servo, then stretch the time until every servo respects its limits
+        float time = 0;
+        for(uint i = 0; i < number; i++) {
+            float accel_fraction;
+            float servo_time = calculate_profile_time(motion->profile, fabsf(motion->angle_differences[i]),
+                                                      motors[i]->max_velocity, motors[i]->max_acceleration, &accel_fraction);
+            if(servo_time > time) {
+                time = servo_time;
+                motion->accel_fraction = accel_fraction;
+            }
+        }
+        float f = motion->accel_fraction;
+        float factor = calculate_profile_acceleration_factor(motion->profile);
+        for(uint i = 0; i < number; i++) {
+            float distance = fabsf(motion->angle_differences[i]);
+            float velocity_time = distance / (motors[i]->max_velocity * (1 - f));
+            float acceleration_time = sqrtf(factor * distance / (motors[i]->max_acceleration * f * (1 - f)));
+            if(velocity_time > time)
+                time = velocity_time;
+            if(acceleration_time > time)
+                time = acceleration_time;
+        }
+        motion->steps = (uint)ceilf(time * 1e6f / motion->period);
+    }
+    // The last step always sets the target angles, even for tiny moves
+    if(motion->steps == 0)
+        motion->steps = 1;
+    // Tangents are velocities multiplied by the motion duration
+    float duration = (float)motion->steps * motion->period / 1e6f;
+    for(uint i = 0; i < number; i++)
+        motion->start_tangents[i] = motors[i]->velocity * duration;
+    // Everything the fixed-point kernel needs, converted once per motion
+    for(uint i = 0; i < number; i++) {
+        float levels_per_degree = motors[i]->level_slope / 1024.0f;
+        motion->slices[i] = motors[i]->slice;
+        motion->channels[i] = motors[i]->channel;
+        motion->start_levels[i] = servo_angle_to_level(motors[i], motion->start_angles[i]);
+        motion->levels[i] = motion->start_levels[i];
+        motion->level_differences[i] = (int32_t)servo_angle_to_level(motors[i], angles[i]) - motion->start_levels[i];
+        motion->start_tangent_levels[i] = (int32_t)lroundf(motion->start_tangents[i] * levels_per_degree);
+        motion->end_tangent_levels[i] = 0;
+    }
+    motion->accel_fraction_q15 = (int32_t)lroundf(motion->accel_fraction * (1 << 15));
+    motion->cruise_velocity_q14 = (int32_t)lroundf((1 << 14) / (1 - motion->accel_fraction));
+}
+
+/**
+ * Let a prepared motion pass its target angles without stopping.
+ * Call before the first servos_motion_step().
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * @end_velocities: Velocities at target angles, in motion servo order (degrees/s)
+ */
+void servos_motion_blend(servos_motion* motion, const float* end_velocities) {
+    float duration = (float)motion->steps * motion->period / 1e6f;
+    for(uint i = 0; i < motion->number; i++) {
+        motion->end_velocities[i] = end_velocities[i];
+        motion->end_tangents[i] = end_velocities[i] * duration;
+        float levels_per_degree = motion->motors[i]->level_slope / 1024.0f;
+        motion->end_tangent_levels[i] = (int32_t)lroundf(motion->end_tangents[i] * levels_per_degree);
+        if(end_velocities[i] != 0)
+            motion->blended = true;
+    }
+}
+
+/**
+ * Calculate PWM levels of a motion step with the float kernel, without moving servos.
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * @step: Step to calculate, from 1 to motion->steps - 1
+ * @angles: Output angles in motion servo order, may be NULL
+ * @levels: Output PWM levels in motion servo order
+ */
+void servos_motion_levels_float(servos_motion* motion, uint step, float* angles, uint16_t* levels) {
+    float t = (float)step / motion->steps;
+    if(motion->blended) {
+        // Cubic Hermite basis, matches the start and end velocities of the motion
+        float t2 = t * t;
+        float t3 = t2 * t;
+        float h10 = t3 - 2 * t2 + t;
+        float h01 = 3 * t2 - 2 * t3;
+        float h11 = t3 - t2;
+        for(uint i = 0; i < motion->number; i++) {
+            float delta = motion->angle_differences[i] * h01 + motion->start_tangents[i] * h10 + motion->end_tangents[i] * h11;
+            float angle = motion->start_angles[i] + delta;
+            levels[i] = servo_angle_to_level(motion->motors[i], angle);
+            if(angles)
+                angles[i] = angle;
+        }
+        return;
+    }
+    float ratio;
+    if(motion->profile == SERVO_PROFILE_COSINE)
+        // Calculate the smooth transition ratio using a cosine function for easing effect
+        ratio = calculate_smooth_ratio(t);
+    else
+        ratio = calculate_profile_ratio(motion->profile, motion->accel_fraction, t);
+    // Set the servo angles based on the start angles and angle differences with ratio
+    for(uint i = 0; i < motion->number; i++) {
+        float angle = motion->start_angles[i] + motion->angle_differences[i] * ratio;
+        levels[i] = servo_angle_to_level(motion->motors[i], angle);
+        if(angles)
+            angles[i] = angle;
+    }
+}
+
+/**
+ * Calculate PWM levels of a motion step with the fixed-point kernel, without moving servos.
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * @step: Step to calculate, from 1 to motion->steps - 1
+ * @levels: Output PWM levels in motion servo order
+ */
+void servos_motion_levels_fixed(servos_motion* motion, uint step, uint16_t* levels) {
+    int32_t t = (int32_t)(((uint32_t)step << 15) / motion->steps);
+    if(motion->blended) {
+        // Cubic Hermite basis in Q15
+        int32_t t2 = (t * t) >> 15;
+        int32_t t3 = (t2 * t) >> 15;
+        int32_t h10 = t3 - 2 * t2 + t;
+        int32_t h01 = 3 * t2 - 2 * t3;
+        int32_t h11 = t3 - t2;
+        for(uint i = 0; i < motion->number; i++) {
+            int32_t delta = motion->level_differences[i] * h01 + motion->start_tangent_levels[i] * h10
+                            + motion->end_tangent_levels[i] * h11;
+            levels[i] = motion->start_levels[i] + ((delta + (1 << 14)) >> 15);
+        }
+        return;
+    }
+    int32_t ratio = calculate_profile_ratio_q15(motion, t);
+    for(uint i = 0; i < motion->number; i++)
+        levels[i] = motion->start_levels[i] + ((motion->level_differences[i] * ratio + (1 << 14)) >> 15);
+}
+
+/**
+ * Perform the next step of a smooth motion.
+ * Servo angles only update at the last step with the fixed-point kernel.
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * 
+ * Return true if more steps remain, false once servos reached target angles.
+ */
+bool servos_motion_step(servos_motion* motion) {
+    if(motion->step >= motion->steps)
+        return false;
+    motion->step++;
+    if(motion->step < motion->steps) {
+        // Only the contiguous motion arrays are touched, servo levels catch up at the last step
+#if SERVO_FIXED_POINT
+        servos_motion_levels_fixed(motion, motion->step, motion->levels);
+#else
+        float angles[SERVO_MOTION_MAX_SERVOS];
+        servos_motion_levels_float(motion, motion->step, angles, motion->levels);
+        for(uint i = 0; i < motion->number; i++)
+            motion->motors[i]->angle = angles[i];
+#endif
+        servos_commit_levels(motion->number, motion->slices, motion->channels, motion->levels);
+        return true;
+    }
+    servos_set_angle(motion->number, motion->motors, motion->target_angles);
+    for(uint i = 0; i < motion->number; i++)
+        motion->motors[i]->velocity = motion->end_velocities[i];
+    return false;
+}
+
+/**
+ * Perform the step of a smooth motion that is due at a time rather than simply the next one.
+ * The first step sets the deadlines, step k is due (k - 1) * motion->period us after it.
+ * A call half a period or more past the deadline is counted as a late step and skips the steps
+ * already due, so the motion still ends on time; an early call does nothing.
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * @now: Current time (us)
+ * 
+ * Return true if more steps remain, false once servos reached target angles.
+ */
+bool servos_motion_step_at(servos_motion* motion, uint32_t now) {
+    if(motion->step == 0) {
+        motion->start_us = now;
+        return servos_motion_step(motion);
+    }
+    if(motion->step >= motion->steps)
+        return false;
+    // Signed difference from the deadline of the next step, correct across timer wrap around
+    int32_t late = (int32_t)(now - motion->start_us - motion->step * motion->period);
+    int32_t half_period = (int32_t)(motion->period / 2);
+    if(late <= -half_period)
+        return true;
+    if(late >= half_period) {
+        arm_stats_record(ARM_STATS_STEP_LATE, (uint32_t)late);
+        uint skipped = ((uint32_t)late + motion->period / 2) / motion->period;
+        motion->step = motion->step + skipped < motion->steps ? motion->step + skipped : motion->steps - 1;
+    }
+    return servos_motion_step(motion);
+}
+
+// Angles of the servos of a motion at a step, the start and target angles at both ends
+static void servos_motion_angles(servos_motion* motion, uint step, float* angles) {
+    if(step == 0 || step >= motion->steps) {
+        for(uint i = 0; i < motion->number; i++)
+            angles[i] = step == 0 ? motion->start_angles[i] : motion->target_angles[i];
+        return;
+    }
+    uint16_t levels[SERVO_MOTION_MAX_SERVOS];
+    servos_motion_levels_float(motion, step, angles, levels);
+}
+
+// Stretch a blended motion until the Hermite curve accelerates within the limits of every servo
+static void servos_motion_fit_blend(servos_motion* motion) {
+    uint steps = motion->steps;
+    for(uint attempt = 0; attempt < 32; attempt++) {
+        float duration = (float)steps * motion->period / 1e6f;
+        bool fits = true;
+        for(uint i = 0; i < motion->number; i++) {
+            servo* motor = motion->motors[i];
+            if(motor->max_acceleration <= 0)
+                continue;
+            // Acceleration of the curve at its start and end, the largest along it
+            float delta = motion->angle_differences[i];
+            float start = fabsf(6 * delta - 4 * motor->velocity * duration - 2 * motion->end_velocities[i] * duration);
+            float end = fabsf(6 * delta - 2 * motor->velocity * duration - 4 * motion->end_velocities[i] * duration);
+            if(fmaxf(start, end) > motor->max_acceleration * duration * duration)
+                fits = false;
+        }
+        if(fits)
+            break;
+        steps += steps / 4 + 1;
+    }
+    if(steps == motion->steps)
+        return;
+    motion->steps = steps;
+    float duration = (float)steps * motion->period / 1e6f;
+    for(uint i = 0; i < motion->number; i++) {
+        float levels_per_degree = motion->motors[i]->level_slope / 1024.0f;
+        motion->start_tangents[i] = motion->motors[i]->velocity * duration;
+        motion->end_tangents[i] = motion->end_velocities[i] * duration;
+        motion->start_tangent_levels[i] = (int32_t)lroundf(motion->start_tangents[i] * levels_per_degree);
+        motion->end_tangent_levels[i] = (int32_t)lroundf(motion->end_tangents[i] * levels_per_degree);
+    }
+}
+
+/**
+ * Calculate angles and velocities of the servos of a motion at a step, without moving servos.
+ * 
+ * @motion: Motion prepared by servos_motion_start()
+ * @step: Step to calculate, from 0 to motion->steps
+ * @angles: Output angles in motion servo order
+ * @velocities: Output velocities in motion servo order (degrees/s), may be NULL
+ */
+void servos_motion_state(servos_motion* motion, uint step, float* angles, float* velocities) {
+    if(step > motion->steps)
+        step = motion->steps;
+    servos_motion_angles(motion, step, angles);
+    if(!velocities)
+        return;
+    if(step >= motion->steps) {
+        for(uint i = 0; i < motion->number; i++)
+            velocities[i] = motion->end_velocities[i];
+        return;
+    }
+    // Central difference over the neighbouring steps
+    uint before = step > 0 ? step - 1 : 0;
+    uint after = step + 1;
+    float before_angles[SERVO_MOTION_MAX_SERVOS];
+    float after_angles[SERVO_MOTION_MAX_SERVOS];
+    servos_motion_angles(motion, before, before_angles);
+    servos_motion_angles(motion, after, after_angles);
+    float time = (float)(after - before) * motion->period / 1e6f;
+    for(uint i = 0; i < motion->number; i++)
+        velocities[i] = (after_angles[i] - before_angles[i]) / time;
+}
+
+/**
+ * Redirect a motion in progress to new target angles, continuing from the angles and velocities
+ * its servos have at the current step. Servos of the motion missing from motors keep their target.
+ * The motion restarts at step 0 with a blended curve slow enough for the acceleration limits.
+ * 
+ * @motion: Motion prepared by servos_motion_start(), possibly partly performed
+ * @number: Number of servos to redirect
+ * @motors: Servos to redirect, may include servos not in the motion yet
+ * @angles: New target angles in degrees
+ */
+void servos_motion_retarget(servos_motion* motion, uint number, servo** motors, const float* angles) {
+    float angles_now[SERVO_MOTION_MAX_SERVOS];
+    float velocities_now[SERVO_MOTION_MAX_SERVOS];
+    servos_motion_state(motion, motion->step, angles_now, velocities_now);
+    servo* all[SERVO_MOTION_MAX_SERVOS];
+    float targets[SERVO_MOTION_MAX_SERVOS];
+    uint count = 0;
+    for(uint i = 0; i < number && count < SERVO_MOTION_MAX_SERVOS; i++) {
+        all[count] = motors[i];
+        targets[count++] = angles[i];
+    }
+    for(uint i = 0; i < motion->number; i++) {
+        bool redirected = false;
+        for(uint j = 0; j < number; j++)
+            redirected |= motors[j] == motion->motors[i];
+        if(!redirected && count < SERVO_MOTION_MAX_SERVOS) {
+            all[count] = motion->motors[i];
+            targets[count++] = motion->target_angles[i];
+        }
+    }
+    // The new motion starts where the old one is now, moving as fast as it does now
+    for(uint i = 0; i < motion->number; i++) {
+        motion->motors[i]->angle = angles_now[i];
+        motion->motors[i]->velocity = velocities_now[i];
+    }
+    servos_motion_start(motion, count, all, targets);
+    if(motion->blended)
+        servos_motion_fit_blend(motion);
+}
+
+/**
+ * Bring a motion in progress to a smooth stop, each servo decelerating at its acceleration limit.
+ * 
+ * @motion: Motion prepared by servos_motion_start(), possibly partly performed
+ */
+void servos_motion_stop(servos_motion* motion) {
+    float angles_now[SERVO_MOTION_MAX_SERVOS];
+    float velocities_now[SERVO_MOTION_MAX_SERVOS];
+    servos_motion_state(motion, motion->step, angles_now, velocities_now);
+    servo* motors[SERVO_MOTION_MAX_SERVOS];
+    float targets[SERVO_MOTION_MAX_SERVOS];
+    for(uint i = 0; i < motion->number; i++) {
+        servo* motor = motion->motors[i];
+        float velocity = velocities_now[i];
+        motors[i] = motor;
+        // Braking distance v^2 / 2a, servos without limits stop where they are
+        targets[i] = angles_now[i];
+        if(motor->max_acceleration > 0)
+            targets[i] += velocity * fabsf(velocity) / (2 * motor->max_acceleration);
+        targets[i] = fminf(fmaxf(targets[i], motor->angle_lower_bound), motor->angle_upper_bound);
+    }
+    servos_motion_retarget(motion, motion->number, motors, targets);
+}
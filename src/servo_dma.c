@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pwm.h"
+#include "hardware/sync.h"
+#include "servo_dma.h"
+#include "arm_trace.h"
+
+
+// Playbacks moving servos, read by the refill interrupt; a slot is set under SERVO_DMA_SPIN_LOCK
+// and cleared by a single store when its playback finishes
+static servos_dma_playback* volatile servos_dma_active[SERVO_DMA_MAX_PLAYBACKS];
+static bool servos_dma_irq_installed = false;
+
+// Number of steps in a block, the last block may be shorter
+static uint servos_dma_block_length(servos_dma_playback* playback, uint block) {
+    uint remaining = playback->motion.steps - block * SERVO_DMA_BLOCK_STEPS;
+    return remaining < SERVO_DMA_BLOCK_STEPS ? remaining : SERVO_DMA_BLOCK_STEPS;
+}
+
+// Calculate the compare words of every slice for the steps of a block into a buffer
+static void servos_dma_fill(servos_dma_playback* playback, uint buffer, uint block) {
+    servos_motion* motion = &playback->motion;
+    uint length = servos_dma_block_length(playback, block);
+    uint16_t levels[SERVO_MOTION_MAX_SERVOS];
+    for(uint k = 0; k < length; k++) {
+        uint step = block * SERVO_DMA_BLOCK_STEPS + k + 1;
+        if(step < motion->steps) {
+#if SERVO_FIXED_POINT
+            servos_motion_levels_fixed(motion, step, levels);
+#else
+            servos_motion_levels_float(motion, step, NULL, levels);
+#endif
+        }
+        else {
+            // The last step lands exactly on the target angles
+            for(uint i = 0; i < motion->number; i++)
+                levels[i] = servo_angle_to_level(motion->motors[i], motion->target_angles[i]);
+        }
+        for(uint s = 0; s < playback->slices; s++)
+            playback->buffers[buffer][s][k] = playback->compares[s];
+        for(uint i = 0; i < motion->number; i++) {
+            uint32_t* compare = &playback->buffers[buffer][playback->slots[i]][k];
+            uint shift = motion->channels[i] ? PWM_CH0_CC_B_LSB : PWM_CH0_CC_A_LSB;
+            *compare = (*compare & ~(0xFFFFu << shift)) | ((uint32_t)levels[i] << shift);
+        }
+    }
+}
+
+// Point the channels of a buffer at a block without starting them
+static void servos_dma_arm(servos_dma_playback* playback, uint buffer, uint block) {
+    uint length = servos_dma_block_length(playback, block);
+    for(uint s = 0; s < playback->slices; s++) {
+        uint channel = playback->channels[s][buffer];
+        uint slice_num = playback->slice_nums[s];
+        dma_channel_config config = dma_channel_get_default_config(channel);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+        channel_config_set_read_increment(&config, true);
+        channel_config_set_write_increment(&config, false);
+        // One compare word per PWM period, latched by the slice at its next wrap
+        channel_config_set_dreq(&config, pwm_get_dreq(slice_num));
+        // Chain to the other buffer only if another block follows, chaining to itself stops
+        if(block + 1 < playback->blocks)
+            channel_config_set_chain_to(&config, playback->channels[s][buffer ^ 1]);
+        else
+            channel_config_set_chain_to(&config, channel);
+        dma_channel_configure(channel, &config, &pwm_hw->slice[slice_num].cc,
+                              playback->buffers[buffer][s], length, false);
+    }
+}
+
+// Update servos to the end of the motion once the last compare words were transferred
+static void servos_dma_finish(servos_dma_playback* playback) {
+    servos_motion* motion = &playback->motion;
+    for(uint i = 0; i < motion->number; i++) {
+        servo_stage_angle(motion->motors[i], motion->target_angles[i]);
+        motion->motors[i]->velocity = motion->end_velocities[i];
+    }
+    motion->step = motion->steps;
+    servos_dma_active[playback->active_slot] = NULL;
+    playback->active_slot = -1;
+    playback->busy = false;
+}
+
+// Refill a buffer of a playback once every slice finished its block, the other buffer keeps playing meanwhile
+static void servos_dma_service(servos_dma_playback* playback) {
+    for(uint buffer = 0; buffer < 2; buffer++) {
+        for(uint s = 0; s < playback->slices; s++) {
+            uint channel = playback->channels[s][buffer];
+            if(!dma_irqn_get_channel_status(SERVO_DMA_IRQ_INDEX, channel))
+                continue;
+            dma_irqn_acknowledge_channel(SERVO_DMA_IRQ_INDEX, channel);
+            playback->channels_done[buffer]++;
+        }
+        if(playback->channels_done[buffer] < playback->slices)
+            continue;
+        playback->channels_done[buffer] = 0;
+        playback->blocks_done++;
+        if(playback->next_block < playback->blocks) {
+            servos_dma_fill(playback, buffer, playback->next_block);
+            servos_dma_arm(playback, buffer, playback->next_block);
+            playback->next_block++;
+        }
+        if(playback->blocks_done == playback->blocks) {
+            servos_dma_finish(playback);
+            return;
+        }
+    }
+}
+
+// Service every running playback, each only acknowledges its own channels
+static void servos_dma_irq_handler(void) {
+    for(uint p = 0; p < SERVO_DMA_MAX_PLAYBACKS; p++) {
+        servos_dma_playback* playback = servos_dma_active[p];
+        if(playback)
+            servos_dma_service(playback);
+    }
+}
+
+// Free slot in the list of running playbacks, -1 if none is free or a running playback
+// drives a slice of this one, its compare words would overwrite ours
+static int servos_dma_free_slot(servos_dma_playback* playback) {
+    int free_slot = -1;
+    for(int p = 0; p < SERVO_DMA_MAX_PLAYBACKS; p++) {
+        servos_dma_playback* other = servos_dma_active[p];
+        if(!other) {
+            if(free_slot < 0)
+                free_slot = p;
+            continue;
+        }
+        for(uint s = 0; s < playback->slices; s++) {
+            for(uint t = 0; t < other->slices; t++) {
+                if(other->slice_nums[t] == playback->slice_nums[s])
+                    return -1;
+            }
+        }
+    }
+    return free_slot;
+}
+
+
+/**
+ * Claim two DMA channels for every PWM slice of servos and install the refill interrupt.
+ * Call on the core that owns the servos, after servos_init().
+ * 
+ * @playback: Playback to initialize
+ * @number: Number of servos the playback may move
+ * @motors: Servos the playback may move
+ * 
+ * Return false if servos have different PWM periods, there are too many slices
+ * or not enough free DMA channels.
+ */
+bool servos_dma_init(servos_dma_playback* playback, uint number, servo** motors) {
+    playback->slices = 0;
+    playback->busy = false;
+    playback->tracing = false;
+    playback->active_slot = -1;
+    playback->period = number > 0 ? motors[0]->period : 0;
+    for(uint i = 0; i < number; i++) {
+        if(motors[i]->period != playback->period) {
+            fprintf(stderr, "Servo DMA playback needs the same PWM period for all servos.\n");
+            return false;
+        }
+        uint s = 0;
+        while(s < playback->slices && playback->slice_nums[s] != motors[i]->slice)
+            s++;
+        if(s < playback->slices)
+            continue;
+        if(playback->slices == SERVO_DMA_MAX_SLICES) {
+            fprintf(stderr, "Too many PWM slices for servo DMA playback.\n");
+            playback->slices = 0;
+            return false;
+        }
+        playback->slice_nums[playback->slices++] = motors[i]->slice;
+    }
+    for(uint s = 0; s < playback->slices; s++) {
+        playback->channels[s][0] = dma_claim_unused_channel(false);
+        playback->channels[s][1] = dma_claim_unused_channel(false);
+        if(playback->channels[s][0] < 0 || playback->channels[s][1] < 0) {
+            fprintf(stderr, "Not enough free DMA channels for servo playback.\n");
+            // Give back the channels claimed so far
+            for(uint r = 0; r <= s; r++) {
+                for(uint buffer = 0; buffer < 2; buffer++) {
+                    if(playback->channels[r][buffer] >= 0)
+                        dma_channel_unclaim(playback->channels[r][buffer]);
+                }
+            }
+            playback->slices = 0;
+            return false;
+        }
+        dma_irqn_set_channel_enabled(SERVO_DMA_IRQ_INDEX, playback->channels[s][0], true);
+        dma_irqn_set_channel_enabled(SERVO_DMA_IRQ_INDEX, playback->channels[s][1], true);
+    }
+    if(!servos_dma_irq_installed) {
+        irq_add_shared_handler(DMA_IRQ_0 + SERVO_DMA_IRQ_INDEX, servos_dma_irq_handler,
+                               PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_0 + SERVO_DMA_IRQ_INDEX, true);
+        servos_dma_irq_installed = true;
+    }
+    return true;
+}
+
+/**
+ * Play a prepared motion by DMA, each PWM wrap loads the compare values of the next step.
+ * Returns immediately, the CPU only refills a buffer every SERVO_DMA_BLOCK_STEPS steps.
+ * Servo angles, levels and velocities update when the last step was transferred.
+ * Up to SERVO_DMA_MAX_PLAYBACKS playbacks run at the same time if they drive different slices.
+ * Channels of the slices outside the motion are held at their level from when it started,
+ * so servos moved by other means must not share a slice with a running playback.
+ * 
+ * @playback: Playback initialized by servos_dma_init()
+ * @motion: Motion prepared by servos_motion_start(), not stepped yet
+ * 
+ * Return false if this playback is running, another running playback drives one of its slices,
+ * SERVO_DMA_MAX_PLAYBACKS are running, or the motion does not fit the claimed slices
+ * or steps at a different rate than the PWM period.
+ */
+bool servos_dma_play(servos_dma_playback* playback, const servos_motion* motion) {
+    if(playback->busy || playback->slices == 0)
+        return false;
+    if(motion->steps == 0 || motion->step != 0 || motion->period != playback->period)
+        return false;
+    for(uint i = 0; i < motion->number; i++) {
+        uint s = 0;
+        while(s < playback->slices && playback->slice_nums[s] != motion->motors[i]->slice)
+            s++;
+        if(s == playback->slices)
+            return false;
+        playback->slots[i] = s;
+    }
+    // Arms on either core may start playbacks, the interrupt only sees the slot once it is set
+    spin_lock_t* lock = spin_lock_instance(SERVO_DMA_SPIN_LOCK);
+    uint32_t interrupts = spin_lock_blocking(lock);
+    int slot = servos_dma_free_slot(playback);
+    if(slot >= 0)
+        servos_dma_active[slot] = playback;
+    spin_unlock(lock, interrupts);
+    if(slot < 0)
+        return false;
+    playback->active_slot = slot;
+    playback->motion = *motion;
+    for(uint i = 0; i < motion->number; i++)
+        playback->traced[i] = motion->motors[i]->level;
+    playback->tracing = true;
+    // Slices also carry channels outside the motion, they keep their current level
+    for(uint s = 0; s < playback->slices; s++)
+        playback->compares[s] = pwm_hw->slice[playback->slice_nums[s]].cc;
+    playback->blocks = (motion->steps + SERVO_DMA_BLOCK_STEPS - 1) / SERVO_DMA_BLOCK_STEPS;
+    playback->blocks_done = 0;
+    playback->channels_done[0] = 0;
+    playback->channels_done[1] = 0;
+    playback->next_block = 0;
+    // Fill both buffers up front, short moves are then completely precomputed
+    while(playback->next_block < playback->blocks && playback->next_block < 2) {
+        servos_dma_fill(playback, playback->next_block, playback->next_block);
+        servos_dma_arm(playback, playback->next_block, playback->next_block);
+        playback->next_block++;
+    }
+    uint32_t channel_mask = 0;
+    for(uint s = 0; s < playback->slices; s++)
+        channel_mask |= 1u << playback->channels[s][0];
+    playback->busy = true;
+    __mem_fence_release();
+    // Slices wrap in phase, so starting every first channel together keeps all servos on the same step
+    dma_start_channel_mask(channel_mask);
+    return true;
+}
+
+/**
+ * Check whether a playback is still moving servos.
+ * 
+ * @playback: Playback to check
+ */
+bool servos_dma_is_busy(servos_dma_playback* playback) {
+    return playback->busy;
+}
+
+/**
+ * Record the levels the PWM slices latched for the motion servos in the PWM trace, only those
+ * that changed since the last call. DMA writes the compare words without the CPU, so call this
+ * once per PWM period while the playback is busy and once more after it finished, e.g. from
+ * the motion tick, to keep the trace free of gaps. Does nothing when the trace is compiled out.
+ * 
+ * @playback: Playback to trace
+ */
+void servos_dma_trace(servos_dma_playback* playback) {
+#if ARM_TRACE_ENABLED
+    if(!playback->tracing)
+        return;
+    // Read busy first, the levels read after it finished include the last step
+    bool busy = playback->busy;
+    __mem_fence_acquire();
+    servos_motion* motion = &playback->motion;
+    for(uint i = 0; i < motion->number; i++) {
+        uint32_t compare = pwm_hw->slice[playback->slice_nums[playback->slots[i]]].cc;
+        uint16_t level = (uint16_t)(compare >> (motion->channels[i] ? PWM_CH0_CC_B_LSB : PWM_CH0_CC_A_LSB));
+        if(level == playback->traced[i])
+            continue;
+        arm_trace_record(motion->motors[i]->slice * 2 + motion->channels[i], level);
+        playback->traced[i] = level;
+    }
+    playback->tracing = busy;
+#else
+    (void)playback;
+#endif
+}
+
+/**
+ * Stop a playback where it is and release its DMA channels.
+ * Servo angles stay at the start of a stopped motion, set them again before moving.
+ * 
+ * @playback: Playback initialized by servos_dma_init()
+ */
+void servos_dma_release(servos_dma_playback* playback) {
+    uint32_t channel_mask = 0;
+    for(uint s = 0; s < playback->slices; s++) {
+        for(uint buffer = 0; buffer < 2; buffer++) {
+            dma_irqn_set_channel_enabled(SERVO_DMA_IRQ_INDEX, playback->channels[s][buffer], false);
+            channel_mask |= 1u << playback->channels[s][buffer];
+        }
+    }
+    // Abort both buffers at once so neither chains into the other
+    dma_hw->abort = channel_mask;
+    while(dma_hw->abort & channel_mask)
+        tight_loop_contents();
+    for(uint s = 0; s < playback->slices; s++) {
+        for(uint buffer = 0; buffer < 2; buffer++) {
+            dma_irqn_acknowledge_channel(SERVO_DMA_IRQ_INDEX, playback->channels[s][buffer]);
+            dma_channel_unclaim(playback->channels[s][buffer]);
+        }
+    }
+    if(playback->active_slot >= 0)
+        servos_dma_active[playback->active_slot] = NULL;
+    playback->active_slot = -1;
+    playback->slices = 0;
+    playback->tracing = false;
+    playback->busy = false;
+}
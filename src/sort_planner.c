@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <math.h>
+#include "pico/stdlib.h"
+#include "sort_planner.h"
+
+
+// Move the planned pose through a segment and return the joint travel (degrees)
+static float planner_apply(float* pose, const robotic_arm_segment* segment) {
+    float travel = 0.0f;
+    for(uint8_t i = 0; i < segment->number; i++) {
+        uint8_t index = segment->indexes[i];
+        if(index >= SORT_PLANNER_SERVOS)
+            continue;
+        travel += fabsf(segment->angles[i] - pose[index]);
+        pose[index] = segment->angles[i];
+    }
+    return travel;
+}
+
+static float planner_apply_sequence(float* pose, const robotic_arm_sequence* sequence) {
+    float travel = 0.0f;
+    for(uint8_t i = 0; i < sequence->length; i++)
+        travel += planner_apply(pose, &sequence->segments[i]);
+    return travel;
+}
+
+// Segment to a cached pose, on the solution with the least joint travel from the planned pose
+static void planner_pose_segment(const sort_planner* planner, robotic_arm_segment* segment, const arm_ik_solution* solution) {
+    arm_kinematics_segment(segment, arm_kinematics_select(solution, planner->pose));
+    segment->flags = planner->segment_flags;
+}
+
+static void planner_servo_segment(const sort_planner* planner, robotic_arm_segment* segment, uint8_t index, float angle) {
+    segment->number = 1;
+    segment->indexes[0] = index;
+    segment->angles[0] = angle;
+    segment->hold_ms = 0;
+    segment->flags = planner->segment_flags;
+}
+
+// Plan the first count segments of an item from the planned pose, which follows them
+static float planner_build_item(sort_planner* planner, int command, robotic_arm_segment* segments, uint8_t count) {
+    const arm_ik_solution* pick = arm_pose_cache_get(planner->poses, SORT_POSE_PICK);
+    const arm_ik_solution* bin = arm_pose_cache_get(planner->poses, sort_pose_find(command));
+
+    // Straight from the previous drop (or home) to the intake, then lift clear and go to the bin.
+    // The gripper is already open, so no home visit is needed between items.
+    float travel = 0.0f;
+    planner_pose_segment(planner, &segments[0], pick);
+    segments[0].hold_ms = SORT_SEGMENT_HOLD_MS;
+    planner_servo_segment(planner, &segments[1], SORT_GRIPPER_SERVO, SORT_GRIPPER_CLOSED);
+    segments[1].hold_ms = SORT_SEGMENT_HOLD_MS;
+    planner_servo_segment(planner, &segments[2], 1, SORT_LIFT_ANGLE);
+    segments[2].flags |= ROBOTIC_ARM_SEGMENT_VIA;
+    for(uint8_t i = 0; i < 3; i++)
+        travel += planner_apply(planner->pose, &segments[i]);
+    for(uint8_t i = 0; i < SORT_PLANNER_SERVOS; i++)
+        planner->lift_pose[i] = planner->pose[i];
+    planner_pose_segment(planner, &segments[3], bin);
+    segments[3].hold_ms = SORT_SEGMENT_HOLD_MS;
+    travel += planner_apply(planner->pose, &segments[3]);
+    if(count < SORT_PLANNER_ITEM_SEGMENTS)
+        return travel;
+    planner_servo_segment(planner, &segments[4], SORT_GRIPPER_SERVO, SORT_GRIPPER_OPEN);
+    segments[4].hold_ms = SORT_SEGMENT_HOLD_MS;
+    travel += planner_apply(planner->pose, &segments[4]);
+    return travel;
+}
+
+// Travel of the fixed sequences for the same item, for comparison
+static void planner_add_fixed(sort_planner* planner, int command) {
+    planner->travel_fixed += planner_apply_sequence(planner->fixed_pose, &sort_sequence_pick);
+    planner->travel_fixed += planner_apply_sequence(planner->fixed_pose, sort_sequence_find(command));
+    planner->travel_fixed += planner_apply_sequence(planner->fixed_pose, &sort_sequence_throw);
+}
+
+/**
+ * Start planning from the current servo angles of a robotic arm.
+ * 
+ * @planner: Planner to initialize
+ * @poses: Pose cache built from sort_pose_points
+ * @robot: Robotic arm to plan for, must be idle
+ */
+void sort_planner_init(sort_planner* planner, const arm_pose_cache* poses, robotic_arm* robot) {
+    planner->poses = poses;
+    planner->segment_flags = 0;
+    for(uint8_t i = 0; i < SORT_PLANNER_SERVOS; i++) {
+        float angle = i < robot->number ? robot->servos[i].angle : 0.0f;
+        planner->pose[i] = angle;
+        planner->fixed_pose[i] = angle;
+    }
+    planner->parked = false;
+    planner->items = 0;
+    planner->travel_planned = 0.0f;
+    planner->travel_fixed = 0.0f;
+    planner->speculative = false;
+    planner->speculative_segment = 0;
+}
+
+/**
+ * Continue planning from the current servo angles after the arm was moved outside the planner.
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm, must be idle
+ */
+void sort_planner_sync(sort_planner* planner, robotic_arm* robot) {
+    for(uint8_t i = 0; i < SORT_PLANNER_SERVOS && i < robot->number; i++) {
+        planner->pose[i] = robot->servos[i].angle;
+        planner->fixed_pose[i] = robot->servos[i].angle;
+    }
+    planner->parked = false;
+}
+
+/**
+ * Check whether a command byte names a bin the planner can reach.
+ * 
+ * @planner: Planner
+ * @command: Command byte, 'a', 'm', 'g' or 'p' in any case
+ */
+bool sort_planner_is_valid(const sort_planner* planner, int command) {
+    sort_pose bin = sort_pose_find(command);
+    return bin != SORT_POSES &&
+           arm_pose_cache_get(planner->poses, bin) != NULL &&
+           arm_pose_cache_get(planner->poses, SORT_POSE_PICK) != NULL;
+}
+
+/**
+ * Queue one item: pick, lift, drop over the bin and release, starting from where
+ * the queued motions end. The arm stays over the bin afterwards, see sort_planner_park().
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm to queue segments to
+ * @command: Bin command byte, check it with sort_planner_is_valid() first
+ * 
+ * Return false without queueing anything if the command is invalid or the queue has no room.
+ */
+bool sort_planner_queue_item(sort_planner* planner, robotic_arm* robot, int command) {
+    // An item queued now would run before the release of the speculative one
+    if(planner->speculative || !sort_planner_is_valid(planner, command))
+        return false;
+    if(robotic_arm_queue_room(robot) < SORT_PLANNER_ITEM_SEGMENTS)
+        return false;
+    robotic_arm_segment segments[SORT_PLANNER_ITEM_SEGMENTS];
+    planner->travel_planned += planner_build_item(planner, command, segments, SORT_PLANNER_ITEM_SEGMENTS);
+    // Room was checked above and only this core queues, so every segment fits
+    for(uint8_t i = 0; i < SORT_PLANNER_ITEM_SEGMENTS; i++)
+        robotic_arm_queue_segment(robot, &segments[i]);
+    planner_add_fixed(planner, command);
+    planner->parked = false;
+    planner->items++;
+    return true;
+}
+
+/**
+ * Queue an item for a provisional bin: pick, lift and move over the bin, but keep holding it
+ * until sort_planner_confirm(). Only one speculative item can wait at a time.
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm to queue segments to
+ * @command: Provisional bin command byte, check it with sort_planner_is_valid() first
+ * 
+ * Return false without queueing anything if the command is invalid, the queue has no room
+ * or a speculative item is already waiting.
+ */
+bool sort_planner_queue_speculative(sort_planner* planner, robotic_arm* robot, int command) {
+    if(planner->speculative || !sort_planner_is_valid(planner, command))
+        return false;
+    if(robotic_arm_queue_room(robot) < SORT_PLANNER_ITEM_SEGMENTS - 1)
+        return false;
+    robotic_arm_segment segments[SORT_PLANNER_ITEM_SEGMENTS - 1];
+    planner->speculative_segment = robot->segments_queued;
+    planner->travel_planned += planner_build_item(planner, command, segments, SORT_PLANNER_ITEM_SEGMENTS - 1);
+    for(uint8_t i = 0; i < SORT_PLANNER_ITEM_SEGMENTS - 1; i++)
+        robotic_arm_queue_segment(robot, &segments[i]);
+    planner->speculative = true;
+    planner->parked = false;
+    return true;
+}
+
+/**
+ * Confirm the bin of the speculative item and queue its release. A different bin redirects
+ * the move over the bin while it runs, or moves on from the provisional bin if it already arrived.
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm the item was queued to
+ * @command: Final bin command byte, check it with sort_planner_is_valid() first
+ * 
+ * Return false if no speculative item waits, the command is invalid or the queue has no room.
+ */
+bool sort_planner_confirm(sort_planner* planner, robotic_arm* robot, int command) {
+    if(!planner->speculative || !sort_planner_is_valid(planner, command))
+        return false;
+    if(robotic_arm_queue_room(robot) < 2)
+        return false;
+    const arm_ik_solution* bin = arm_pose_cache_get(planner->poses, sort_pose_find(command));
+    float provisional[SORT_PLANNER_SERVOS];
+    for(uint8_t i = 0; i < SORT_PLANNER_SERVOS; i++)
+        provisional[i] = planner->pose[i];
+    // Redirect the bin move from the lift pose, it may still be waiting or running
+    robotic_arm_segment segment;
+    arm_kinematics_segment(&segment, arm_kinematics_select(bin, planner->lift_pose));
+    segment.flags = planner->segment_flags;
+    segment.hold_ms = SORT_SEGMENT_HOLD_MS;
+    bool same = true;
+    for(uint8_t i = 0; i < segment.number; i++)
+        same &= fabsf(segment.angles[i] - provisional[segment.indexes[i]]) < 0.01f;
+    if(!same) {
+        uint32_t bin_segment = planner->speculative_segment + SORT_PLANNER_ITEM_SEGMENTS - 2;
+        if(robotic_arm_retarget(robot, bin_segment, &segment)) {
+            // The provisional bin move is replaced, count the redirected one instead
+            float old_travel = 0.0f;
+            float new_travel = 0.0f;
+            for(uint8_t i = 0; i < segment.number; i++) {
+                uint8_t index = segment.indexes[i];
+                old_travel += fabsf(provisional[index] - planner->lift_pose[index]);
+                new_travel += fabsf(segment.angles[i] - planner->lift_pose[index]);
+            }
+            planner->travel_planned += new_travel - old_travel;
+            for(uint8_t i = 0; i < segment.number; i++)
+                planner->pose[segment.indexes[i]] = segment.angles[i];
+        }
+        else {
+            // Already over the provisional bin, move on to the final one from there
+            planner_pose_segment(planner, &segment, bin);
+            segment.hold_ms = SORT_SEGMENT_HOLD_MS;
+            robotic_arm_queue_segment(robot, &segment);
+            planner->travel_planned += planner_apply(planner->pose, &segment);
+        }
+    }
+    planner_servo_segment(planner, &segment, SORT_GRIPPER_SERVO, SORT_GRIPPER_OPEN);
+    segment.hold_ms = SORT_SEGMENT_HOLD_MS;
+    robotic_arm_queue_segment(robot, &segment);
+    planner->travel_planned += planner_apply(planner->pose, &segment);
+    planner_add_fixed(planner, command);
+    planner->speculative = false;
+    planner->items++;
+    return true;
+}
+
+/**
+ * Cancel the speculative item: drop its segments, brake the arm to a stop and, if the gripper
+ * already closed, put the item back at the pick pose. Blocks until the arm stopped.
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm the item was queued to
+ * 
+ * Return false if no speculative item waits.
+ */
+bool sort_planner_cancel(sort_planner* planner, robotic_arm* robot) {
+    if(!planner->speculative)
+        return false;
+    robotic_arm_cancel(robot, planner->speculative_segment);
+    robotic_arm_wait(robot);
+    for(uint8_t i = 0; i < SORT_PLANNER_SERVOS && i < robot->number; i++)
+        planner->pose[i] = robot->servos[i].angle;
+    planner->speculative = false;
+    if(planner->pose[SORT_GRIPPER_SERVO] <= SORT_GRIPPER_OPEN + 1.0f)
+        return true;
+    // Holding the item, put it back where it was picked
+    robotic_arm_segment segment;
+    planner_pose_segment(planner, &segment, arm_pose_cache_get(planner->poses, SORT_POSE_PICK));
+    segment.hold_ms = SORT_SEGMENT_HOLD_MS;
+    robotic_arm_queue_segment(robot, &segment);
+    planner->travel_planned += planner_apply(planner->pose, &segment);
+    planner_servo_segment(planner, &segment, SORT_GRIPPER_SERVO, SORT_GRIPPER_OPEN);
+    segment.hold_ms = SORT_SEGMENT_HOLD_MS;
+    robotic_arm_queue_segment(robot, &segment);
+    planner->travel_planned += planner_apply(planner->pose, &segment);
+    return true;
+}
+
+/**
+ * Queue a return to home unless the queued motions already end there.
+ * 
+ * @planner: Planner
+ * @robot: Robotic arm to queue the segment to
+ * 
+ * Return false if the queue has no room.
+ */
+bool sort_planner_park(sort_planner* planner, robotic_arm* robot) {
+    if(planner->parked)
+        return true;
+    const arm_ik_solution* home = arm_pose_cache_get(planner->poses, SORT_POSE_HOME);
+    if(home == NULL)
+        return true;
+    robotic_arm_segment segment;
+    planner_pose_segment(planner, &segment, home);
+    if(!robotic_arm_queue_segment(robot, &segment))
+        return false;
+    planner->travel_planned += planner_apply(planner->pose, &segment);
+    planner->parked = true;
+    return true;
+}
+
+/**
+ * Print the joint travel of the planned items and of the fixed sequences for the same items.
+ * 
+ * @planner: Planner
+ */
+void sort_planner_print(const sort_planner* planner) {
+    printf("Sort planner: %lu items, joint travel %.0f degrees planned, %.0f degrees with fixed sequences",
+           (unsigned long)planner->items, planner->travel_planned, planner->travel_fixed);
+    if(planner->travel_fixed > 0.0f)
+        printf(" (%.0f%%)", 100.0f * planner->travel_planned / planner->travel_fixed);
+    printf("\n");
+}
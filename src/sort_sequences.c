@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "sort_sequences.h"
+
+
+// Segment tables live in flash, playing them needs no parsing
+// Grasp and release points stop, lifting and returning home blend into the next segment
+static const robotic_arm_segment pick_segments[] = {
+    {.number = 3, .indexes = {0, 1, 2}, .angles = {150, 40, 126}, .hold_ms = SORT_SEGMENT_HOLD_MS},
+    {.number = 1, .indexes = {3},       .angles = {165},          .hold_ms = SORT_SEGMENT_HOLD_MS},
+    {.number = 1, .indexes = {1},       .angles = {90},           .flags = ROBOTIC_ARM_SEGMENT_VIA},
+    {.number = 1, .indexes = {0},       .angles = {90},           .flags = ROBOTIC_ARM_SEGMENT_VIA}
+};
+
+static const robotic_arm_segment throw_segments[] = {
+    {.number = 1, .indexes = {3},       .angles = {90},           .hold_ms = SORT_SEGMENT_HOLD_MS},
+    {.number = 3, .indexes = {0, 1, 2}, .angles = {90, 90, 90},   .flags = ROBOTIC_ARM_SEGMENT_VIA}
+};
+
+// Bin poses played for the A, M, G and P commands sent by camera2.py
+static const robotic_arm_segment bin_a_segments[] = {
+    {.number = 3, .indexes = {0, 1, 2}, .angles = {90, 65, 145},  .hold_ms = SORT_SEGMENT_HOLD_MS}
+};
+
+static const robotic_arm_segment bin_m_segments[] = {
+    {.number = 3, .indexes = {0, 1, 2}, .angles = {85, 25, 47},   .hold_ms = SORT_SEGMENT_HOLD_MS}
+};
+
+static const robotic_arm_segment bin_g_segments[] = {
+    {.number = 3, .indexes = {0, 1, 2}, .angles = {36, 65, 140},  .hold_ms = SORT_SEGMENT_HOLD_MS}
+};
+
+static const robotic_arm_segment bin_p_segments[] = {
+    {.number = 3, .indexes = {0, 1, 2}, .angles = {51, 30, 40},   .hold_ms = SORT_SEGMENT_HOLD_MS}
+};
+
+// The same gripper positions in millimetres, forward kinematics of the tuned angles above
+const arm_point sort_pose_points[SORT_POSES] = {
+    [SORT_POSE_HOME]  = {.x = 100.0f, .y =    0.0f, .z = 175.0f},
+    [SORT_POSE_PICK]  = {.x =  43.7f, .y =   75.7f, .z =  37.7f},
+    [SORT_POSE_BIN_A] = {.x =  61.7f, .y =    0.0f, .z =  66.7f},
+    [SORT_POSE_BIN_M] = {.x = 187.2f, .y =  -16.4f, .z =  76.9f},
+    [SORT_POSE_BIN_G] = {.x =  41.3f, .y =  -56.8f, .z =  68.6f},
+    [SORT_POSE_BIN_P] = {.x = 147.2f, .y = -119.2f, .z = 105.1f}
+};
+
+const robotic_arm_sequence sort_sequence_pick = ROBOTIC_ARM_SEQUENCE("pick", pick_segments);
+const robotic_arm_sequence sort_sequence_throw = ROBOTIC_ARM_SEQUENCE("throw", throw_segments);
+
+static const robotic_arm_sequence bin_a = ROBOTIC_ARM_SEQUENCE("a", bin_a_segments);
+static const robotic_arm_sequence bin_m = ROBOTIC_ARM_SEQUENCE("m", bin_m_segments);
+static const robotic_arm_sequence bin_g = ROBOTIC_ARM_SEQUENCE("g", bin_g_segments);
+static const robotic_arm_sequence bin_p = ROBOTIC_ARM_SEQUENCE("p", bin_p_segments);
+
+// Command byte to bin sequence, indexed directly by the received byte
+static const robotic_arm_sequence* const sort_registry[128] = {
+    ['a'] = &bin_a, ['A'] = &bin_a,
+    ['m'] = &bin_m, ['M'] = &bin_m,
+    ['g'] = &bin_g, ['G'] = &bin_g,
+    ['p'] = &bin_p, ['P'] = &bin_p
+};
+
+/**
+ * Find the bin sequence played for a command byte.
+ * 
+ * @command: Command byte received from serial, 'a', 'm', 'g' or 'p' in any case
+ * 
+ * Return NULL if command is not a bin command.
+ */
+const robotic_arm_sequence* sort_sequence_find(int command) {
+    if(command < 0 || command >= (int)(sizeof(sort_registry) / sizeof(sort_registry[0])))
+        return NULL;
+    return sort_registry[command];
+}
+
+/**
+ * Find the bin pose for a command byte.
+ * 
+ * @command: Command byte received from serial, 'a', 'm', 'g' or 'p' in any case
+ * 
+ * Return SORT_POSES if command is not a bin command.
+ */
+sort_pose sort_pose_find(int command) {
+    switch(command | 0x20) {
+        case 'a': return SORT_POSE_BIN_A;
+        case 'm': return SORT_POSE_BIN_M;
+        case 'g': return SORT_POSE_BIN_G;
+        case 'p': return SORT_POSE_BIN_P;
+        default: return SORT_POSES;
+    }
+}
@@ -0,0 +1,163 @@
+"""解碼韌體 PWM 追蹤資料（格式見 src/include/arm_trace.h），輸出 CSV、各軸時間軸或抖動摘要
+
+用法：
+    python tools/trace_decode.py trace.bin                  # CSV：time_us,output,level,segment
+    python tools/trace_decode.py trace.bin --timeline       # 每個時間點各輸出的 level
+    python tools/trace_decode.py trace.bin --summary        # 各輸出寫入間隔統計
+    python tools/trace_decode.py --port /dev/tty.usbmodem1 -o trace.bin   # 送出 '&' 並存下追蹤資料
+"""
+import argparse
+import struct
+import sys
+import time
+
+TRACE_MAGIC = b"ATRC"
+TRACE_VERSION = 1
+TRACE_OUTPUT_MASK = 0x0F
+TRACE_SEGMENT = 0x10
+TRACE_ABSOLUTE = 0x20
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, pos
+        shift += 7
+
+def decode_trace(blob):
+    """回傳 (time_us, output, level, segment) 串列，時間為韌體 time_us_32()，跨越溢位時繼續遞增"""
+    start = blob.find(TRACE_MAGIC)
+    if start < 0:
+        raise ValueError("找不到追蹤資料開頭 ATRC")
+    version, block_size, block_count = struct.unpack_from("<BHH", blob, start + 4)
+    if version != TRACE_VERSION:
+        raise ValueError(f"不支援的追蹤格式版本 {version}")
+    pos = start + 9
+    records = []
+    last_time = None
+    epoch = 0
+    for _ in range(block_count):
+        block_time, segment, used = struct.unpack_from("<IIH", blob, pos)
+        pos += 10
+        end = pos + used
+        if end > len(blob) or used > block_size:
+            raise ValueError("追蹤資料不完整")
+        # 每個區塊各自從絕對時間與絕對 level 開始，可以獨立解碼
+        levels = {}
+        now = block_time
+        while pos < end:
+            header = blob[pos]
+            pos += 1
+            delta, pos = read_varint(blob, pos)
+            now = (now + delta) & 0xFFFFFFFF
+            if header & TRACE_SEGMENT:
+                segment, pos = read_varint(blob, pos)
+            value, pos = read_varint(blob, pos)
+            output = header & TRACE_OUTPUT_MASK
+            if header & TRACE_ABSOLUTE:
+                level = value
+            else:
+                level = levels[output] + ((value >> 1) ^ -(value & 1))
+            levels[output] = level
+            if last_time is not None and now < last_time and last_time - now > 0x80000000:
+                epoch += 1 << 32
+            last_time = now
+            records.append((epoch + now, output, level, segment))
+    return records
+
+def read_from_port(port, timeout):
+    import serial
+    with serial.Serial(port, 115200, timeout=0.2) as ser:
+        ser.reset_input_buffer()
+        ser.write(b"&")
+        blob = b""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            blob += ser.read(4096)
+            start = blob.find(TRACE_MAGIC)
+            if start < 0 or len(blob) < start + 9:
+                continue
+            # 依區塊標頭逐一確認資料是否已收齊
+            _, _, block_count = struct.unpack_from("<BHH", blob, start + 4)
+            pos = start + 9
+            complete = True
+            for _ in range(block_count):
+                if len(blob) < pos + 10:
+                    complete = False
+                    break
+                pos += 10 + struct.unpack_from("<H", blob, pos + 8)[0]
+            if complete and len(blob) >= pos:
+                return blob[start:pos]
+    raise TimeoutError("等待追蹤資料逾時")
+
+def write_csv(records, out):
+    out.write("time_us,output,level,segment\n")
+    for t, output, level, segment in records:
+        out.write(f"{t},{output},{level},{segment}\n")
+
+def write_timeline(records, out):
+    """同一時間的寫入合併成一列，沒有寫入的輸出沿用上一個 level"""
+    outputs = sorted({r[1] for r in records})
+    out.write("time_us,segment," + ",".join(f"out{o}" for o in outputs) + "\n")
+    current = {}
+    i = 0
+    while i < len(records):
+        t = records[i][0]
+        segment = records[i][3]
+        while i < len(records) and records[i][0] == t:
+            current[records[i][1]] = records[i][2]
+            segment = records[i][3]
+            i += 1
+        out.write(f"{t},{segment}," + ",".join(str(current.get(o, "")) for o in outputs) + "\n")
+
+def write_summary(records, out):
+    """各輸出相鄰兩次寫入的間隔，用來檢查步進抖動"""
+    by_output = {}
+    for t, output, _, _ in records:
+        by_output.setdefault(output, []).append(t)
+    for output in sorted(by_output):
+        times = by_output[output]
+        gaps = [b - a for a, b in zip(times, times[1:])]
+        if not gaps:
+            out.write(f"out{output}: {len(times)} writes\n")
+            continue
+        gaps.sort()
+        median = gaps[len(gaps) // 2]
+        out.write(f"out{output}: {len(times)} writes, interval min {gaps[0]} us, "
+                  f"median {median} us, max {gaps[-1]} us\n")
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a PWM trace dump of the robotic arm firmware")
+    parser.add_argument("input", nargs="?", help="trace dump file, omit with --port")
+    parser.add_argument("--port", help="serial port to request the dump from")
+    parser.add_argument("--timeout", type=float, default=5.0, help="seconds to wait for the dump")
+    parser.add_argument("-o", "--output", help="save the raw dump read from --port")
+    parser.add_argument("--timeline", action="store_true", help="one row per time with the level of every output")
+    parser.add_argument("--summary", action="store_true", help="write interval statistics per output")
+    args = parser.parse_args()
+
+    if args.port:
+        blob = read_from_port(args.port, args.timeout)
+        if args.output:
+            with open(args.output, "wb") as f:
+                f.write(blob)
+    elif args.input:
+        with open(args.input, "rb") as f:
+            blob = f.read()
+    else:
+        parser.error("需要輸入檔或 --port")
+
+    records = decode_trace(blob)
+    if args.summary:
+        write_summary(records, sys.stdout)
+    elif args.timeline:
+        write_timeline(records, sys.stdout)
+    else:
+        write_csv(records, sys.stdout)
+
+if __name__ == "__main__":
+    main()